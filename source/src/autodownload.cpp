@@ -4,19 +4,25 @@
 #include "cube.h"
 #define DEBUGCOND (autodownloaddebug == 1)
 
+#define DLCACHEHEXSIZE (2 * TIGERHASHSIZE + 1)
+
+struct pckhash { char hex[DLCACHEHEXSIZE]; };
+
 struct pckserver
 {
     string host;
     int priority, ping, resolved;
     hashtable<const char *, int> updates;
+    hashtable<const char *, pckhash> hashes;  // optional content hashes from updates.txt
     pckserver() { memset(&host, 0, (char *)&updates - (char *)&host); }
 };
 
 struct package
 {
-    string name, fullpath, requestname, host;
+    string name, fullpath, requestname, host, dllog;
     int type, iszip, strictnames, server;
     const char **exts;
+    stream *data;                           // downloaded, but not yet processed
     package() { memset(&name, 0, sizeof(struct package)); }
 };
 
@@ -68,6 +74,26 @@ SDL_mutex *pckpinglog_lock; // auxilliary locking for pckping_log
 vector<char> pckping_log; // access controlled by sem_pckservers (and pckpinglog_lock)
 const char *updatestxt = "/updates.txt";
 
+void parseupdatehashes(hashtable<const char *, pckhash> &ht, const char *buf) // optional third column of updates.txt: tiger hash of the package file
+{
+    string line, name, rev, hex;
+    uchar hash[TIGERHASHSIZE];
+    pckhash ph;
+    for(const char *l = buf; *l; l += *l ? 1 : 0)
+    {
+        int len = (int)strcspn(l, "\n");
+        copystring(line, l, min(len + 1, MAXSTRLEN));
+        l += len;
+        if(sscanf(line, "%259s %259s %259s", name, rev, hex) == 3 && strlen(hex) == 2 * TIGERHASHSIZE && hex2bin(hash, hex, TIGERHASHSIZE) == TIGERHASHSIZE)
+        {
+            bin2hex(ph.hex, hash, TIGERHASHSIZE);
+            pckhash *p = ht.access(name);
+            if(p) *p = ph;
+            else ht.access(newstring(name), ph);
+        }
+    }
+}
+
 int pingpckserver(void *data) // fetch updates.txt from a media server, measure required time
 {
     httpget h;
@@ -100,6 +126,8 @@ int pingpckserver(void *data) // fetch updates.txt from a media server, measure
                 { // parse updates.txt
                     h.outvec->add('\0');
                     s->updates.clear();
+                    s->hashes.clear();
+                    parseupdatehashes(s->hashes, (char *)h.outvec->getbuf());
                     parseupdatelist(s->updates, (char *)h.outvec->getbuf()); // don't filter entries
                     SDL_mutexP(pckpinglog_lock);
                     cvecprintf(pckping_log, "lgot %s:%d%s: %d bytes, %d valid update lines\n", u.domain, h.ip.port, url, res, s->updates.numelems);
@@ -203,7 +231,7 @@ const char *mmexts[] = { ".md2", ".md3", ".cfg", ".txt", ".jpg", ".png", "" },
            *mapexts[] = { ".cgz", ".cfg", "" },
            *sbexts[] = { "_lf.jpg", "_rt.jpg", "_ft.jpg", "_bk.jpg", "_dn.jpg", "_up.jpg", "_license.txt", "" };
 
-bool requirepackage(int type, const char *name, const char *host)
+package *newpackage(int type, const char *name, const char *host)
 {
     const char *prefix = NULL, *checkprefix = NULL, *forceext = NULL;
     package *pck = new package;
@@ -247,7 +275,7 @@ bool requirepackage(int type, const char *name, const char *host)
         default:
             conoutf("\f3requirepackage: illegal package type %d (\"%s\")", type, name); // should probably be fatal()
             delete pck;
-            return false;
+            return NULL;
     }
     string upath;
     copystring(upath, name);
@@ -257,19 +285,25 @@ bool requirepackage(int type, const char *name, const char *host)
     {
         conoutf("\f3requirepackage: illegal media path \"%s\" (type: %d)", name, type);
         delete pck;
-        return false;
+        return NULL;
     }
     if(forceext && strlen(pck->name) > strlen(forceext) && !strcmp(pck->name + strlen(pck->name) - strlen(forceext), forceext)) forceext = NULL; // filename already has required extension
     formatstring(pck->fullpath)("%s%s%s", prefix ? prefix : "", pck->name, forceext ? forceext : "");
     formatstring(pck->requestname)("/%s%s%s", pck->fullpath, type == PCK_MAP ? ".cgz" : "", pck->iszip ? ".zip" : ""); // special case map zips: file ending .cgz.zip
+    pck->type = type;
+    if(host) copystring(pck->host, host); // assign fixed server
+    return pck;
+}
 
+bool requirepackage(int type, const char *name, const char *host)
+{
+    package *pck = newpackage(type, name, host);
+    if(!pck) return false;
     loopv(pendingpackages) if(!strcmp(pendingpackages[i]->requestname, pck->requestname))
     { // request already queued
         delete pck;
         return false;
     }
-    pck->type = type;
-    if(host) copystring(pck->host, host); // assign fixed server
     DEBUG("name: " << pck->name << ", fullpath: " << pck->fullpath << ", requestname: " << pck->requestname << ", host: " << pck->host << ", type: " << pck->type << ", iszip: " << pck->iszip
           << ", strictnames: " << pck->strictnames << ", server: " << pck->server << ", exts: " << (pck->exts ? *pck->exts : ""));
     pendingpackages.add(pck);
@@ -327,6 +361,7 @@ void processdownload(package *pck, stream *f) // write downloaded data to file(s
     }
     else
     { // write single file
+        if(pck->type == PCK_MOD) delfile(findfile(path(pck->fullpath, true), "w")); // new file instead of truncating a possibly mapped zip
         stream *d = openfile(path(pck->fullpath, true), "wb");
         if(d)
         {
@@ -353,6 +388,182 @@ void processdownload(package *pck, stream *f) // write downloaded data to file(s
     }
 }
 
+// download cache: every downloaded package file is kept once per content, in "dlcache/<tiger hash>"
+// a name index maps request names (and their revisions) to content, so identical files under different names or from different servers are only downloaded once
+// the content hash is checked once, when a file enters the cache - against the hash from updates.txt, if the server provides one
+
+#define DLCACHEDIR "dlcache" PATHDIVS
+#define DLCACHEINDEX DLCACHEDIR "index.txt"
+
+struct dlobject { int size, lastused; };
+struct dlname { char hex[DLCACHEHEXSIZE]; int rev; };
+
+hashtable<const char *, dlobject> dlobjects;  // content hash -> cached file
+hashtable<const char *, dlname> dlnames;      // request name -> content hash
+int dlcacheclock = 0;
+int64_t dlcachetotal = 0;
+bool dlcacheloaded = false, dlcachedirty = false;
+
+VARP(dlcachesize, 0, 64, 4096); // size limit of the download cache in MB, 0 disables the cache
+
+void dlcachename(const char *requestname, const char *hex, int rev)
+{
+    dlname *n = dlnames.access(requestname);
+    if(!n) n = &dlnames.access(newstring(requestname), dlname());
+    copystring(n->hex, hex, DLCACHEHEXSIZE);
+    n->rev = rev;
+    dlcachedirty = true;
+}
+
+void dlcachedrop(const char *hex) // remove a file and all names pointing to it
+{
+    string fname;
+    formatstring(fname)(DLCACHEDIR "%s", hex);
+    delfile(findfile(fname, "w"));
+    vector<const char *> names;
+    enumeratekt(dlnames, const char *, name, dlname, n, { if(!strcmp(n.hex, hex)) names.add(name); });
+    loopv(names)
+    {
+        dlnames.remove(names[i]);
+        delete[] names[i];
+    }
+    const char *key = NULL;
+    enumeratekt(dlobjects, const char *, k, dlobject, o, if(!strcmp(k, hex)) { key = k; dlcachetotal -= o.size; });
+    if(key)
+    {
+        dlobjects.remove(key);
+        delete[] key;
+    }
+    dlcachedirty = true;
+}
+
+void dlcacheload()
+{
+    dlcacheloaded = true;
+    stream *f = openfile(DLCACHEINDEX, "r");
+    if(!f) return;
+    char line[2 * MAXSTRLEN];
+    string hex, name;
+    int a, b;
+    while(f->getline(line, sizeof(line)))
+    {
+        if(sscanf(line, "o %48s %d %d", hex, &a, &b) == 3 && strlen(hex) == 2 * TIGERHASHSIZE && !dlobjects.access(hex))
+        {
+            dlobject o = { a, b };
+            dlobjects.access(newstring(hex), o);
+            dlcachetotal += a;
+            dlcacheclock = max(dlcacheclock, b);
+        }
+        else if(sscanf(line, "n %48s %d %259s", hex, &a, name) == 3 && dlobjects.access(hex)) dlcachename(name, hex, a);
+    }
+    delete f;
+    dlcachedirty = false;
+}
+
+void dlcachesave()
+{
+    if(!dlcachedirty) return;
+    stream *f = openfile(DLCACHEINDEX, "w");
+    if(!f) return;
+    f->printf("// download cache index, written automatically\n");
+    enumeratekt(dlobjects, const char *, hex, dlobject, o, f->printf("o %s %d %d\n", hex, o.size, o.lastused));
+    enumeratekt(dlnames, const char *, name, dlname, n, f->printf("n %s %d %s\n", n.hex, n.rev, name));
+    delete f;
+    dlcachedirty = false;
+}
+
+int dlobjectsort(const char **a, const char **b) { return dlobjects.access(*a)->lastused - dlobjects.access(*b)->lastused; }
+
+void dlcacheevict() // drop least recently used files until the cache fits the size limit
+{
+    int64_t limit = (int64_t)dlcachesize << 20;
+    if(dlcachetotal <= limit) return;
+    vector<const char *> hexes;
+    enumeratek(dlobjects, const char *, hex, hexes.add(hex));
+    hexes.sort(dlobjectsort);
+    string hex;
+    loopv(hexes)
+    {
+        if(dlcachetotal <= limit) break;
+        copystring(hex, hexes[i]);
+        DEBUG("evicting " << hex);
+        dlcachedrop(hex);
+    }
+}
+
+bool dlcachefetch(package *pck, const char *hex, int rev, int *size = NULL) // install a package from the cache, if its content is known
+{
+    if(!dlcachesize) return false;
+    if(!dlcacheloaded) dlcacheload();
+    dlname *n = dlnames.access(pck->requestname);
+    if(!hex && n && rev > 0 && n->rev >= rev) hex = n->hex; // no hash provided by the server: use the name index, if the revision is still current
+    dlobject *o = hex ? dlobjects.access(hex) : NULL;
+    if(!o) return false;
+    string fname;
+    formatstring(fname)(DLCACHEDIR "%s", hex);
+    stream *f = openfile(fname, "rb");
+    if(!f || f->size() != o->size)
+    { // file vanished or was damaged locally
+        DELETEP(f);
+        dlcachedrop(fname + strlen(DLCACHEDIR));
+        return false;
+    }
+    clientlogf("installing %s from the download cache (%s)", pck->requestname, fname + strlen(DLCACHEDIR));
+    o->lastused = ++dlcacheclock;
+    dlcachename(pck->requestname, fname + strlen(DLCACHEDIR), rev);
+    processdownload(pck, f);
+    if(size) *size = o->size;
+    return true;
+}
+
+bool dlcachestore(package *pck, pckserver *s) // check a downloaded package against the server's hash and add it to the cache
+{
+    uchar hash[TIGERHASHSIZE], buf[4096];
+    char hexbuf[DLCACHEHEXSIZE];
+    void *ts = tigerhash_init(hash);
+    stream *f = pck->data;
+    f->seek(0);
+    int len, size = 0;
+    while((len = f->read(buf, sizeof(buf))) > 0)
+    {
+        tigerhash_add(hash, buf, len, ts);
+        size += len;
+    }
+    tigerhash_finish(hash, ts);
+    string fname;
+    formatstring(fname)(DLCACHEDIR "%s", bin2hex(hexbuf, hash, TIGERHASHSIZE));
+    const char *hex = fname + strlen(DLCACHEDIR);
+    pckhash *ph = s ? s->hashes.access(pck->requestname) : NULL;
+    if(ph && strcmp(ph->hex, hex))
+    {
+        formatstring(pck->dllog)("download %s%s failed: content hash mismatch", s->host, pck->requestname);
+        return false;
+    }
+    if(!dlcachesize) return true;
+    if(!dlcacheloaded) dlcacheload();
+    dlobject *o = dlobjects.access(hex);
+    if(!o)
+    {
+        stream *d = openfile(path(fname), "wb");
+        if(!d) return true;
+        f->seek(0);
+        bool ok = streamcopy(d, f) == size;
+        delete d;
+        if(!ok)
+        {
+            delfile(findfile(fname, "w"));
+            return true;
+        }
+        dlobject n = { size, 0 };
+        o = &dlobjects.access(newstring(hex), n);
+        dlcachetotal += size;
+    }
+    o->lastused = ++dlcacheclock;
+    int *rev = s ? s->updates.access(pck->requestname) : NULL;
+    dlcachename(pck->requestname, hex, rev ? *rev : 0);
+    return true;
+}
+
 bool canceldownloads = false;
 int progress_n, progress_of;
 
@@ -373,48 +584,205 @@ int progress_callback_dlpackage(void *data, float progress)
     return 0;
 }
 
-bool dlpackage(httpget &h, package *pck, pckserver *s) // download one package from one server
+#define DLRESUMES 2
+
+bool fetchpackage(httpget &h, package *pck, pckserver *s) // download one package from one server to pck->data, messages go to pck->dllog (no console or ui access: may run in a download thread)
 {
     urlparse u;
     u.set(s ? s->host : pck->host);
-    h.callbackfunc = progress_callback_dlpackage;
-    h.callbackdata = pck->name;
-    progress_n = progress_of - pendingpackages.length();
     if(*u.domain && h.set_host(u.domain))
     {
         if(*u.port) h.set_port(atoi(u.port));
         h.outstream = openvecfile(NULL);
         defformatstring(url)("%s%s", u.path, pck->requestname);
         int got = h.get(url, 6000, 90000);
+        for(int resumes = 0; got < 0 && h.resumefrom > 0 && !canceldownloads && resumes < DLRESUMES; resumes++) got = h.get(url, 6000, 90000, h.resumefrom); // transfer broke off: continue where it stopped
         if(got < 0 || !h.response)
         {
             if(!canceldownloads && s) s->ping = 0; // received a hard error from the server connection, better not try this one again
-            clientlogf("download %s:%d%s failed, err: %s", u.domain, h.ip.port, url, h.err ? h.err : "(null)");
+            formatstring(pck->dllog)("download %s:%d%s failed, err: %s", u.domain, h.ip.port, url, h.err ? h.err : "(null)");
             h.disconnect();
         }
         else
         {
-            if(h.response == 200)
+            if(h.response == 200 || h.response == 206)
             {
-                DEBUGCODE(clientlogf("downloaded %s:%d%s, %d bytes (%d raw), %d msec", u.domain, h.ip.port, url, got, h.contentlength, h.elapsedtime));
-                processdownload(pck, h.outstream);
-                h.outstream = NULL; // deleted by processdownload()
+                pck->dllog[0] = '\0'; // drop the message of an earlier failed attempt
+                DEBUGCODE(formatstring(pck->dllog)("downloaded %s:%d%s, %d bytes (%d raw), %d msec", u.domain, h.ip.port, url, got, h.contentlength, h.elapsedtime));
+                pck->data = h.outstream;
+                h.outstream = NULL;
                 return true;
             }
-            else clientlogf("download %s:%d%s failed, server response %d%s%s", u.domain, h.ip.port, url, h.response, h.err ? ", err: " : "", h.err ? h.err : "");
+            else formatstring(pck->dllog)("download %s:%d%s failed, server response %d%s%s", u.domain, h.ip.port, url, h.response, h.err ? ", err: " : "", h.err ? h.err : "");
         }
         DELETEP(h.outstream);
     }
     else
     {
         if(s) s->resolved = 0;
-        clientlogf("resolving host \"%s\" failed", u.domain);
+        formatstring(pck->dllog)("resolving host \"%s\" failed", u.domain);
         h.disconnect();
     }
     return false;
 }
 
-int packagesort_server(package **a, package **b) { return (*b)->server - (*a)->server; }
+bool dlpackage(httpget &h, package *pck, pckserver *s) // download one package from one server and install it
+{
+    h.callbackfunc = progress_callback_dlpackage;
+    h.callbackdata = pck->name;
+    progress_n = progress_of - pendingpackages.length();
+    bool ok = fetchpackage(h, pck, s);
+    if(ok && !dlcachestore(pck, s))
+    {
+        DELETEP(pck->data);
+        ok = false;
+    }
+    if(*pck->dllog) clientlogf("%s", pck->dllog);
+    pck->dllog[0] = '\0';
+    if(ok)
+    {
+        processdownload(pck, pck->data);
+        pck->data = NULL; // deleted by processdownload()
+    }
+    return ok;
+}
+
+// packages assigned to a server are fetched over a few parallel connections per server, each with a few requests pipelined:
+// many small files (textures of a new map) then don't cost a round trip each
+
+#define DLCONNECTIONS 3
+#define DLPIPELINE 4
+
+struct dlqueue
+{
+    pckserver *s;
+    vector<package *> todo, done, failed;    // protected by dllock
+    int traffic;
+};
+
+SDL_mutex *dllock = NULL;
+
+int dlworkercallback(void *data, float progress) { return canceldownloads ? 1 : 0; }
+
+int dlworker(void *data)
+{
+    dlqueue *q = (dlqueue *)data;
+    httpget h;
+    h.callbackfunc = dlworkercallback;
+    urlparse u;
+    u.set(q->s->host);
+    package *batch[DLPIPELINE];
+    for(;;)
+    {
+        int n = 0;
+        SDL_LockMutex(dllock);
+        while(n < DLPIPELINE && q->todo.length() && !canceldownloads) batch[n++] = q->todo.remove(0);
+        SDL_UnlockMutex(dllock);
+        if(!n) break;
+        if(*u.domain && h.set_host(u.domain))
+        {
+            if(*u.port) h.set_port(atoi(u.port));
+            loopi(n)
+            {
+                defformatstring(url)("%s%s", u.path, batch[i]->requestname);
+                if(!h.pipeline(url)) break;  // (get() sends the rest)
+            }
+        }
+        loopi(n)
+        {
+            bool ok = !canceldownloads && fetchpackage(h, batch[i], q->s);
+            SDL_LockMutex(dllock);
+            (ok ? q->done : q->failed).add(batch[i]);
+            SDL_UnlockMutex(dllock);
+        }
+    }
+    h.disconnect();
+    SDL_LockMutex(dllock);
+    q->traffic += h.traffic;
+    SDL_UnlockMutex(dllock);
+    return 0;
+}
+
+int dlparallel(vector<package *> &pcks) // download packages with auto-assigned servers, returns traffic
+{
+    if(!dllock) dllock = SDL_CreateMutex();
+    vector<dlqueue *> queues;
+    loopv(pcks)
+    {
+        pckserver *s = pckservers[pcks[i]->server];
+        dlqueue *q = NULL;
+        loopvj(queues) if(queues[j]->s == s) { q = queues[j]; break; }
+        if(!q)
+        {
+            q = queues.add(new dlqueue);
+            q->s = s;
+            q->traffic = 0;
+        }
+        q->todo.add(pcks[i]);
+    }
+    vector<SDL_Thread *> threads;
+    loopv(queues)
+    {
+        int started = 0;
+        loopj(min(DLCONNECTIONS, (queues[i]->todo.length() + DLPIPELINE - 1) / DLPIPELINE))
+        {
+            SDL_Thread *t = SDL_CreateThread(dlworker, "DownloadPackages", queues[i]);
+            if(t) threads.add(t), started++;
+        }
+        if(!started) dlworker(queues[i]);
+    }
+    int total = pcks.length(), finished = 0, traffic = 0;
+    pcks.setsize(0);
+    while(finished < total)
+    { // show progress and check for user interrupts, while the threads are busy
+        finished = 0;
+        SDL_LockMutex(dllock);
+        loopv(queues) finished += queues[i]->done.length() + queues[i]->failed.length();
+        SDL_UnlockMutex(dllock);
+        progress_n = progress_of - pendingpackages.length() - (total - finished);
+        if(finished < total)
+        {
+            progress_callback_dlpackage((void *)"", float(finished) / total);
+            if(canceldownloads) break;
+            SDL_Delay(20);
+        }
+    }
+    loopv(threads)
+    {
+        int nop;
+        SDL_WaitThread(threads[i], &nop);
+    }
+    loopv(queues)
+    {
+        dlqueue *q = queues[i];
+        loopvj(q->done)
+        {
+            package *pck = q->done[j];
+            if(!dlcachestore(pck, q->s))
+            {
+                DELETEP(pck->data);
+                q->failed.add(pck);
+                continue;
+            }
+            if(*pck->dllog) clientlogf("%s", pck->dllog);
+            processdownload(pck, pck->data);
+            delete pck;
+        }
+        loopvj(q->failed)
+        {
+            package *pck = q->failed[j];
+            if(*pck->dllog) clientlogf("%s", pck->dllog);
+            pck->dllog[0] = '\0';
+            pck->server = -1; // auto-assigned server didn't work - try any other now
+            pcks.add(pck);
+        }
+        pcks.put(q->todo.getbuf(), q->todo.length()); // (cancelled)
+        traffic += q->traffic;
+        delete q;
+    }
+    return traffic;
+}
+
 int packagesort_name(package **a, package **b) { return strcmp((*b)->name, (*a)->name); }
 int packagesort_host(package **a, package **b) { return strcmp((*b)->host, (*a)->host); }
 
@@ -426,9 +794,26 @@ int pckserversort(pckserver **a, pckserver **b)
     return (*b)->ping - (*a)->ping; // or whichever ping is not zero
 }
 
-int downloadpackages(bool loadscr) // get all pending packages
+int findpckserver(package *pck) // assign the server with the highest revision for that content, returns the revision (call with sem_pckservers locked)
+{
+    int maxrev = 0, *rev = NULL;
+    pck->server = -1;
+    loopv(pckservers)
+    {
+        pckserver *s = pckservers[i];
+        if(s->priority > -1000 && s->resolved && s->ping && (rev = s->updates.access(pck->requestname)) && *rev > maxrev)
+        {
+            maxrev = *rev;
+            pck->server = i;
+        }
+    }
+    return maxrev;
+}
+
+int downloadpackages(bool loadscr) // get all pending packages, returns the bytes downloaded or installed from the cache (0 on failure)
 {
-    bool failed = false;
+    bool failed = false, cached = false;
+    int cachedbytes = 0;
     httpget h;
     canceldownloads = false;
     progress_of = loadscr ? pendingpackages.length() : -1;
@@ -441,31 +826,26 @@ int downloadpackages(bool loadscr) // get all pending packages
     loopv(pendingpackages)
     {
         package *pck = pendingpackages[i];
-        int maxrev = 0, *rev = NULL;
-        pck->server = -1;                  // server with highest revision for that content
-        loopvj(pckservers)
-        {
-            pckserver *s = pckservers[j];
-            if(s->priority > -1000 && s->resolved && s->ping && (rev = s->updates.access(pck->requestname)) && *rev > maxrev)
-            {
-                maxrev = *rev;
-                pck->server = j;
-            }
+        int maxrev = findpckserver(pck);
+        pckhash *ph = pckservers.inrange(pck->server) ? pckservers[pck->server]->hashes.access(pck->requestname) : NULL;
+        int size = 0;
+        if(!*pck->host && dlcachefetch(pck, ph ? ph->hex : NULL, maxrev, &size))
+        { // content already downloaded before
+            delete pendingpackages.remove(i--);
+            cachedbytes += size;
+            cached = true;
         }
     }
 
     // get all packages with auto-assigned servers
-    pendingpackages.sort(packagesort_server);
-    loopvrev(pendingpackages)
+    vector<package *> assigned;
+    loopv(pendingpackages)
     {
-        if(canceldownloads) break;
         package *pck = pendingpackages[i];
-        if(!*pck->host && pckservers.inrange(pck->server) && pckservers[pck->server]->resolved)
-        {
-            if(dlpackage(h, pck, pckservers[pck->server])) delete pendingpackages.remove(i);
-            else pck->server = -1; // auto-assigned server didn't work - try any other now
-        }
+        if(!*pck->host && pckservers.inrange(pck->server) && pckservers[pck->server]->resolved) assigned.add(pendingpackages.remove(i--));
     }
+    int traffic = assigned.length() ? dlparallel(assigned) : 0;
+    loopv(assigned) pendingpackages.add(assigned[i]); // failed
 
     // try all packages from all servers - high priority servers first
     pendingpackages.sort(packagesort_name);
@@ -512,7 +892,72 @@ int downloadpackages(bool loadscr) // get all pending packages
     }
     sem_pckservers.post();
     h.disconnect();
-    return failed ? 0 : h.traffic;
+    dlcacheevict();
+    dlcachesave();
+    if(failed) return 0;
+    return max(h.traffic + traffic + cachedbytes, cached ? 1 : 0); // (packages from the cache count as success, too - even empty ones)
+}
+
+// prefetching: one package at a time is downloaded by a background thread, while the game goes on (used for the next map)
+
+package *prefetchpck = NULL;
+pckserver *prefetchserver = NULL;
+SDL_Thread *prefetchthread = NULL;
+volatile bool prefetchdone = false, prefetchok = false;
+
+int prefetchworker(void *data)
+{
+    httpget h;
+    prefetchok = fetchpackage(h, prefetchpck, prefetchserver);
+    h.disconnect();
+    prefetchdone = true;
+    return 0;
+}
+
+bool prefetchpackage(int type, const char *name) // start downloading a package in the background, returns false, if that is not possible (installs right away, if the content is cached)
+{
+    if(!autodownload || prefetchpck) return false;
+    package *pck = newpackage(type, name, NULL);
+    if(!pck) return false;
+    if(sem_pckservers.trywait())
+    { // still pinging the servers
+        delete pck;
+        return false;
+    }
+    int maxrev = findpckserver(pck);
+    pckhash *ph = pckservers.inrange(pck->server) ? pckservers[pck->server]->hashes.access(pck->requestname) : NULL;
+    bool cached = dlcachefetch(pck, ph ? ph->hex : NULL, maxrev);
+    prefetchserver = !cached && pckservers.inrange(pck->server) ? pckservers[pck->server] : NULL;
+    sem_pckservers.post();
+    if(cached) dlcachesave();
+    if(!prefetchserver)
+    {
+        delete pck;
+        return cached;
+    }
+    prefetchpck = pck;
+    prefetchdone = prefetchok = false;
+    if(!(prefetchthread = SDL_CreateThread(prefetchworker, "PrefetchPackage", NULL))) DELETEP(prefetchpck);
+    return prefetchpck != NULL;
+}
+
+void pollprefetchpackage() // install a package, once the background download has finished
+{
+    if(!prefetchthread || !prefetchdone) return;
+    int nop;
+    SDL_WaitThread(prefetchthread, &nop);
+    prefetchthread = NULL;
+    package *pck = prefetchpck;
+    bool ok = prefetchok && dlcachestore(pck, prefetchserver);
+    if(*pck->dllog) clientlogf("%s", pck->dllog);
+    if(ok)
+    {
+        clientlogf("prefetched %s", pck->requestname);
+        processdownload(pck, pck->data);
+        dlcachesave();
+    }
+    else DELETEP(pck->data);
+    DELETEP(prefetchpck);
 }
 
 void writepcksourcecfg()
@@ -45,6 +45,25 @@ string clientpassword = "";
 int connectrole = CR_DEFAULT;
 bool modprotocol = false;
 
+// connect cookies: a busy server may answer our connect request with a challenge,
+// we then repeat the request with the cookie in the connect data
+
+static enet_uint32 connectcookie = 0;
+static ENetAddress connectcookieaddr;
+
+static int ENET_CALLBACK connectchallenge(ENetHost *host, ENetEvent *event)
+{
+    if(!connpeer || connpeer->state != ENET_PEER_STATE_CONNECTING || host->receivedDataLength != CONNECTCOOKIE_LEN) return 0;
+    const ENetAddress &from = host->receivedAddress;
+    if(from.port != connpeer->address.port || (from.host != connpeer->address.host && connpeer->address.host != ENET_HOST_BROADCAST)) return 0;
+    enet_uint32 d[CONNECTCOOKIE_LEN / 4];
+    memcpy(d, host->receivedData, CONNECTCOOKIE_LEN);
+    if(ENET_NET_TO_HOST_32(d[0]) != CONNECTCOOKIE_MAGIC || !d[1]) return 0;
+    connectcookie = ENET_NET_TO_HOST_32(d[1]);
+    connectcookieaddr = from;
+    return 1;
+}
+
 void abortconnect()
 {
     if(!connpeer) return;
@@ -52,6 +71,7 @@ void abortconnect()
     connectrole = CR_DEFAULT;
     if(connpeer->state!=ENET_PEER_STATE_DISCONNECTED) enet_peer_reset(connpeer);
     connpeer = NULL;
+    connectcookie = 0;
 #if 0
     if(!curpeer)
     {
@@ -61,16 +81,61 @@ void abortconnect()
 #endif
 }
 
+// hostnames are resolved in the background: the connect continues in gets2c(), once the name is in the resolver cache
+
+static string resolvingserver;
+static int resolvingport, resolvingmillis;
+
+static void connectaddress(ENetAddress &address)
+{
+    if(!clienthost && (clienthost = enet_host_create(NULL, 2, 3, 0, 0)))
+        clienthost->intercept = connectchallenge;
+
+    if(clienthost)
+    {
+        connectcookie = 0;
+        connpeer = enet_host_connect(clienthost, &address, 3, 0);
+        enet_host_flush(clienthost);
+        connmillis = totalmillis;
+        connattempts = 0;
+        if(!m_mp(gamemode)) gamemode = GMODE_TEAMDEATHMATCH;
+    }
+    else
+    {
+        conoutf("\f2could \f3not connect\f2 to server");
+        clientpassword[0] = '\0';
+        connectrole = CR_DEFAULT;
+    }
+}
+
+static void checkresolvingserver()
+{
+    if(!resolvingserver[0]) return;
+    ENetAddress address;
+    address.port = resolvingport;
+    int resolved = resolvercached(resolvingserver, &address);
+    if(resolved < 0 && totalmillis - resolvingmillis <= RESOLVERLIMIT) return;
+    if(resolved > 0) connectaddress(address);
+    else
+    {
+        conoutf("\f2could \f3not resolve\f2 server \f5%s\f2", resolvingserver);
+        clientpassword[0] = '\0';
+        connectrole = CR_DEFAULT;
+    }
+    resolvingserver[0] = '\0';
+}
+
 void connectserv_(const char *servername, int serverport = 0, const char *password = NULL, int role = CR_DEFAULT)
 {
     if(serverport <= 0) serverport = CUBE_DEFAULT_SERVER_PORT;
     if(watchingdemo) enddemoplayback();
     if(!clfail && cllock && searchlan<2) return;
 
-    if(connpeer)
+    if(connpeer || resolvingserver[0])
     {
         conoutf("aborting connection attempt");
         abortconnect();
+        resolvingserver[0] = '\0';
     }
     connectrole = role;
     copystring(clientpassword, password ? password : "");
@@ -81,7 +146,16 @@ void connectserv_(const char *servername, int serverport = 0, const char *passwo
     {
         addserver(servername, serverport, 0);
         conoutf("\f2attempting to %sconnect to \f5%s\f4:%d\f2", role==CR_DEFAULT?"":"\f8admin\f2", servername, serverport);
-        if(!resolverwait(servername, &address))
+        int resolved = resolvercached(servername, &address);
+        if(resolved < 0)
+        {
+            copystring(resolvingserver, servername);
+            resolvingport = serverport;
+            resolvingmillis = totalmillis;
+            resolverquery(resolvingserver, false);
+            return;
+        }
+        if(!resolved)
         {
             conoutf("\f2could \f3not resolve\f2 server \f5%s\f2", servername);
             clientpassword[0] = '\0';
@@ -94,24 +168,7 @@ void connectserv_(const char *servername, int serverport = 0, const char *passwo
         conoutf("\f2attempting to connect over \f1LAN\f2");
         address.host = ENET_HOST_BROADCAST;
     }
-
-    if(!clienthost)
-        clienthost = enet_host_create(NULL, 2, 3, 0, 0);
-
-    if(clienthost)
-    {
-        connpeer = enet_host_connect(clienthost, &address, 3, 0);
-        enet_host_flush(clienthost);
-        connmillis = totalmillis;
-        connattempts = 0;
-        if(!m_mp(gamemode)) gamemode = GMODE_TEAMDEATHMATCH;
-    }
-    else
-    {
-        conoutf("\f2could \f3not connect\f2 to server");
-        clientpassword[0] = '\0';
-        connectrole = CR_DEFAULT;
-    }
+    connectaddress(address);
 }
 
 void connectserv(char *servername, int *serverport, char *password)
@@ -205,8 +262,9 @@ void disconnect(int onlyclean, int async)
 
 void trydisconnect()
 {
-    if(connpeer)
+    if(connpeer || resolvingserver[0])
     {
+        resolvingserver[0] = '\0';
         conoutf("aborting connection attempt");
         abortconnect();
         return;
@@ -588,7 +646,22 @@ void sendintro()
 void gets2c()           // get updates from the server
 {
     ENetEvent event;
+    checkresolvingserver();
     if(!clienthost || (!curpeer && !connpeer)) return;
+    if(connpeer && connectcookie)
+    { // server wants proof of our address: repeat the connect request with the cookie
+        enet_peer_reset(connpeer);
+        ENetPeer *p = enet_host_connect(clienthost, &connectcookieaddr, 3, connectcookie);
+        connectcookie = 0;
+        if(!p)
+        {
+            conoutf("\f3could not connect to server");
+            abortconnect();
+            return;
+        }
+        connpeer = p;
+        enet_host_flush(clienthost);
+    }
     if(connpeer && totalmillis/3000 > connmillis/3000)
     {
         conoutf("attempting to connect...");
@@ -554,6 +554,16 @@ void parsemessages(int cn, playerent *d, ucharbuf &p, bool demo = false)
                 break;
             }
 
+            case SV_NEXTMAP:
+            {
+                getstring(text, p);
+                int mode = getint(p);
+                int downloadable = getint(p);
+                int revision = getint(p);
+                if(!demo && !watchingdemo) prefetchmap(text, mode, downloadable, revision);
+                break;
+            }
+
             case SV_SWITCHNAME:
                 getstring(text, p);
                 filtertext(text, text, FTXT__PLAYERNAME, MAXNAMELEN);
@@ -1528,7 +1538,7 @@ void receivefile(uchar *data, int len)
         case SV_RECVMAP:
         {
             getstring(text, p);
-            conoutf("received map \"%s\" from server, reloading..", text);
+            conoutf("received map \"%s\" from server%s", text, strcmp(behindpath(text), getclientmap()) ? "" : ", reloading.."); // (not the current map: prefetched next map)
             int mapsize = getint(p);
             int cfgsize = getint(p);
             int cfgsizegz = getint(p);
@@ -18,6 +18,7 @@ static const char *hexdigits = "0123456789abcdef";
  */
 
 #define TIGER_PASSES 3
+#define TIGERLANES 4
 
 namespace tiger
 {
@@ -87,6 +88,54 @@ namespace tiger
         state[2] = c;
     }
 
+#define tround4(a, b, c, x) loop(l, TIGERLANES) \
+    { \
+      c[l] ^= x[l]; \
+      a[l] -= sb1[((c[l])>>(0*8))&0xFF] ^ sb2[((c[l])>>(2*8))&0xFF] ^ \
+       sb3[((c[l])>>(4*8))&0xFF] ^ sb4[((c[l])>>(6*8))&0xFF] ; \
+      b[l] += sb4[((c[l])>>(1*8))&0xFF] ^ sb3[((c[l])>>(3*8))&0xFF] ^ \
+       sb2[((c[l])>>(5*8))&0xFF] ^ sb1[((c[l])>>(7*8))&0xFF] ; \
+      b[l] *= mul; \
+    }
+
+    void compresslanes(const chunk * const *str, chunk (*state)[3])   // TIGERLANES independent compress() calls, interleaved: the table lookups of all lanes overlap
+    {
+        chunk a[TIGERLANES], b[TIGERLANES], c[TIGERLANES], aa[TIGERLANES], bb[TIGERLANES], cc[TIGERLANES], x[8][TIGERLANES];
+
+        loop(l, TIGERLANES)
+        {
+            aa[l] = a[l] = state[l][0];
+            bb[l] = b[l] = state[l][1];
+            cc[l] = c[l] = state[l][2];
+            loopi(8) x[i][l] = lilswap(str[l][i]);
+        }
+        loop(pass_no, TIGER_PASSES)
+        {
+            if(pass_no) loop(l, TIGERLANES)
+            {
+                x[0][l] -= x[7][l] ^ 0xA5A5A5A5A5A5A5A5ULL; x[1][l] ^= x[0][l]; x[2][l] += x[1][l]; x[3][l] -= x[2][l] ^ ((~x[1][l])<<19);
+                x[4][l] ^= x[3][l]; x[5][l] += x[4][l]; x[6][l] -= x[5][l] ^ ((~x[4][l])>>23); x[7][l] ^= x[6][l];
+                x[0][l] += x[7][l]; x[1][l] -= x[0][l] ^ ((~x[7][l])<<19); x[2][l] ^= x[1][l]; x[3][l] += x[2][l];
+                x[4][l] -= x[3][l] ^ ((~x[2][l])>>23); x[5][l] ^= x[4][l]; x[6][l] += x[5][l]; x[7][l] -= x[6][l] ^ 0x0123456789ABCDEFULL;
+            }
+
+            uint mul = !pass_no ? 5 : (pass_no==1 ? 7 : 9);
+            tround4(a, b, c, x[0]) tround4(b, c, a, x[1]) tround4(c, a, b, x[2]) tround4(a, b, c, x[3])
+            tround4(b, c, a, x[4]) tround4(c, a, b, x[5]) tround4(a, b, c, x[6]) tround4(b, c, a, x[7])
+
+            loop(l, TIGERLANES) { chunk tmp = a[l]; a[l] = c[l]; c[l] = b[l]; b[l] = tmp; }
+        }
+
+        loop(l, TIGERLANES)
+        {
+            state[l][0] = a[l] ^ aa[l];
+            state[l][1] = b[l] - bb[l];
+            state[l][2] = c[l] + cc[l];
+        }
+    }
+
+#undef tround4
+
     void gensboxes()
     {
         const char *str = "Tiger - A Fast New Hash Function, by Ross Anderson and Eli Biham";
@@ -110,7 +159,7 @@ namespace tiger
 
     struct incremental_buffer { int len, total; union { uchar u[64]; chunk c[8]; }; incremental_buffer() { len = total = 0; } };
 
-    incremental_buffer *hash_init(hashval &val)
+    void initval(hashval &val)
     {
         static bool init = false;
         if(!init) { gensboxes(); init = true; }
@@ -118,7 +167,11 @@ namespace tiger
         val.chunks[0] = 0x0123456789ABCDEFULL;
         val.chunks[1] = 0xFEDCBA9876543210ULL;
         val.chunks[2] = 0xF096A5B4C3B2E187ULL;
+    }
 
+    incremental_buffer *hash_init(hashval &val)
+    {
+        initval(val);
         return new incremental_buffer;
     }
 
@@ -184,6 +237,58 @@ namespace tiger
 
         hash_finish(val, b);
     }
+
+    void hash_multi(const uchar **msgs, const int *lens, hashval **vals, int n)  // hash n independent messages, TIGERLANES at a time
+    {
+        struct lane { const uchar *msg; int blocks, full, done; union { uchar u[128]; chunk c[16]; } tail; } lanes[TIGERLANES];
+        static const chunk dummy[8] = { 0 };
+        for(int first = 0; first < n; first += TIGERLANES)
+        {
+            int num = min(n - first, TIGERLANES), active = num;
+            chunk state[TIGERLANES][3];
+            loopi(num)
+            {
+                lane &ln = lanes[i];
+                initval(*vals[first + i]);
+                int len = lens[first + i], rest = len & 63;
+                ln.msg = msgs[first + i];
+                ln.full = len >> 6;
+                ln.blocks = ln.full + (rest >= 56 ? 2 : 1);
+                ln.done = 0;
+                memset(ln.tail.u, 0, sizeof(ln.tail.u));
+                memcpy(ln.tail.u, ln.msg + (len & ~63), rest);
+                ln.tail.u[rest] = 0x01;
+                ln.tail.c[(ln.blocks - ln.full) * 8 - 1] = lilswap(chunk(len) << 3);
+                memcpy(state[i], vals[first + i]->chunks, sizeof(state[i]));
+            }
+            while(active > 1)
+            {
+                const chunk *str[TIGERLANES];
+                loopi(TIGERLANES)
+                {
+                    lane &ln = lanes[i];
+                    if(i >= num || ln.done >= ln.blocks) str[i] = dummy;
+                    else str[i] = ln.done < ln.full ? (const chunk *)(ln.msg + ln.done * 64) : ln.tail.c + (ln.done - ln.full) * 8;
+                }
+                chunk out[TIGERLANES][3];
+                memcpy(out, state, sizeof(out));
+                compresslanes(str, out);
+                active = 0;
+                loopi(num) if(lanes[i].done < lanes[i].blocks)
+                {
+                    memcpy(state[i], out[i], sizeof(state[i]));
+                    if(++lanes[i].done < lanes[i].blocks) active++;
+                }
+            }
+            loopi(num)
+            {
+                lane &ln = lanes[i];
+                for(; ln.done < ln.blocks; ln.done++) compress(ln.done < ln.full ? (const chunk *)(ln.msg + ln.done * 64) : ln.tail.c + (ln.done - ln.full) * 8, state[i]);
+                memcpy(vals[first + i]->chunks, state[i], sizeof(state[i]));
+                lilswap(vals[first + i]->chunks, 3);
+            }
+        }
+    }
 }
 
 void tigerhash(uchar *hash, const uchar *msg, int len)
@@ -207,6 +312,11 @@ void tigerhash_finish(uchar *hash, void *state)
     else delete (tiger::incremental_buffer *)state;
 }
 
+void tigerhash_multi(uchar **hashes, const uchar **msgs, const int *lens, int n)  // same as n calls of tigerhash(), but faster
+{
+    tiger::hash_multi(msgs, lens, (tiger::hashval **)hashes, n);
+}
+
 #undef sb1
 #undef sb2
 #undef sb3
@@ -223,22 +333,23 @@ void tigerhash_finish(uchar *hash, void *state)
      h += (RR64(a,28) ^ RR64(a,34) ^ RR64(a,39)) + (((a | b) & c) | (a & b));
 #define SHA512SIZE (512 / 8)
 
-void sha512_compress(uint64_t *state, const uchar *inbuf)  // sha512 main function: compress one chunk of 128 bytes
+static const uint64_t sha512K[80] =
 {
-    static const uint64_t K[80] =
-    {
-        0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
-        0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL, 0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
-        0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
-        0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
-        0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL, 0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
-        0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
-        0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
-        0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL, 0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
-        0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
-        0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
-    };
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL, 0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL, 0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL, 0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
 
+void sha512_compress(uint64_t *state, const uchar *inbuf)  // sha512 main function: compress one chunk of 128 bytes
+{
+    const uint64_t *K = sha512K;
     uint64_t S[8], W[80];
 
     loopi(8) S[i] = state[i];
@@ -281,6 +392,98 @@ void sha512(uchar *hash, const uchar *msg, int msglen)
     sha512_compress(state, endmsg);
     loopi(8) ((uint64_t*)hash)[i] = bigswap(state[i]);
 }
+
+// multi-buffer sha512: several independent messages are hashed side by side, one message per SIMD lane
+// (gcc vector extensions; on x86-64 linux, an AVX2 version is picked at runtime, if the cpu supports it)
+
+#define SHA512LANES 4
+
+#ifdef __GNUC__
+typedef uint64_t sha512lanes __attribute__((vector_size(SHA512LANES * 8)));
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(__clang__) && __GNUC__ >= 6
+__attribute__((target_clones("avx2", "default")))
+#endif
+void sha512_compresslanes(uint64_t (*state)[8], const uchar * const *inbuf)
+{
+    const uint64_t *K = sha512K;
+    sha512lanes S[8], W[80];
+
+    loopi(8) loop(l, SHA512LANES) S[i][l] = state[l][i];
+    loopi(16) loop(l, SHA512LANES) W[i][l] = bigswap(((const uint64_t*)inbuf[l])[i]);
+    loopi(64) W[i + 16] = W[i] + W[i + 9] + (RR64(W[i + 14],19) ^ RR64(W[i + 14],61) ^ (W[i + 14] >> 6)) + (RR64(W[i + 1],1) ^ RR64(W[i + 1],  8) ^ (W[i + 1] >> 7));
+
+    for(int i = 0; i < 80; i += 8)
+    {
+        SHA512ROUND(S[0],S[1],S[2],S[3],S[4],S[5],S[6],S[7],i+0);
+        SHA512ROUND(S[7],S[0],S[1],S[2],S[3],S[4],S[5],S[6],i+1);
+        SHA512ROUND(S[6],S[7],S[0],S[1],S[2],S[3],S[4],S[5],i+2);
+        SHA512ROUND(S[5],S[6],S[7],S[0],S[1],S[2],S[3],S[4],i+3);
+        SHA512ROUND(S[4],S[5],S[6],S[7],S[0],S[1],S[2],S[3],i+4);
+        SHA512ROUND(S[3],S[4],S[5],S[6],S[7],S[0],S[1],S[2],i+5);
+        SHA512ROUND(S[2],S[3],S[4],S[5],S[6],S[7],S[0],S[1],i+6);
+        SHA512ROUND(S[1],S[2],S[3],S[4],S[5],S[6],S[7],S[0],i+7);
+    }
+    loopi(8) loop(l, SHA512LANES) state[l][i] += S[i][l];
+}
+#else
+void sha512_compresslanes(uint64_t (*state)[8], const uchar * const *inbuf)  // portable fallback
+{
+    loop(l, SHA512LANES) sha512_compress(state[l], inbuf[l]);
+}
+#endif
+
+void sha512_multi(uchar **hashes, const uchar **msgs, const int *lens, int n)  // same as n calls of sha512(), but faster
+{
+    struct lane { const uchar *msg; int blocks, full, done; uchar tail[256]; } lanes[SHA512LANES];
+    static const uchar dummy[128] = { 0 };
+    for(int first = 0; first < n; first += SHA512LANES)
+    {
+        int num = min(n - first, SHA512LANES), active = num;
+        uint64_t state[SHA512LANES][8];
+        loopi(num)
+        {
+            lane &ln = lanes[i];
+            int len = lens[first + i], rest = len & 127;
+            ln.msg = msgs[first + i];
+            ln.full = len >> 7;
+            ln.blocks = ln.full + (rest > 111 ? 2 : 1);
+            ln.done = 0;
+            memset(ln.tail, 0, sizeof(ln.tail));
+            memcpy(ln.tail, ln.msg + (len & ~127), rest);
+            ln.tail[rest] = 0x80;
+            *((uint64_t*)(ln.tail + (ln.blocks - ln.full) * 128 - 8)) = bigswap(len * 8ULL);
+            static const uint64_t init[8] = { 0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+                                              0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL };
+            memcpy(state[i], init, sizeof(init));
+        }
+        while(active > 1)
+        {
+            const uchar *in[SHA512LANES];
+            loopi(SHA512LANES)
+            {
+                lane &ln = lanes[i];
+                if(i >= num || ln.done >= ln.blocks) in[i] = dummy;
+                else in[i] = ln.done < ln.full ? ln.msg + ln.done * 128 : ln.tail + (ln.done - ln.full) * 128;
+            }
+            uint64_t out[SHA512LANES][8];
+            memcpy(out, state, sizeof(out));
+            sha512_compresslanes(out, in);
+            active = 0;
+            loopi(num) if(lanes[i].done < lanes[i].blocks)
+            {
+                memcpy(state[i], out[i], sizeof(state[i]));
+                if(++lanes[i].done < lanes[i].blocks) active++;
+            }
+        }
+        loopi(num)
+        {
+            lane &ln = lanes[i];
+            for(; ln.done < ln.blocks; ln.done++) sha512_compress(state[i], ln.done < ln.full ? ln.msg + ln.done * 128 : ln.tail + (ln.done - ln.full) * 128);
+            loopj(8) ((uint64_t*)hashes[first + i])[j] = bigswap(state[i][j]);
+        }
+    }
+}
 #undef RR64
 #undef SHA512ROUND
 
@@ -306,6 +509,39 @@ COMMANDF(tiger, "s", (char *msg)    // tiger debug command
     loopi(24) concatformatstring(erg, "%02x", hash.bytes[i]);
     conoutf("%s", erg);
 });
+
+void hashspeedtest(int *size)  // compare single and multi-buffer hashing of 64 messages
+{
+    const int num = 64;
+    int len = clamp(*size, 1, 1<<20);
+    uchar *data = new uchar[num * len], hashes[num][SHA512SIZE], *hp[num];
+    const uchar *msgs[num];
+    int lens[num];
+    entropy_get(data, num * len);
+    loopi(num)
+    {
+        msgs[i] = data + i * len;
+        lens[i] = len;
+        hp[i] = hashes[i];
+    }
+    stopwatch watch;
+    watch.start();
+    loopi(num) tigerhash(hashes[i], msgs[i], len);
+    int tsingle = watch.elapsed();
+    watch.start();
+    tigerhash_multi(hp, msgs, lens, num);
+    int tmulti = watch.elapsed();
+    conoutf("tiger, %d messages of %d bytes: %d ms single, %d ms multi-buffer", num, len, tsingle, tmulti);
+    watch.start();
+    loopi(num) sha512(hashes[i], msgs[i], len);
+    tsingle = watch.elapsed();
+    watch.start();
+    sha512_multi(hp, msgs, lens, num);
+    tmulti = watch.elapsed();
+    conoutf("sha512, %d messages of %d bytes: %d ms single, %d ms multi-buffer", num, len, tsingle, tmulti);
+    delete[] data;
+}
+COMMAND(hashspeedtest, "i");
 #endif
 #endif
 
@@ -321,6 +557,34 @@ int __hashtest() // crash, if hash functions don't work properly - no one ever t
     uchar shash[SHA512SIZE];
     sha512(shash, (uchar*)msg, strlen(msg));
     int res = memcmp(hash.bytes, ht, TIGERHASHSIZE) | memcmp(shash, hs, SHA512SIZE);
+
+    // multi-buffer hashing has to match the single-buffer functions: mixed lengths around the padding boundaries of both hashes,
+    // in different lane positions
+    static const int lens[] = { 0, 1, 55, 56, 63, 64, 65, 111, 112, 127, 128, 129, 183, 184, 200, 239, 240, 255, 256, 1000 };
+    const int num = sizeof(lens) / sizeof(lens[0]);
+    uchar data[1000 + num], mhashes[num][SHA512SIZE], *hp[num];
+    const uchar *msgs[num];
+    loopi(1000 + num) data[i] = uchar(i * 7 + (i >> 5));
+    loopi(num)
+    {
+        msgs[i] = data + i;
+        hp[i] = mhashes[i];
+    }
+    loop(first, 4)
+    {
+        tigerhash_multi(hp + first, msgs + first, lens + first, num - first);
+        for(int i = first; i < num; i++)
+        {
+            tigerhash(shash, msgs[i], lens[i]);
+            res |= memcmp(shash, mhashes[i], TIGERHASHSIZE);
+        }
+        sha512_multi(hp + first, msgs + first, lens + first, num - first);
+        for(int i = first; i < num; i++)
+        {
+            sha512(shash, msgs[i], lens[i]);
+            res |= memcmp(shash, mhashes[i], SHA512SIZE);
+        }
+    }
     ASSERT(!res);
     return res;
 }
@@ -637,13 +901,69 @@ void ed25519_sign(uchar *sm, int *smlen, const uchar *m, int mlen, const uchar *
     sc25519_to32bytes(sm + 32, &scs);       // sm: 32-byte R, 32-byte S, mlen-byte m
 }
 
+// ed25519_sign_check() is strict: it accepts only if R == S*B - H(R,A,m)*A.
+// batch verification is cofactored: it accepts if 8 * (S*B - H(R,A,m)*A - R) == 0 and rejects small-order R and A outright,
+// because random linear combinations can't tell torsion components apart from errors otherwise.
+// both accept the same signatures from ed25519_sign(); they differ only on signatures with deliberately added torsion components
+
+static void ge25519_mul8(ge25519 *r, const ge25519 *p)     // r = 8 * p
+{
+    ge25519_p1p1 t;
+    *r = *p;
+    loopi(3)
+    {
+        dbl_p1p1(&t, (ge25519_p2 *)r);
+        p1p1_to_p3(r, &t);
+    }
+}
+
+static bool ge25519_smallorder(const ge25519 *p)
+{
+    ge25519 q;
+    ge25519_mul8(&q, p);
+    return ge25519_isneutral_vartime(&q) != 0;
+}
+
+static bool unpacknegr(ge25519 *negr, const uchar *r)      // returns -R, false if R is no valid point, not canonically encoded or of small order
+{
+    if(ge25519_unpackneg_vartime(negr, r)) return false;
+    uchar rcheck[32];
+    fe25519 x;
+    fe25519_neg(&x, &negr->x);
+    fe25519_pack(rcheck, &negr->y);
+    rcheck[31] ^= fe25519_getparity(&x) << 7;
+    return !memcmp(rcheck, r, 32) && !ge25519_smallorder(negr);
+}
+
+// decompressed public keys are cached, so that repeated verifications with the same key (auth, certs) skip the square root
+// (the cache is not thread-safe: verify signatures only from the main thread)
+
+#define PUBKEYCACHESIZE 256
+
+static struct { uchar key[32]; ge25519 negkey; bool valid; } pubkeycache[PUBKEYCACHESIZE];
+
+static bool unpackpubkey(ge25519 *negkey, const uchar *pk)     // returns -pk, false if pk is no valid point
+{
+    uint h = (pk[0] | (pk[1] << 8)) & (PUBKEYCACHESIZE - 1);
+    if(pubkeycache[h].valid && !memcmp(pubkeycache[h].key, pk, 32))
+    {
+        *negkey = pubkeycache[h].negkey;
+        return true;
+    }
+    if(ge25519_unpackneg_vartime(negkey, pk)) return false;
+    memcpy(pubkeycache[h].key, pk, 32);
+    pubkeycache[h].negkey = *negkey;
+    pubkeycache[h].valid = true;
+    return true;
+}
+
 uchar *ed25519_sign_check(uchar *sm, int smlen, const uchar *pk)
 {
     uchar scopy[32], hram[64], rcheck[32];
     ge25519 get1, get2;
     sc25519 schram, scs;
 
-    if(smlen < 64 || (sm[63] & 224) || ge25519_unpackneg_vartime(&get1, pk)) return NULL;  // frame error
+    if(smlen < 64 || (sm[63] & 224) || !unpackpubkey(&get1, pk)) return NULL;  // frame error
 
     memmove(scopy, sm + 32, 32);
     sc25519_from32bytes(&scs, sm + 32);
@@ -661,6 +981,177 @@ uchar *ed25519_sign_check(uchar *sm, int smlen, const uchar *pk)
     return memcmp(rcheck, sm, 32) ? NULL : sm + 64;
 }
 
+static bool ed25519_sign_check_cofactored(uchar *sm, int smlen, const uchar *pk)  // single signature version of the batch check, for failed batches
+{
+    uchar scopy[32], hram[64];
+    ge25519 get1, get2, negr;
+    ge25519_p1p1 t;
+    sc25519 schram, scs;
+
+    if(smlen < 64 || (sm[63] & 224) || !unpackpubkey(&get1, pk) || ge25519_smallorder(&get1) || !unpacknegr(&negr, sm)) return false;  // frame error
+
+    memmove(scopy, sm + 32, 32);
+    sc25519_from32bytes(&scs, sm + 32);
+
+    memmove(sm + 32, pk, 32);
+    sha512(hram, sm, smlen);
+
+    sc25519_from64bytes(&schram, hram);
+
+    ge25519_double_scalarmult_vartime(&get2, &get1, &schram, &ge25519_base, &scs);
+    add_p1p1(&t, &get2, &negr);
+    p1p1_to_p3(&get2, &t);
+    ge25519_mul8(&get2, &get2);         // 8 * (S*B - H(R,A,m)*A - R)
+
+    memmove(sm + 32, scopy, 32);        // restore sm
+
+    return ge25519_isneutral_vartime(&get2) != 0;
+}
+
+// batch verification: instead of checking 8 * (S*B - H(R,A,m)*A - R) == 0 for every signature, check
+// 8 * sum(z * (S*B - H(R,A,m)*A - R)) == 0 for random 128-bit z, with one shared chain of point doublings for all signatures;
+// if a batch fails, its signatures are checked one by one to find the bad ones
+// (z is drawn from the entropy pool, not from the seedable pseudorandom generator, so it can't be predicted)
+
+#define ED25519BATCH 32
+
+static void ge25519_negate(ge25519 *r, const ge25519 *p)
+{
+    fe25519_neg(&r->x, &p->x);
+    r->y = p->y;
+    r->z = p->z;
+    fe25519_neg(&r->t, &p->t);
+}
+
+static bool ed25519_sign_check_chunk(uchar **sm, const int *smlen, const uchar **pk, int n, bool *valid)  // n <= ED25519BATCH
+{
+    struct term { ge25519 pre[4]; sc25519 scalar; signed char digits[85]; const uchar *key; };    // pre: 1*P .. 4*P
+    term *terms = new term[2 * n];
+    int numterms = 0;
+    sc25519 sb, z, s, h;
+    memset(&sb, 0, sizeof(sb));
+    uchar seed[16];
+    entropy_get(seed, sizeof(seed));
+    ge25519 points[2 * ED25519BATCH];                   // -R, -A
+    uchar scopy[ED25519BATCH][32], hram[ED25519BATCH][64], zbuf[ED25519BATCH][16 + 64 + 32], zhash[ED25519BATCH][64], *hashes[ED25519BATCH];
+    const uchar *msgs[ED25519BATCH];
+    int lens[ED25519BATCH], idx[ED25519BATCH], num = 0;
+    loopi(n)
+    {
+        valid[i] = false;
+        ge25519 &negr = points[2 * i], &nega = points[2 * i + 1];
+        if(smlen[i] < 64 || (sm[i][63] & 224) || !unpackpubkey(&nega, pk[i]) || ge25519_smallorder(&nega) || !unpacknegr(&negr, sm[i])) continue;  // same frame checks as ed25519_sign_check_cofactored()
+        valid[i] = true;
+        memmove(scopy[i], sm[i] + 32, 32);
+        memmove(sm[i] + 32, pk[i], 32);
+        hashes[num] = hram[i];
+        msgs[num] = sm[i];
+        lens[num] = smlen[i];
+        idx[num++] = i;
+    }
+    sha512_multi(hashes, msgs, lens, num);              // H(R,A,m)
+    loopj(num)
+    {
+        int i = idx[j];
+        memmove(sm[i] + 32, scopy[i], 32);              // restore sm
+        memcpy(zbuf[i], seed, 16);
+        memcpy(zbuf[i] + 16, hram[i], 64);
+        memcpy(zbuf[i] + 16 + 64, scopy[i], 32);
+        hashes[j] = zhash[i];
+        msgs[j] = zbuf[i];
+        lens[j] = sizeof(zbuf[i]);
+    }
+    sha512_multi(hashes, msgs, lens, num);              // z
+    loopj(num)
+    {
+        int i = idx[j];
+        sc25519_from64bytes(&h, hram[i]);
+        sc25519_from32bytes(&s, scopy[i]);
+        shortsc25519 zs;
+        shortsc25519_from16bytes(&zs, zhash[i]);
+        sc25519_from_shortsc(&z, &zs);
+
+        sc25519_mul(&s, &s, &z);
+        sc25519_add(&sb, &sb, &s);
+        sc25519_mul(&h, &h, &z);
+
+        term &tr = terms[numterms++];                   // z * -R
+        tr.pre[0] = points[2 * i];
+        tr.scalar = z;
+        tr.key = NULL;
+        term *ta = NULL;                                // z * H(R,A,m) * -A, merged for identical keys
+        loopk(numterms - 1) if(terms[k].key && !memcmp(terms[k].key, pk[i], 32)) { ta = &terms[k]; break; }
+        if(ta) sc25519_add(&ta->scalar, &ta->scalar, &h);
+        else
+        {
+            ta = &terms[numterms++];
+            ta->pre[0] = points[2 * i + 1];
+            ta->scalar = h;
+            ta->key = pk[i];
+        }
+    }
+    bool ok = true;
+    if(numterms)
+    {
+        ge25519_p1p1 t;
+        loopi(numterms)
+        {
+            term &tm = terms[i];
+            dbl_p1p1(&t, (ge25519_p2 *)&tm.pre[0]); p1p1_to_p3(&tm.pre[1], &t);
+            add_p1p1(&t, &tm.pre[0], &tm.pre[1]);   p1p1_to_p3(&tm.pre[2], &t);
+            dbl_p1p1(&t, (ge25519_p2 *)&tm.pre[1]); p1p1_to_p3(&tm.pre[3], &t);
+            sc25519_window3(tm.digits, &tm.scalar);
+        }
+        ge25519 r, q;
+        setneutral(&r);
+        for(int pos = 84; pos >= 0; pos--)
+        {
+            if(pos < 84) loopk(3)
+            {
+                dbl_p1p1(&t, (ge25519_p2 *)&r);
+                p1p1_to_p3(&r, &t);
+            }
+            loopi(numterms)
+            {
+                int d = terms[i].digits[pos];
+                if(!d) continue;
+                if(d > 0) add_p1p1(&t, &r, &terms[i].pre[d - 1]);
+                else
+                {
+                    ge25519_negate(&q, &terms[i].pre[-d - 1]);
+                    add_p1p1(&t, &r, &q);
+                }
+                p1p1_to_p3(&r, &t);
+            }
+        }
+        ge25519_scalarmult_base(&q, &sb);
+        add_p1p1(&t, &r, &q);
+        p1p1_to_p3(&r, &t);
+        ge25519_mul8(&r, &r);
+        ok = ge25519_isneutral_vartime(&r) != 0;
+    }
+    delete[] terms;
+    return ok;
+}
+
+int ed25519_sign_check_batch(uchar **sm, const int *smlen, const uchar **pk, int n, bool *valid)  // returns number of valid signatures, valid[] (optional) tells which
+{
+    bool chunkvalid[ED25519BATCH];
+    int numvalid = 0;
+    for(int first = 0; first < n; first += ED25519BATCH)
+    {
+        int num = min(n - first, ED25519BATCH);
+        bool ok = ed25519_sign_check_chunk(sm + first, smlen + first, pk + first, num, chunkvalid);
+        loopi(num)
+        {
+            if(chunkvalid[i] && !ok) chunkvalid[i] = ed25519_sign_check_cofactored(sm[first + i], smlen[first + i], pk[first + i]);
+            if(chunkvalid[i]) numvalid++;
+            if(valid) valid[first + i] = chunkvalid[i];
+        }
+    }
+    return numvalid;
+}
+
 
 #ifndef STANDALONE
 #ifdef _DEBUG
@@ -725,8 +1216,124 @@ void ed25519speedtest()  // check speed of ed25519 functions
     watch.start();
     loopi(200) ed25519_sign_check(smsg, 128, pub);
     conoutf("verify signature of 64-byte message: %.2f ms", watch.elapsed() / 200.0f);
+
+    const int numkeys = 16, numsigs = 4 * ED25519BATCH;    // batch verification: several signatures per key, like auth challenges of returning players
+    uchar *keys = new uchar[numkeys * 64], *smsgs = new uchar[numsigs * 128], *sms[numsigs];
+    const uchar *pks[numsigs];
+    int smlens[numsigs];
+    loopi(numkeys)
+    {
+        entropy_get(keys + i * 64, 32);
+        ed25519_pubkey_from_private(keys + i * 64 + 32, keys + i * 64);
+    }
+    loopi(numsigs)
+    {
+        entropy_get(msg, 64);
+        sms[i] = smsgs + i * 128;
+        pks[i] = keys + (i % numkeys) * 64 + 32;
+        ed25519_sign(sms[i], &smlens[i], msg, 64, keys + (i % numkeys) * 64);
+    }
+    watch.start();
+    int valid = 0;
+    loopi(numsigs) if(ed25519_sign_check(sms[i], smlens[i], pks[i])) valid++;
+    conoutf("verify %d signatures one by one: %.2f ms per signature (%d valid)", numsigs, watch.elapsed() / float(numsigs), valid);
+    watch.start();
+    valid = ed25519_sign_check_batch(sms, smlens, pks, numsigs, NULL);
+    conoutf("verify %d signatures in batches of %d: %.2f ms per signature (%d valid)", numsigs, ED25519BATCH, watch.elapsed() / float(numsigs), valid);
+    delete[] keys;
+    delete[] smsgs;
 }
 COMMAND(ed25519speedtest, "");
+
+static void ed25519_sign_torsion(uchar *sm, const uchar *m, int mlen, const uchar *priv, const uchar *pk, const ge25519 *torsion)  // sign with R + torsion
+{
+    uchar az[64], nonce[64], hram[64];
+    sc25519 sck, scs, sca;
+    ge25519 ger;
+    ge25519_p1p1 t;
+    sha512(az, priv, 32);
+    az[0] &= 248;
+    az[31] &= 127;
+    az[31] |= 64;
+    entropy_get(nonce, 64);
+    sc25519_from64bytes(&sck, nonce);
+    ge25519_scalarmult_base(&ger, &sck);
+    if(torsion)
+    {
+        add_p1p1(&t, &ger, torsion);
+        p1p1_to_p3(&ger, &t);
+    }
+    ge25519_pack(sm, &ger);
+    memcpy(sm + 32, pk, 32);
+    memmove(sm + 64, m, mlen);
+    sha512(hram, sm, mlen + 64);
+    sc25519_from64bytes(&scs, hram);
+    sc25519_from32bytes(&sca, az);
+    sc25519_mul(&scs, &scs, &sca);
+    sc25519_add(&scs, &scs, &sck);
+    sc25519_to32bytes(sm + 32, &scs);
+}
+
+void ed25519torsiontest()  // check batch verification against its single signature version, on signatures with torsion components in R or A
+{
+    const uchar order8[32] = { 0x26, 0xe8, 0x95, 0x8f, 0xc2, 0xb2, 0x27, 0xb0, 0x45, 0xc3, 0xf4, 0x89, 0xf2, 0xef, 0x98, 0xf0,
+                               0xd5, 0xdf, 0xac, 0x05, 0xd3, 0xc6, 0x33, 0x39, 0xb1, 0x38, 0x02, 0x88, 0x6d, 0x53, 0xfc, 0x05 };
+    ge25519 torsion, q;
+    ge25519_p1p1 t;
+    if(ge25519_unpackneg_vartime(&torsion, order8) || !ge25519_smallorder(&torsion)) { conoutf("bad torsion point"); return; }
+    dbl_p1p1(&t, (ge25519_p2 *)&torsion); p1p1_to_p3(&q, &t);
+    dbl_p1p1(&t, (ge25519_p2 *)&q); p1p1_to_p3(&q, &t);
+    if(ge25519_isneutral_vartime(&q)) { conoutf("torsion point is not of order 8"); return; }
+
+    uchar priv[32], pub[32], tpub[32], msg[64];
+    entropy_get(priv, 32);
+    ed25519_pubkey_from_private(pub, priv);
+    unpackpubkey(&q, pub);
+    ge25519_negate(&q, &q);
+    add_p1p1(&t, &q, &torsion);
+    p1p1_to_p3(&q, &t);
+    ge25519_pack(tpub, &q);                             // A + torsion, same private key
+
+    const int numsigs = 2 * ED25519BATCH;
+    uchar *smsgs = new uchar[numsigs * 128], *sms[numsigs];
+    const uchar *pks[numsigs];
+    int smlens[numsigs], expected = 0;
+    bool single[numsigs], batch[numsigs];
+    loopi(numsigs)
+    {
+        entropy_get(msg, 64);
+        sms[i] = smsgs + i * 128;
+        smlens[i] = 128;
+        pks[i] = i & 4 ? tpub : pub;
+        ed25519_sign_torsion(sms[i], msg, 64, priv, pks[i], i & 1 ? &torsion : NULL);
+        if(i & 2) sms[i][64]++;                         // altered message: has to fail
+        else if(i == 8) memcpy(sms[i], order8, 32);     // small-order R: has to fail
+        else expected++;
+    }
+    uchar *goodsms[numsigs];
+    const uchar *goodpks[numsigs];
+    int singlevalid = 0, strictvalid = 0, mismatches = 0, rounds = 64, numgood = 0;
+    loopi(numsigs)
+    {
+        if((single[i] = ed25519_sign_check_cofactored(sms[i], smlens[i], pks[i]))) singlevalid++;
+        if(ed25519_sign_check(sms[i], smlens[i], pks[i])) strictvalid++;
+        if(!(i & 2) && i != 8)                          // batches without bad signatures can only fail on torsion components
+        {
+            goodsms[numgood] = sms[i];
+            goodpks[numgood++] = pks[i];
+        }
+    }
+    loopj(rounds)
+    {
+        ed25519_sign_check_batch(sms, smlens, pks, numsigs, batch);
+        loopi(numsigs) if(batch[i] != single[i]) mismatches++;
+        ed25519_sign_check_batch(goodsms, smlens, goodpks, numgood, batch);
+        loopi(numgood) if(batch[i] != ed25519_sign_check_cofactored(goodsms[i], smlens[i], goodpks[i])) mismatches++;
+    }
+    conoutf("%d torsion-tweaked signatures: %d valid (%d expected), %d single/batch mismatches in %d rounds, %d valid in the strict check", numsigs, singlevalid, expected, mismatches, rounds, strictvalid);
+    delete[] smsgs;
+}
+COMMAND(ed25519torsiontest, "");
 #endif
 #endif
 
@@ -1512,6 +2119,33 @@ const char *genpwdhash(const char *name, const char *pwd, int salt)
     return temp;
 }
 
+int findpwdhash(const char *name, const char **pwds, int numpwds, int salt, const char *pwdhash)  // index of the first of pwds[] that matches genpwdhash(name, pwd, salt) == pwdhash, -1 if none does
+{
+    const int chunk = 4 * TIGERLANES;
+    string temp[chunk];
+    tiger::hashval hashes[chunk], *vals[chunk];
+    const uchar *msgs[chunk];
+    int lens[chunk];
+    for(int first = 0; first < numpwds; first += chunk)
+    {
+        int num = min(numpwds - first, chunk);
+        loopi(num)
+        {
+            formatstring(temp[i])("%s %d %s %s %d", pwds[first + i], salt, name, pwds[first + i], iabs(PROTOCOL_VERSION));
+            msgs[i] = (const uchar *)temp[i];
+            lens[i] = strlen(temp[i]);
+            vals[i] = &hashes[i];
+        }
+        tiger::hash_multi(msgs, lens, vals, num);
+        loopi(num)
+        {
+            formatstring(temp[i])("%s %s %s", hashchunktoa(hashes[i].chunks[0]), hashchunktoa(hashes[i].chunks[1]), hashchunktoa(hashes[i].chunks[2]));
+            if(!strcmp(temp[i], pwdhash)) return first + i;
+        }
+    }
+    return -1;
+}
+
 
 
 
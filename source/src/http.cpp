@@ -23,7 +23,7 @@ void httpget::reset(int keep) // keep == 0: delete all, keep == 1: keep connecti
         disconnect();
     }
     err = NULL;
-    response = chunked = gzipped = contentlength = offset = elapsedtime = traffic = 0;
+    response = chunked = gzipped = contentlength = offset = resumefrom = elapsedtime = traffic = 0;
     if(keep < 2) DELSTRING(url);
     DELSTRING(header);
     rawsnd.setsize(0);
@@ -75,6 +75,8 @@ void httpget::disconnect()
         enet_socket_destroy(tcp);
         tcp = ENET_SOCKET_NULL;
     }
+    pipelined.deletearrays(); // responses to pipelined requests are lost with the connection
+    surplus.setsize(0);
 }
 
 struct connectinfo { ENetSocket sock; ENetAddress address; volatile char running; };
@@ -131,6 +133,46 @@ bool httpget::connect(bool force)
     return true;
 }
 
+void httpget::request(const char *url1, int range, bool head) // assemble GET request
+{
+    cvecprintf(rawsnd, "%s %s HTTP/1.1%s", head ? "HEAD" : "GET", url1, crlf);
+    cvecprintf(rawsnd, "Host: %s%s", hostname, crlf);
+    cvecprintf(rawsnd, "Accept: */*%s", crlf);
+    if(referrer) cvecprintf(rawsnd, "Referer: %s%s", referrer, crlf);
+    if(useragent) cvecprintf(rawsnd, "User-Agent: %s%s", useragent, crlf);
+    if(range > 0) cvecprintf(rawsnd, "Range: bytes=%d-%sTE: gzip%s", range, crlf, crlf);  // content-encoding gzip for range requests is nonsense, so we'll ask for transfer-encoding instead (not that any server will deliver that...)
+    else if(!head) cvecprintf(rawsnd, "Accept-Encoding: gzip%s", crlf); // ask for gzip only for full requests, because we intend to unzip instantly
+    cvecprintf(rawsnd, "%s", crlf);
+}
+
+bool httpget::pipeline(const char *url1) // send a GET request ahead: get(url1) will then only wait for the response
+{
+    if(!connect()) return false;
+    rawsnd.setsize(0);
+    request(url1);
+    ENetBuffer buf;
+    buf.data = rawsnd.getbuf();
+    buf.dataLength = rawsnd.length();
+    stopwatch to;
+    to.start();
+    while(buf.dataLength > 0)
+    {
+        enet_uint32 events = ENET_SOCKET_WAIT_SEND;
+        int sent = enet_socket_wait(tcp, &events, 250) >= 0 && events ? enet_socket_send(tcp, NULL, &buf, 1) : 0;
+        if(sent < 0 || to.elapsed() > connecttimeout)
+        {
+            disconnect();
+            return false;
+        }
+        buf.data = (char *)buf.data + sent;
+        buf.dataLength -= sent;
+        traffic += sent;
+    }
+    tcp_age.start();
+    pipelined.add(newstring(url1));
+    return true;
+}
+
 int httpget::get(const char *url1, uint timeout, uint totaltimeout, int range, bool head)
 {
     int redirects = 0, res = 0, transferred = 0;
@@ -142,20 +184,26 @@ int httpget::get(const char *url1, uint timeout, uint totaltimeout, int range, b
     reset(1); // clear old response values and url
     url = newstring(url1);
 
-    bool reconnected = false, retry = false;
+    bool reconnected = false, retry = false, keepalive = true, havelength = false, present = false, broken = false;
+    if(pipelined.length() && !range && !head && !strcmp(pipelined[0], url)) present = true; // request was already sent
+    else if(pipelined.length() || surplus.length()) disconnect(); // out of order or unexpected data: start over
     for(;;)
     { // (in a loop because of possible redirects)
         if(!connect()) goto geterror;
+        if(present)
+        {
+            if(pipelined.length())
+            { // same connection: the response may even be here already
+                delete[] pipelined.remove(0);
+                rawrec.put(surplus.getbuf(), surplus.length());
+                surplus.setsize(0);
+            }
+            else present = false; // connect() started over (connection too old) and dropped the pipelined requests: send the request again
+        }
 
-        // assemble GET request
-        cvecprintf(rawsnd, "%s %s HTTP/1.1%s", head ? "HEAD" : "GET", url, crlf);
-        cvecprintf(rawsnd, "Host: %s%s", hostname, crlf);
-        cvecprintf(rawsnd, "Accept: */*%s", crlf);
-        if(referrer) cvecprintf(rawsnd, "Referer: %s%s", referrer, crlf);
-        if(useragent) cvecprintf(rawsnd, "User-Agent: %s%s", useragent, crlf);
-        if(range > 0) cvecprintf(rawsnd, "Range: bytes=%d-%sTE: gzip%s", range, crlf, crlf);  // content-encoding gzip for range requests is nonsense, so we'll ask for transfer-encoding instead (not that any server will deliver that...)
-        else if(!head) cvecprintf(rawsnd, "Accept-Encoding: gzip%s", crlf); // ask for gzip only for full requests, because we intend to unzip instantly
-        cvecprintf(rawsnd, "%s", crlf);
+        // assemble GET request (unless pipelined)
+        if(!present) request(url, range, head);
+        present = false;
 
         // send request
         execcallback(0);
@@ -189,30 +237,38 @@ int httpget::get(const char *url1, uint timeout, uint totaltimeout, int range, b
         }
 
         // get response
-        bool again = false, haveheader = false;
+        bool again = false, haveheader = false, pending = rawrec.length() > 0; // (pipelined response data may have arrived with the previous response)
         if(!retry) for(;;)
         {
             elapsedtime = to.elapsed();
-            if(elapsedtime > totaltimeout || elapsedtime > lastresponse + timeout) GETERROR(elapsedtime > totaltimeout ? "timeout 2" : "timeout 3");
+            if(elapsedtime > totaltimeout || elapsedtime > lastresponse + timeout)
+            {
+                broken = true;
+                GETERROR(elapsedtime > totaltimeout ? "timeout 2" : "timeout 3");
+            }
             float progress = -float(elapsedtime - lastresponse) / timeout;
             enet_uint32 events = ENET_SOCKET_WAIT_RECEIVE;
             if(rawrec.length() > maxsize || datarec.length() > maxsize) break;
-            if(enet_socket_wait(tcp, &events, 250) >= 0 && events)
+            if(pending || (enet_socket_wait(tcp, &events, 250) >= 0 && events))
             {
-                if(rawrec.length() >= rawrec.capacity()) rawrec.reserve(4096);
-                buf.data = rawrec.getbuf() + rawrec.length();
-                buf.dataLength = rawrec.capacity() - rawrec.length();
-                int recv = enet_socket_receive(tcp, NULL, &buf, 1);
-                if(recv <= 0)
+                if(!pending)
                 {
-                    if(!haveheader && !reconnected) retry = true; // line may be half dead - retry once
-                    break;
+                    if(rawrec.length() >= rawrec.capacity()) rawrec.reserve(4096);
+                    buf.data = rawrec.getbuf() + rawrec.length();
+                    buf.dataLength = rawrec.capacity() - rawrec.length();
+                    int recv = enet_socket_receive(tcp, NULL, &buf, 1);
+                    if(recv <= 0)
+                    {
+                        if(!haveheader && !reconnected) retry = true; // line may be half dead - retry once
+                        break;
+                    }
+                    rawrec.advance(recv);
+                    tcp_age.start();
+                    traffic += recv;
+                    if((transferred += recv) > maxtransfer) GETERROR("transfer size exceeds limit");
+                    lastresponse = to.elapsed();
                 }
-                rawrec.advance(recv);
-                tcp_age.start();
-                traffic += recv;
-                if((transferred += recv) > maxtransfer) GETERROR("transfer size exceeds limit");
-                lastresponse = to.elapsed();
+                pending = false;
 
                 // parsing received data
                 rawrec.add('\0'); // append '\0' to use string functions safely - will be removed again
@@ -262,13 +318,14 @@ int httpget::get(const char *url1, uint timeout, uint totaltimeout, int range, b
                         }
                         // response was 2xx, check for some extras
                         char *u = header_uc + (p - header), *f, *n;
+                        if(!strncmp(header_uc, "HTTP/1.0", 8) || ((f = strstr(u, "CONNECTION: ")) && (n = strchr(f, LF)) && (f = strstr(f, "CLOSE")) && f < n)) keepalive = false;
                         if((f = strstr(u, "TRANSFER-ENCODING: ")) && (n = strchr(f, LF)))
                         {
                             if((f = strstr(f, "CHUNKED")) && f < n) chunked = 1;
                             if((f = strstr(f, "GZIP")) && f < n) gzipped = 1; // untested: I could not find a server who delivers that
                         }
                         if((f = strstr(u, "CONTENT-ENCODING: ")) && (n = strchr(f, LF)) && (f = strstr(f, "GZIP")) && f < n) gzipped = 1;
-                        if((f = strstr(u, "CONTENT-LENGTH: ")) && (f = strchr(f, ' '))) contentlength = atoi(f + 1);
+                        if((f = strstr(u, "CONTENT-LENGTH: ")) && (f = strchr(f, ' '))) { contentlength = atoi(f + 1); havelength = true; }
                         if((f = strstr(u, "CONTENT-RANGE: ")) && (n = strchr(f, LF)) && (f = strstr(f, "BYTES ")) && (f = strchr(f, ' ')) && f < n) offset = atoi(f + 1);
                         DELSTRING(header_uc);
                     }
@@ -301,9 +358,9 @@ int httpget::get(const char *url1, uint timeout, uint totaltimeout, int range, b
                     }
                     else
                     {
-                        if(contentlength > 0)
+                        if(havelength)
                         {
-                            progress = float(rawrec.length() - 1) / contentlength; // get a real progress bar
+                            progress = float(rawrec.length() - 1) / (contentlength | 1); // get a real progress bar
                             if(rawrec.length() - 1 >= contentlength) content = &rawrec;
                         }
                         else progress = float(rawrec.length() - 1) / (maxtransfer | 1); // not accurate, but moving
@@ -324,7 +381,34 @@ int httpget::get(const char *url1, uint timeout, uint totaltimeout, int range, b
         if(again) continue; // redirect
         else break;
     }
-    if(!content) content = &rawrec; // end by "server close connection" - this should maybe be flagged as error instead
+    if(head)
+    { // no content, anything else belongs to the next response
+        surplus.put(rawrec.getbuf(), rawrec.length());
+        rawrec.setsize(0);
+        content = &rawrec;
+    }
+    else if(!content)
+    { // end by "server close connection"
+        if(havelength)
+        { // ...before the announced length
+            broken = true;
+            GETERROR("connection closed");
+        }
+        content = &rawrec;
+        keepalive = false;
+    }
+    else if(content == &rawrec && rawrec.length() > contentlength)
+    { // response to the next pipelined request
+        surplus.put(rawrec.getbuf() + contentlength, rawrec.length() - contentlength);
+        rawrec.setsize(contentlength);
+    }
+    else if(content == &datarec) surplus.put(rawrec.getbuf(), rawrec.length());
+    if(range > 0 && response == 200)
+    { // server ignored the range: complete content follows, replace the partial content
+        if(outvec) outvec->setsize(0);
+        if(outstream) outstream->seek(0);
+    }
+    else if(range > 0 && response == 206 && offset != range) GETERROR("bad range");
     if(gzipped)
     {
         z_stream zs;
@@ -367,7 +451,13 @@ int httpget::get(const char *url1, uint timeout, uint totaltimeout, int range, b
 geterror:
     if(res > maxsize) err = "output truncated";
     elapsedtime = to.elapsed();
-    if(err) disconnect();
+    if(err && broken && header && (response == 200 || response == 206) && !chunked && !gzipped && !head && rawrec.length() && !content)
+    { // transfer broke off: keep what we got, get(url, .., resumefrom) can continue from here
+        if(outvec) outvec->insert(outvec->length(), (const uchar *)rawrec.getbuf(), rawrec.length());
+        if(outstream) outstream->write(rawrec.getbuf(), rawrec.length());
+        resumefrom = offset + rawrec.length();
+    }
+    if(err || !keepalive) disconnect();
     return err ? -1 : res;
 }
 
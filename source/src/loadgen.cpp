@@ -0,0 +1,532 @@
+// loadgen.cpp: headless load generator for the dedicated server
+// simulates a crowd of players in one process: every simulated client has its own enet host, does the real
+// connect/welcome handshake, walks around on the map floorplan, shoots, reloads and chats - and we measure, how the server copes
+
+#include "cube.h"
+
+// loadmapstats() provides the floorplan of the map
+char *maplayout = NULL, *testlayout = NULL;
+int maplayout_factor, testlayout_factor, maplayoutssize;
+int Mvolume, Marea, SHhits, Mopen = 0;
+float Mheight = 0;
+int checkarea(int maplayout_factor, char *maplayout) { return 0; }  // (area statistics are not needed here)
+
+void fatal(const char *s, ...)
+{
+    defvformatstring(msg,s,s);
+    printf("ac_loadgen fatal error: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+// configuration
+
+static int numsims = 32, serverport = CUBE_DEFAULT_SERVER_PORT, duration = 0, rampup = 250, statsinterval = 10;
+static int shootrate = 60, hitrate = 25, reloadrate = 6, chatrate = 1;     // per minute (hitrate: percentage of the shots)
+static const char *servername = "localhost", *serverpassword = "";
+static ENetAddress serveraddress;
+
+// map of the server
+
+static string mapname = "";
+static int mapcgzsize = 0, maprevision = 0;
+static vector<vec> mapspawns;
+
+static void loadmap(const char *name, int available, int revision)
+{
+    copystring(mapname, behindpath(name));
+    mapcgzsize = available;
+    maprevision = revision;
+    mapspawns.setsize(0);
+    DELETEA(maplayout);
+    static const char *mappaths[] = { "packages/maps/servermaps/incoming/", "packages/maps/servermaps/", "packages/maps/official/", "packages/maps/" };
+    loopi(sizeof(mappaths) / sizeof(mappaths[0]))
+    {
+        defformatstring(filename)("%s%s.cgz", mappaths[i], mapname);
+        mapstats *ms = loadmapstats(path(filename), true);
+        if(!ms) continue;
+        mapcgzsize = ms->cgzsize;
+        maprevision = ms->hdr.maprevision;
+        loopj(ms->hdr.numents) if(ms->enttypes[j] == PLAYERSTART) mapspawns.add(vec(ms->entposs[j * 3], ms->entposs[j * 3 + 1], 0));
+        printf("map %s: %s, size %d, revision %d, %d spawns\n", mapname, filename, mapcgzsize, maprevision, mapspawns.length());
+        return;
+    }
+    printf("map %s not found locally, walking blind\n", mapname);
+}
+
+static float floorheight(float x, float y)    // -1: solid or outside the map
+{
+    int ssize = 1 << maplayout_factor;
+    if(!maplayout) return x >= 1 && y >= 1 && x < 255 && y < 255 ? 0 : -1;
+    if(x < 2 || y < 2 || x >= ssize - 2 || y >= ssize - 2) return -1;
+    char f = maplayout[int(x) + (int(y) << maplayout_factor)];
+    return f == 127 ? -1 : f;
+}
+
+// statistics
+
+struct loadgenstats
+{
+    int pongs, rttsum, rttmax;
+    int wspackets;
+    double wsintsum, wsintsqsum;
+    int wsintmax;
+    int shots, hits, reloads, chats, spawns, deaths, disconnects;
+    double rec, sent;
+
+    void reset() { memset(this, 0, sizeof(loadgenstats)); }
+};
+
+static loadgenstats stats, totals;
+
+// simulated clients
+
+enum { SIM_CONNECTING = 0, SIM_INTRO, SIM_PLAYING, SIM_DISCONNECTED };
+
+struct simclient
+{
+    int num, status, clientnum, lifesequence, gun, mag, fullmag, ammo;
+    bool alive;
+    ENetHost *host;
+    ENetPeer *peer;
+    enet_uint32 cookie;
+    vec o;
+    float yaw;
+    int connectmillis, lastupdate, lastping, lastws, nextshot, nextreload, nextchat, nexttryspawn;
+
+    simclient() : status(SIM_DISCONNECTED), clientnum(-1), host(NULL), peer(NULL) {}
+};
+
+static vector<simclient> sims;
+static int lgmillis = 0;
+
+static int nextevent(int rate)  // random interval for "rate" events per minute
+{
+    return rate > 0 ? lgmillis + 1 + rnd(2 * 60000 / rate) : INT_MAX;
+}
+
+static simclient *findsim(ENetHost *host)
+{
+    loopv(sims) if(sims[i].host == host) return &sims[i];
+    return NULL;
+}
+
+static int ENET_CALLBACK simconnectchallenge(ENetHost *host, ENetEvent *event)   // see client.cpp
+{
+    simclient *c = findsim(host);
+    if(!c || !c->peer || c->peer->state != ENET_PEER_STATE_CONNECTING || host->receivedDataLength != CONNECTCOOKIE_LEN) return 0;
+    enet_uint32 d[CONNECTCOOKIE_LEN / 4];
+    memcpy(d, host->receivedData, CONNECTCOOKIE_LEN);
+    if(ENET_NET_TO_HOST_32(d[0]) != CONNECTCOOKIE_MAGIC || !d[1]) return 0;
+    c->cookie = ENET_NET_TO_HOST_32(d[1]);
+    return 1;
+}
+
+static void simconnect(simclient &c)
+{
+    if(!c.host && (c.host = enet_host_create(NULL, 1, 3, 0, 0))) c.host->intercept = simconnectchallenge;
+    if(!c.host) fatal("could not create enet host");
+    c.peer = enet_host_connect(c.host, &serveraddress, 3, 0);
+    c.status = SIM_CONNECTING;
+    c.clientnum = -1;
+    c.alive = false;
+    c.cookie = 0;
+    c.connectmillis = lgmillis;
+}
+
+static void simsend(simclient &c, int chan, packetbuf &p)
+{
+    enet_peer_send(c.peer, chan, p.finalize());
+}
+
+static void simsendf(simclient &c, const char *format, ...)     // reliable message on channel 1; i: int, s: string
+{
+    packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+    va_list args;
+    va_start(args, format);
+    while(*format) switch(*format++)
+    {
+        case 'i': putint(p, va_arg(args, int)); break;
+        case 's': sendstring(va_arg(args, const char *), p); break;
+    }
+    va_end(args);
+    simsend(c, 1, p);
+}
+
+static void simspawnpos(simclient &c)
+{
+    c.o = vec(128, 128, 0);
+    if(mapspawns.length()) c.o = mapspawns[rnd(mapspawns.length())];
+    else if(maplayout) loopi(1000)
+    {
+        int ssize = 1 << maplayout_factor;
+        c.o = vec(rnd(ssize), rnd(ssize), 0);
+        if(floorheight(c.o.x, c.o.y) >= 0) break;
+    }
+    c.o.z = max(floorheight(c.o.x, c.o.y), 0.0f);
+    c.yaw = rnd(360);
+}
+
+static void simwalk(simclient &c, int elapsed)
+{
+    const float speed = 12.0f / 1000;  // cubes per millisecond
+    loopi(4)
+    {
+        float dist = speed * elapsed, nx = c.o.x + sinf(RAD * c.yaw) * dist, ny = c.o.y - cosf(RAD * c.yaw) * dist, nz = floorheight(nx, ny);
+        if(nz >= 0 && nz <= c.o.z + 1 && rnd(100))    // (can step up one cube, and sometimes changes direction for no reason)
+        {
+            c.o = vec(nx, ny, nz);
+            return;
+        }
+        c.yaw = rnd(360);
+    }
+}
+
+static void sendposition(simclient &c)
+{
+    packetbuf q(100);
+    putint(q, SV_POS);
+    putint(q, c.clientnum);
+    putuint(q, int(c.o.x * DMF));
+    putuint(q, int(c.o.y * DMF));
+    putuint(q, int(c.o.z * DMF));
+    putuint(q, int(c.yaw));
+    putint(q, 0);                                           // pitch
+    putuint(q, 0);                                          // no roll, no velocity
+    putuint(q, (1 << 2) | (1 << 4) | ((c.lifesequence & 1) << 6));   // move forward, onfloor
+    simsend(c, 0, q);
+}
+
+static void sendshot(simclient &c)
+{
+    simclient *target = NULL;
+    if(rnd(100) < hitrate)
+    {
+        int t = rnd(sims.length());
+        loopv(sims)
+        {
+            simclient &s = sims[(t + i) % sims.length()];
+            if(&s != &c && s.alive && s.clientnum >= 0) { target = &s; break; }
+        }
+    }
+    vec to = target ? target->o : vec(c.o.x + sinf(RAD * c.yaw) * 50, c.o.y - cosf(RAD * c.yaw) * 50, c.o.z + 4);
+    packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+    putint(p, SV_SHOOT);
+    putint(p, lgmillis - c.connectmillis);
+    putint(p, c.gun);
+    loopi(3) putint(p, int(to[i] * DMF));
+    putint(p, target ? 1 : 0);
+    if(target)
+    {
+        vec dir = vec(to).sub(c.o).normalize();
+        putint(p, target->clientnum);
+        putint(p, target->lifesequence);
+        putint(p, 0);                                       // info
+        loopi(3) putint(p, int(dir[i] * DNF));
+        stats.hits++;
+    }
+    simsend(c, 1, p);
+    c.mag--;
+    stats.shots++;
+}
+
+static void simupdate(simclient &c)
+{
+    if(c.status != SIM_PLAYING || c.clientnum < 0) return;
+    if(lgmillis - c.lastping > 250)
+    {
+        simsendf(c, "ii", SV_PING, lgmillis);
+        c.lastping = lgmillis;
+    }
+    if(!c.alive)
+    {
+        if(lgmillis > c.nexttryspawn)
+        {
+            simsendf(c, "i", SV_TRYSPAWN);
+            c.nexttryspawn = lgmillis + 2000;
+        }
+        return;
+    }
+    int elapsed = lgmillis - c.lastupdate;
+    if(elapsed >= 40)       // like the real client: 25 updates per second
+    {
+        simwalk(c, elapsed);
+        sendposition(c);
+        c.lastupdate = lgmillis;
+    }
+    if(lgmillis > c.nextshot)
+    {
+        if(c.mag > 0) sendshot(c);
+        c.nextshot = nextevent(shootrate);
+    }
+    if(lgmillis > c.nextreload || (c.mag <= 0 && c.ammo > 0))
+    {
+        simsendf(c, "iii", SV_RELOAD, lgmillis - c.connectmillis, c.gun);
+        int n = min(c.ammo, c.fullmag - c.mag);
+        if(n > 0) { c.mag += n; c.ammo -= n; }
+        c.nextreload = nextevent(reloadrate);
+        stats.reloads++;
+    }
+    if(lgmillis > c.nextchat)
+    {
+        defformatstring(text)("load test message %d from %d", rnd(10000), c.num);
+        simsendf(c, "is", SV_TEXT, text);
+        c.nextchat = nextevent(chatrate);
+        stats.chats++;
+    }
+}
+
+static void simparse(simclient &c, int chan, uchar *buf, int len)     // only the first message of a packet is parsed: that's good enough for all sendf() messages
+{
+    ucharbuf p(buf, len);
+    if(chan == 0)
+    { // worldstate positions: measure the server tick
+        if(c.lastws)
+        {
+            int interval = lgmillis - c.lastws;
+            stats.wspackets++;
+            stats.wsintsum += interval;
+            stats.wsintsqsum += double(interval) * interval;
+            stats.wsintmax = max(stats.wsintmax, interval);
+        }
+        c.lastws = lgmillis;
+        return;
+    }
+    char text[MAXTRANS];
+    int type = getint(p);
+    switch(type)
+    {
+        case SV_SERVINFO:
+        {
+            c.clientnum = getint(p);
+            getint(p);
+            int salt = getint(p);
+            defformatstring(name)("loadgen%d", c.num);
+            simsendf(c, "iiisssiiii", SV_CONNECT, AC_VERSION, 0, name, genpwdhash(name, serverpassword, salt), "", CR_DEFAULT, GUN_ASSAULT, 0, 0);
+            c.status = SIM_INTRO;
+            break;
+        }
+
+        case SV_WELCOME:
+            c.status = SIM_PLAYING;
+            if(getint(p) < 0 || getint(p) != SV_MAPCHANGE) break;
+            // fall through
+        case SV_MAPCHANGE:
+        {
+            getstring(text, p);
+            getint(p);
+            int available = getint(p), revision = getint(p);
+            if(strcmp(mapname, behindpath(text))) loadmap(text, available, revision);
+            simsendf(c, "iii", SV_MAPIDENT, mapcgzsize, maprevision);
+            c.alive = false;
+            c.nexttryspawn = lgmillis + 500 + rnd(1000);
+            break;
+        }
+
+        case SV_SPAWNSTATE:
+        {
+            c.lifesequence = getint(p);
+            loopi(3) getint(p);                 // health, armour, primary
+            c.gun = getint(p);
+            getint(p);                          // arena spawn
+            int ammo[NUMGUNS], mag[NUMGUNS];
+            loopi(NUMGUNS) ammo[i] = getint(p);
+            loopi(NUMGUNS) mag[i] = getint(p);
+            if(!valid_weapon(c.gun)) c.gun = GUN_PISTOL;
+            c.ammo = ammo[c.gun];
+            c.mag = c.fullmag = mag[c.gun];
+            simspawnpos(c);
+            simsendf(c, "iii", SV_SPAWN, c.lifesequence, c.gun);
+            c.alive = true;
+            c.nextshot = nextevent(shootrate);
+            c.nextreload = nextevent(reloadrate);
+            c.nextchat = nextevent(chatrate);
+            stats.spawns++;
+            break;
+        }
+
+        case SV_DIED:
+        case SV_GIBDIED:
+        case SV_FORCEDEATH:
+            if(getint(p) == c.clientnum && c.alive)
+            {
+                c.alive = false;
+                c.nexttryspawn = lgmillis + 1000 + rnd(4000);
+                stats.deaths++;
+            }
+            break;
+
+        case SV_PONG:
+        {
+            int rtt = lgmillis - getint(p);
+            stats.pongs++;
+            stats.rttsum += rtt;
+            stats.rttmax = max(stats.rttmax, rtt);
+            break;
+        }
+    }
+}
+
+static void simservice(simclient &c)
+{
+    if(!c.host) return;
+    if(c.cookie && c.peer && c.status == SIM_CONNECTING)
+    { // the server wants proof of our address
+        enet_peer_reset(c.peer);
+        c.peer = enet_host_connect(c.host, &serveraddress, 3, c.cookie);
+        c.cookie = 0;
+    }
+    ENetEvent event;
+    while(c.host && enet_host_service(c.host, &event, 0) > 0) switch(event.type)
+    {
+        case ENET_EVENT_TYPE_RECEIVE:
+            simparse(c, event.channelID, event.packet->data, (int)event.packet->dataLength);
+            enet_packet_destroy(event.packet);
+            break;
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+            if(c.status != SIM_DISCONNECTED) printf("client %d disconnected (reason %d)\n", c.num, event.data);
+            c.status = SIM_DISCONNECTED;
+            c.alive = false;
+            c.peer = NULL;
+            stats.disconnects++;
+            return;
+
+        default:
+            break;
+    }
+    if(c.status == SIM_CONNECTING && lgmillis - c.connectmillis > 10000)
+    {
+        printf("client %d could not connect\n", c.num);
+        if(c.peer) enet_peer_reset(c.peer);
+        c.peer = NULL;
+        c.status = SIM_DISCONNECTED;
+        stats.disconnects++;
+    }
+}
+
+static void collectbandwidth(loadgenstats &s)
+{
+    loopv(sims) if(sims[i].host)
+    {
+        ENetHost *h = sims[i].host;
+        s.rec += h->totalReceivedData;
+        s.sent += h->totalSentData;
+        h->totalReceivedData = h->totalSentData = 0;
+    }
+}
+
+static void printstats(loadgenstats &s, int millis, const char *what)
+{
+    int playing = 0, alive = 0;
+    loopv(sims)
+    {
+        if(sims[i].status == SIM_PLAYING) playing++;
+        if(sims[i].alive) alive++;
+    }
+    float secs = max(millis, 1) / 1000.0f, wsavg = s.wspackets ? s.wsintsum / s.wspackets : 0, wssd = s.wspackets ? sqrt(max(s.wsintsqsum / s.wspackets - wsavg * wsavg, 0.0)) : 0;
+    printf("%s %.0fs: %d/%d playing, %d alive | rtt avg %.1f max %d ms | ticks avg %.1f sd %.1f max %d ms | %.1f rec %.1f send K/sec | "
+           "%d shots (%d hits), %d reloads, %d chats, %d spawns, %d deaths, %d disconnects\n",
+           what, secs, playing, sims.length(), alive, s.pongs ? float(s.rttsum) / s.pongs : 0.0f, s.rttmax, wsavg, wssd, s.wsintmax,
+           s.rec / secs / 1024, s.sent / secs / 1024, s.shots, s.hits, s.reloads, s.chats, s.spawns, s.deaths, s.disconnects);
+    fflush(stdout);
+}
+
+static void addstats(loadgenstats &t, const loadgenstats &s)
+{
+    t.pongs += s.pongs; t.rttsum += s.rttsum; t.rttmax = max(t.rttmax, s.rttmax);
+    t.wspackets += s.wspackets; t.wsintsum += s.wsintsum; t.wsintsqsum += s.wsintsqsum; t.wsintmax = max(t.wsintmax, s.wsintmax);
+    t.rec += s.rec; t.sent += s.sent;
+    t.shots += s.shots; t.hits += s.hits; t.reloads += s.reloads; t.chats += s.chats; t.spawns += s.spawns; t.deaths += s.deaths; t.disconnects += s.disconnects;
+}
+
+static void usage()
+{
+    printf("usage: ac_loadgen [options] [server]\n"
+           "  -c<n>              number of simulated clients (default %d, max %d)\n"
+           "  -f<port>           server port (default %d)\n"
+           "  -t<seconds>        stop after that time (default: run until interrupted)\n"
+           "  -r<ms>             delay between connecting clients (default %d, the server rate limits connects per subnet)\n"
+           "  -i<seconds>        statistics interval (default %d)\n"
+           "  -p<password>       server password\n"
+           "  --shootrate=<n>    shots per minute and client (default %d)\n"
+           "  --hitrate=<n>      percentage of shots that hit another simulated client (default %d)\n"
+           "  --reloadrate=<n>   extra reloads per minute and client (default %d)\n"
+           "  --chatrate=<n>     chat messages per minute and client (default %d)\n",
+           numsims, MAXCLIENTS, serverport, rampup, statsinterval, shootrate, hitrate, reloadrate, chatrate);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        if(a[0] != '-') { servername = a; continue; }
+        int ai = atoi(a + 2);
+        switch(a[1])
+        {
+            case 'c': numsims = clamp(ai, 1, MAXCLIENTS); break;
+            case 'f': if(ai > 0 && ai < 65536) serverport = ai; break;
+            case 't': duration = max(ai, 0); break;
+            case 'r': rampup = max(ai, 0); break;
+            case 'i': statsinterval = max(ai, 1); break;
+            case 'p': serverpassword = a + 2; break;
+            case '-':
+                if(!strncmp(a, "--shootrate=", 12)) shootrate = max(atoi(a + 12), 0);
+                else if(!strncmp(a, "--hitrate=", 10)) hitrate = clamp(atoi(a + 10), 0, 100);
+                else if(!strncmp(a, "--reloadrate=", 13)) reloadrate = max(atoi(a + 13), 0);
+                else if(!strncmp(a, "--chatrate=", 11)) chatrate = max(atoi(a + 11), 0);
+                else usage();
+                break;
+            default: usage();
+        }
+    }
+    if(enet_initialize() < 0) fatal("unable to initialise network module");
+    enet_time_set(0);   // start the clock at 0, like the server: lgmillis is an int
+    serveraddress.port = serverport;
+    if(enet_address_set_host(&serveraddress, servername) < 0) fatal("could not resolve %s", servername);
+    seedMT(time(NULL));
+    printf("ac_loadgen: %d clients to %s:%d, %d shots, %d reloads, %d chats per minute and client\n", numsims, servername, serverport, shootrate, reloadrate, chatrate);
+
+    sims.pad(numsims);
+    loopv(sims) sims[i].num = i;
+    lgmillis = enet_time_get();
+    int started = 0, startmillis = lgmillis, laststats = lgmillis, nextconnect = lgmillis;
+    stats.reset();
+    totals.reset();
+    for(;;)
+    {
+        lgmillis = enet_time_get();
+        if(started < sims.length() && lgmillis >= nextconnect)
+        {
+            simconnect(sims[started++]);
+            nextconnect = lgmillis + rampup;
+        }
+        loopv(sims)
+        {
+            simservice(sims[i]);
+            simupdate(sims[i]);
+            if(sims[i].host) enet_host_flush(sims[i].host);
+        }
+        if(lgmillis - laststats >= statsinterval * 1000)
+        {
+            collectbandwidth(stats);
+            printstats(stats, lgmillis - laststats, "last");
+            addstats(totals, stats);
+            stats.reset();
+            laststats = lgmillis;
+        }
+        if(duration && lgmillis - startmillis > duration * 1000) break;
+        sl_sleep(2);
+    }
+    collectbandwidth(stats);
+    addstats(totals, stats);
+    printstats(totals, lgmillis - startmillis, "total");
+    loopv(sims) if(sims[i].host)
+    {
+        if(sims[i].peer) enet_peer_disconnect_now(sims[i].peer, DISC_NONE);
+        enet_host_destroy(sims[i].host);
+    }
+    enet_deinitialize();
+    return EXIT_SUCCESS;
+}
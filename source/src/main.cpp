@@ -1468,6 +1468,7 @@ int main(int argc, char **argv)
         if(millis>lastflush+60000) { fflush(stdout); lastflush = millis; }
 #endif
         pollautodownloadresponse();
+        pollmapprefetch();
     }
 
     quit();
@@ -1,6 +1,11 @@
 #include "cube.h"
 #include <signal.h>
 #include <enet/time.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define MASTER_EPOLL    // epoll instead of select(), which is limited to FD_SETSIZE sockets
+#define MASTER_MMSG     // sendmmsg/recvmmsg for server pings
+#endif
 
 #define INPUT_LIMIT 4096
 #define OUTPUT_LIMIT (64*1024)
@@ -8,12 +13,25 @@
 #define AUTH_TIME (60*1000)
 #define AUTH_LIMIT 100
 #define AUTH_THROTTLE 1000
+#ifdef MASTER_EPOLL
+#define CLIENT_LIMIT 65536
+#else
 #define CLIENT_LIMIT 8192
+#endif
 #define DUP_LIMIT 16
 #define PING_TIME 3000
 #define PING_RETRY 5
 #define KEEPALIVE_TIME (65*60*1000)
 #define SERVER_LIMIT (10*1024)
+#define HOST_SHARDS 4096
+#define WHEEL_SLOTS 256
+#define WHEEL_TICK 1000
+#define EPOLL_EVENTS 256
+#define ACCEPT_LIMIT 64
+#define LIST_HISTORY 64
+#define PING_BATCH 64
+#define PING_RATE 2000
+#define KEEPALIVE_CHECK 64
 
 FILE *logfile = NULL;
 
@@ -115,16 +133,57 @@ struct gameserver
     string ip;
     int port, numpings;
     enet_uint32 lastping, lastpong;
+    bool listed;        // part of the current server list version
+    enet_uint32 pingdue;
+    gameserver *pingprev, *pingnext;    // verification queue
+    bool queued;
 };
 vector<gameserver *> gameservers;
 
+hashtable<ENetAddress, gameserver *> gameserverindex(1<<12);     // by ping address
+
+// servers waiting for a (re)ping, ordered by due time: pings are sent in batches at a limited rate,
+// so that many servers registering at once (e.g. after a restart of the master) are verified over time
+
+gameserver *pinghead = NULL, *pingtail = NULL;
+int pingtokens = PING_BATCH;
+enet_uint32 pingtokentime = 0;
+
+void unqueueping(gameserver &s)
+{
+    if(!s.queued) return;
+    if(s.pingprev) s.pingprev->pingnext = s.pingnext;
+    else pinghead = s.pingnext;
+    if(s.pingnext) s.pingnext->pingprev = s.pingprev;
+    else pingtail = s.pingprev;
+    s.pingprev = s.pingnext = NULL;
+    s.queued = false;
+}
+
+void queueping(gameserver &s, enet_uint32 due)    // re-pings are due later than everything queued and just get appended,
+{                                                 // new registrations are due now and go ahead of the re-pings that are not due yet
+    unqueueping(s);
+    gameserver *prev = pingtail;
+    while(prev && ENET_TIME_LESS(due, prev->pingdue)) prev = prev->pingprev;
+    s.pingdue = due;
+    s.pingprev = prev;
+    s.pingnext = prev ? prev->pingnext : pinghead;
+    if(s.pingnext) s.pingnext->pingprev = &s;
+    else pingtail = &s;
+    if(prev) prev->pingnext = &s;
+    else pinghead = &s;
+    s.queued = true;
+}
+
 struct messagebuf
 {
     vector<messagebuf *> &owner;
     vector<char> buf;
     int refs;
+    int since;          // server list changes: list version this message starts from
+    bool gz, cached;    // cached: kept, even if unreferenced
 
-    messagebuf(vector<messagebuf *> &owner) : owner(owner), refs(0) {}
+    messagebuf(vector<messagebuf *> &owner) : owner(owner), refs(0), since(-1), gz(false), cached(false) {}
 
     const char *getbuf() { return buf.getbuf(); }
     int length() { return buf.length(); }
@@ -149,6 +208,24 @@ struct messagebuf
 vector<messagebuf *> gameserverlists, gbanlists;
 bool updateserverlist = true;
 
+// clients which send "list <name> <version> <build> <gz> <since> <epoch>" get a header line "serverlist <version> <epoch> <full|changes> <gz> <length>",
+// followed by the list or by the changes since the list version they know (as addserver/delserver commands), optionally compressed;
+// list versions restart with every master instance, so changes are only sent if the client knows the current epoch;
+// all responses are generated once per list version and shared by all clients
+
+struct listchange
+{
+    int version;
+    vector<char> lines;     // changes from version-1 to version
+};
+vector<listchange *> listhistory;
+vector<char> pendinglistchanges;
+int serverlistversion = 0;
+uint serverlistepoch = 0;       // identifies this master instance
+vector<messagebuf *> fullserverlists[2], serverlistchanges;     // [gz]
+
+enum { CLIENT_READ = 0, CLIENT_WRITE, CLIENT_CLOSE };    // connection states: waiting for commands, sending output or message, purged after this loop
+
 struct client
 {
     ENetAddress address;
@@ -163,10 +240,22 @@ struct client
     vector<authreq> authreqs; // for AUTH
     bool shouldpurge;
     bool registeredserver;
+    int state, index;                   // index: position in clients
+    int events;                         // registered epoll events
+    client *wheelprev, *wheelnext;      // timer wheel slot list
+    int wheelslot;
 
-    client() : message(NULL), inputpos(0), outputpos(0), servport(-1), lastauth(0), shouldpurge(false), registeredserver(false) {}
+    client() : message(NULL), inputpos(0), outputpos(0), servport(-1), lastauth(0), shouldpurge(false), registeredserver(false),
+               state(CLIENT_READ), index(-1), events(0), wheelprev(NULL), wheelnext(NULL), wheelslot(-1) {}
 };
-vector<client *> clients;
+vector<client *> clients, closedclients;
+vector<client *> hostshards[HOST_SHARDS];   // clients by ip address, in connect order
+
+vector<client *> &hostshard(enet_uint32 host) { return hostshards[iphash(host) % HOST_SHARDS]; }
+
+#ifdef MASTER_EPOLL
+int epollfd = -1;
+#endif
 
 ENetSocket serversocket = ENET_SOCKET_NULL;
 
@@ -197,19 +286,99 @@ void conoutf(const char *fmt, ...)
     va_end(args);
 }
 
-void purgeclient(int n)
+// client timeouts: a timer wheel with one slot per second, a slot is checked when its time has come
+// (input doesn't move a client: if it isn't due yet, it is put into the slot of its new deadline)
+
+client *wheel[WHEEL_SLOTS];
+int wheelpos = 0;
+enet_uint32 wheeltime = 0;      // time, when the slot at wheelpos is checked
+
+void wheelinsert(client &c)
+{
+    enet_uint32 due = c.lastinput + (c.registeredserver ? KEEPALIVE_TIME : CLIENT_TIME);
+    int ticks = ENET_TIME_GREATER(due, wheeltime) ? (ENET_TIME_DIFFERENCE(due, wheeltime) + WHEEL_TICK - 1) / WHEEL_TICK : 0;
+    c.wheelslot = (wheelpos + min(ticks, WHEEL_SLOTS - 1)) % WHEEL_SLOTS;
+    c.wheelprev = NULL;
+    c.wheelnext = wheel[c.wheelslot];
+    if(c.wheelnext) c.wheelnext->wheelprev = &c;
+    wheel[c.wheelslot] = &c;
+}
+
+void wheelremove(client &c)
+{
+    if(c.wheelslot < 0) return;
+    if(c.wheelprev) c.wheelprev->wheelnext = c.wheelnext;
+    else wheel[c.wheelslot] = c.wheelnext;
+    if(c.wheelnext) c.wheelnext->wheelprev = c.wheelprev;
+    c.wheelslot = -1;
+}
+
+void closeclient(client &c)
+{
+    if(c.state == CLIENT_CLOSE) return;
+    c.state = CLIENT_CLOSE;
+    wheelremove(c);
+    closedclients.add(&c);
+}
+
+void checktimeouts()
+{
+    while(ENET_TIME_GREATER_EQUAL(servtime, wheeltime))
+    {
+        client *c = wheel[wheelpos];
+        wheel[wheelpos] = NULL;
+        wheelpos = (wheelpos + 1) % WHEEL_SLOTS;
+        wheeltime += WHEEL_TICK;
+        while(c)
+        {
+            client *next = c->wheelnext;
+            c->wheelslot = -1;
+            if(ENET_TIME_DIFFERENCE(servtime, c->lastinput) >= (c->registeredserver ? KEEPALIVE_TIME : CLIENT_TIME)) closeclient(*c);
+            else wheelinsert(*c);
+            c = next;
+        }
+    }
+}
+
+void purgeclosedclients()   // clients are only deleted here, so pending socket events never point to deleted clients
 {
-    client &c = *clients[n];
-    if(c.message) c.message->purge();
-    enet_socket_destroy(c.socket);
-    delete clients[n];
-    clients.remove(n);
+    loopv(closedclients)
+    {
+        client *c = closedclients[i];
+        if(c->message) c->message->purge();
+        enet_socket_destroy(c->socket);     // (also removes it from the epoll set)
+        hostshard(c->address.host).removeobj(c);
+        clients[c->index] = clients.last();
+        clients[c->index]->index = c->index;
+        clients.pop();
+        delete c;
+    }
+    closedclients.setsize(0);
+}
+
+void updateclientstate(client &c)
+{
+    if(c.state == CLIENT_CLOSE) return;
+    c.state = c.message || c.output.length() ? CLIENT_WRITE : CLIENT_READ;
+#ifdef MASTER_EPOLL
+    int events = c.state == CLIENT_WRITE ? EPOLLOUT : EPOLLIN;
+    if(events != c.events)
+    {
+        epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = &c;
+        if(epoll_ctl(epollfd, c.events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c.socket, &ev) < 0) { closeclient(c); return; }
+        c.events = events;
+    }
+#endif
 }
 
 void output(client &c, const char *msg, int len = 0)
 {
     if(!len) len = strlen(msg);
     c.output.put(msg, len);
+    if(c.output.length() > OUTPUT_LIMIT) closeclient(c);
+    else updateclientstate(c);
 }
 
 void outputf(client &c, const char *fmt, ...)
@@ -255,15 +424,58 @@ void setupserver(int port, const char *ip = NULL)
         fatal("failed to make server socket non-blocking");
     if(!setuppingsocket())
         fatal("failed to create ping socket");
+#ifdef MASTER_EPOLL
+    epollfd = epoll_create(EPOLL_EVENTS);
+    if(epollfd < 0) fatal("failed to create epoll instance");
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &serversocket;
+    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, serversocket, &ev) < 0) fatal("failed to watch server socket");
+    ev.data.ptr = &pingsocket;
+    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, pingsocket, &ev) < 0) fatal("failed to watch ping socket");
+#endif
 
     enet_time_set(0);
 
     starttime = time(NULL);
+    serverlistepoch = (uint)starttime + (uint)(size_t)&serverlistepoch;     // differs between restarts, even within the same second
     char *ct = ctime(&starttime);
     if(strchr(ct, '\n')) *strchr(ct, '\n') = '\0';
     conoutf("*** Starting master server on %s %d at %s ***", ip ? ip : "localhost", port, ct);
 }
 
+messagebuf *serverlistmessage(vector<messagebuf *> &owner, const char *kind, const vector<char> &body, bool gz)
+{
+    messagebuf *m = new messagebuf(owner);
+    defformatstring(header)("serverlist %d %u %s %d %d\n", serverlistversion, serverlistepoch, kind, gz ? 1 : 0, body.length());
+    m->buf.put(header, strlen(header));
+    if(gz)
+    {
+        uLongf len = compressBound(body.length());
+        m->buf.reserve(len);
+        if(compress2((Bytef *)m->buf.getbuf() + m->buf.length(), &len, (const Bytef *)body.getbuf(), body.length(), Z_BEST_COMPRESSION) != Z_OK) fatal("failed to compress server list");
+        m->buf.advance(len);
+    }
+    else m->buf.put(body.getbuf(), body.length());
+    m->gz = gz;
+    owner.add(m);
+    return m;
+}
+
+void removegameserver(int i)
+{
+    gameserver *s = gameservers.remove(i);
+    unqueueping(*s);
+    gameserverindex.remove(s->address);
+    if(s->listed)
+    {
+        defformatstring(cmd)("delserver %s %d\n", s->ip, s->port);
+        pendinglistchanges.put(cmd, strlen(cmd));
+    }
+    delete s;
+    updateserverlist = true;
+}
+
 void genserverlist()
 {
     if(!updateserverlist) return;
@@ -276,10 +488,51 @@ void genserverlist()
         if(!s.lastpong) continue;
         defformatstring(cmd)("addserver %s %d\n", s.ip, s.port);
         l->buf.put(cmd, strlen(cmd));
+        if(!s.listed)
+        {
+            s.listed = true;
+            pendinglistchanges.put(cmd, strlen(cmd));
+        }
     }
-    l->buf.add('\0');
     gameserverlists.add(l);
     updateserverlist = false;
+
+    serverlistversion++;
+    listchange *c = new listchange;
+    c->version = serverlistversion;
+    c->lines.put(pendinglistchanges.getbuf(), pendinglistchanges.length());
+    pendinglistchanges.setsize(0);
+    listhistory.add(c);
+    if(listhistory.length() > LIST_HISTORY) delete listhistory.remove(0);
+    loopk(2)
+    {
+        while(fullserverlists[k].length() && fullserverlists[k].last()->refs<=0)
+            delete fullserverlists[k].pop();
+        serverlistmessage(fullserverlists[k], "full", l->buf, k != 0);
+    }
+    loopvrev(serverlistchanges)     // changes are only cached for the current version
+    {
+        messagebuf *m = serverlistchanges[i];
+        m->cached = false;
+        if(m->refs<=0) delete serverlistchanges.remove(i);
+    }
+    l->buf.add('\0');
+}
+
+messagebuf *getserverlist(int since, bool gz)
+{
+    if(since <= 0 || since > serverlistversion || listhistory.empty() || since < listhistory[0]->version - 1) return fullserverlists[gz ? 1 : 0].last();
+    loopv(serverlistchanges)
+    {
+        messagebuf *m = serverlistchanges[i];
+        if(m->cached && m->since == since && m->gz == gz) return m;
+    }
+    vector<char> body;
+    loopv(listhistory) if(listhistory[i]->version > since) body.put(listhistory[i]->lines.getbuf(), listhistory[i]->lines.length());
+    messagebuf *m = serverlistmessage(serverlistchanges, "changes", body, gz);
+    m->since = since;
+    m->cached = true;
+    return m;
 }
 
 void gengbanlist()
@@ -311,27 +564,30 @@ void gengbanlist()
     loopv(clients)
     {
         client &c = *clients[i];
-        if(c.servport >= 0 && !c.message)
+        if(c.servport >= 0 && !c.message && c.state != CLIENT_CLOSE)
         {
             c.message = l;
             c.message->refs++;
+            updateclientstate(c);
         }
     }
 }
 
 void addgameserver(client &c)
 {
-    if(gameservers.length() >= SERVER_LIMIT) return;
-    loopv(gameservers)
+    ENetAddress address;
+    address.host = c.address.host;
+    address.port = c.servport+1;
+    gameserver **known = gameserverindex.access(address);
+    if(known)
     {
-        gameserver &s = *gameservers[i];
-        if(s.address.host == c.address.host && s.port == c.servport)
-        {
-            s.lastping = 0;
-            s.numpings = 0;
-            return;
-        }
+        gameserver &s = **known;
+        s.lastping = 0;
+        s.numpings = 0;
+        queueping(s, servtime);
+        return;
     }
+    if(gameservers.length() >= SERVER_LIMIT) return;
     string hostname;
     if(enet_address_get_host_ip(&c.address, hostname, sizeof(hostname)) < 0)
     {
@@ -339,20 +595,25 @@ void addgameserver(client &c)
         return;
     }
     gameserver &s = *gameservers.add(new gameserver);
-    s.address.host = c.address.host;
-    s.address.port = c.servport+1;
+    s.address = address;
     copystring(s.ip, hostname);
     s.port = c.servport;
     s.numpings = 0;
     s.lastping = s.lastpong = 0;
+    s.listed = false;
+    s.pingprev = s.pingnext = NULL;
+    s.queued = false;
+    gameserverindex[address] = &s;
+    queueping(s, servtime);
 }
 
 client *findclient(gameserver &s)
 {
-    loopv(clients)
+    vector<client *> &shard = hostshard(s.address.host);
+    loopv(shard)
     {
-        client &c = *clients[i];
-        if(s.address.host == c.address.host && s.port == c.servport)
+        client &c = *shard[i];
+        if(s.address.host == c.address.host && s.port == c.servport && c.state != CLIENT_CLOSE)
             return &c;
     }
     return NULL;
@@ -364,92 +625,173 @@ void servermessage(gameserver &s, const char *msg)
     if(c) outputf(*c, msg);
 }
 
+void serverpong(const ENetAddress &addr)
+{
+    gameserver **known = gameserverindex.access(addr);
+    if(!known) return;
+    gameserver &s = **known;
+    if(s.lastping && (!s.lastpong || ENET_TIME_GREATER(s.lastping, s.lastpong)))
+    {
+        unqueueping(s);
+        client *c = findclient(s);
+        if(c)
+        {
+            c->registeredserver = true;
+            outputf(*c, "succreg\n");
+            if(!c->message && gbanlists.length())
+            {
+                c->message = gbanlists.last();
+                c->message->refs++;
+                updateclientstate(*c);
+            }
+        }
+    }
+    if(!s.lastpong) updateserverlist = true;
+    s.lastpong = servtime ? servtime : 1;
+}
+
 void checkserverpongs()
 {
+    static uchar pongs[PING_BATCH][MAXTRANS];
+#ifdef MASTER_MMSG
+    static mmsghdr msgs[PING_BATCH];
+    static iovec iovs[PING_BATCH];
+    static sockaddr_in addrs[PING_BATCH];
+    for(;;)
+    {
+        loopi(PING_BATCH)
+        {
+            iovs[i].iov_base = pongs[i];
+            iovs[i].iov_len = sizeof(pongs[i]);
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(pingsocket, msgs, PING_BATCH, MSG_DONTWAIT, NULL);
+        if(n <= 0) break;
+        loopi(n) if(msgs[i].msg_len > 0)
+        {
+            ENetAddress addr;
+            addr.host = addrs[i].sin_addr.s_addr;
+            addr.port = ntohs(addrs[i].sin_port);
+            serverpong(addr);
+        }
+        if(n < PING_BATCH) break;
+    }
+#else
     ENetBuffer buf;
     ENetAddress addr;
-    static uchar pong[MAXTRANS];
     for(;;)
     {
-        buf.data = pong;
-        buf.dataLength = sizeof(pong);
+        buf.data = pongs[0];
+        buf.dataLength = sizeof(pongs[0]);
         int len = enet_socket_receive(pingsocket, &addr, &buf, 1);
         if(len <= 0) break;
-        loopv(gameservers)
-        {
-            gameserver &s = *gameservers[i];
-            if(s.address.host == addr.host && s.address.port == addr.port)
-            {
-                if(s.lastping && (!s.lastpong || ENET_TIME_GREATER(s.lastping, s.lastpong)))
-                {
-                    client *c = findclient(s);
-                    if(c)
-                    {
-                        c->registeredserver = true;
-                        outputf(*c, "succreg\n");
-                        if(!c->message && gbanlists.length())
-                        {
-                            c->message = gbanlists.last();
-                            c->message->refs++;
-                        }
-                    }
-                }
-                if(!s.lastpong) updateserverlist = true;
-                s.lastpong = servtime ? servtime : 1;
-                break;
-            }
-        }
+        serverpong(addr);
     }
+#endif
 }
 
-void bangameservers()
+void sendserverpings(gameserver **batch, int n)
 {
-    loopvrev(gameservers) if(checkban(servbans, gameservers[i]->address.host))
+    static const uchar ping[] = { 1 };
+#ifdef MASTER_MMSG
+    static mmsghdr msgs[PING_BATCH];
+    static iovec iov;
+    static sockaddr_in addrs[PING_BATCH];
+    iov.iov_base = (void *)ping;
+    iov.iov_len = sizeof(ping);
+    loopi(n)
     {
-        delete gameservers.remove(i);
-        updateserverlist = true;
+        memset(&addrs[i], 0, sizeof(addrs[i]));
+        addrs[i].sin_family = AF_INET;
+        addrs[i].sin_addr.s_addr = batch[i]->address.host;
+        addrs[i].sin_port = htons(batch[i]->address.port);
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
     }
+    for(int sent = 0; sent < n;)
+    {
+        int res = sendmmsg(pingsocket, &msgs[sent], n - sent, MSG_DONTWAIT);
+        if(res <= 0) break; // lost pings are retried anyway
+        sent += res;
+    }
+#else
+    ENetBuffer buf;
+    buf.data = (void *)ping;
+    buf.dataLength = sizeof(ping);
+    loopi(n) enet_socket_send(pingsocket, &batch[i]->address, &buf, 1);
+#endif
+}
+
+void bangameservers()
+{
+    loopvrev(gameservers) if(checkban(servbans, gameservers[i]->address.host)) removegameserver(i);
 }
 
+int keepalivepos = 0;
+
 void checkgameservers()
 {
-    ENetBuffer buf;
-    loopv(gameservers)
+    // keepalive: a few servers per call
+    for(int n = min(gameservers.length(), KEEPALIVE_CHECK); n > 0; n--)
     {
-        gameserver &s = *gameservers[i];
-        if(s.lastping && s.lastpong && ENET_TIME_LESS_EQUAL(s.lastping, s.lastpong))
+        if(keepalivepos >= gameservers.length()) keepalivepos = 0;
+        gameserver &s = *gameservers[keepalivepos];
+        if(s.lastping && s.lastpong && ENET_TIME_LESS_EQUAL(s.lastping, s.lastpong) && ENET_TIME_DIFFERENCE(servtime, s.lastpong) > KEEPALIVE_TIME)
+            removegameserver(keepalivepos);
+        else keepalivepos++;
+    }
+
+    // pings
+    int refill = min(ENET_TIME_DIFFERENCE(servtime, pingtokentime), (enet_uint32)1000) * PING_RATE / 1000;
+    if(refill > 0)
+    {
+        pingtokens = min(pingtokens + refill, PING_RATE / 10);
+        pingtokentime = servtime;
+    }
+    gameserver *batch[PING_BATCH];
+    int batched = 0;
+    while(pinghead && pingtokens > 0 && ENET_TIME_LESS_EQUAL(pinghead->pingdue, servtime))
+    {
+        gameserver &s = *pinghead;
+        unqueueping(s);
+        if(s.numpings >= PING_RETRY)
         {
-            if(ENET_TIME_DIFFERENCE(servtime, s.lastpong) > KEEPALIVE_TIME)
-            {
-                delete gameservers.remove(i--);
-                updateserverlist = true;
-            }
+            servermessage(s, "failreg failed pinging server\n");
+            removegameserver(gameservers.find(&s));
+            continue;
         }
-        else if(!s.lastping || ENET_TIME_DIFFERENCE(servtime, s.lastping) > PING_TIME)
+        s.numpings++;
+        s.lastping = servtime ? servtime : 1;
+        queueping(s, servtime + PING_TIME);
+        pingtokens--;
+        batch[batched++] = &s;
+        if(batched >= PING_BATCH)
         {
-            if(s.numpings >= PING_RETRY)
-            {
-                servermessage(s, "failreg failed pinging server\n");
-                delete gameservers.remove(i--);
-                updateserverlist = true;
-            }
-            else
-            {
-                static const uchar ping[] = { 1 };
-                buf.data = (void *)ping;
-                buf.dataLength = sizeof(ping);
-                s.numpings++;
-                s.lastping = servtime ? servtime : 1;
-                enet_socket_send(pingsocket, &s.address, &buf, 1);
-            }
+            sendserverpings(batch, batched);
+            batched = 0;
         }
     }
+    if(batched) sendserverpings(batch, batched);
+}
+
+int pingtimeout()     // milliseconds until checkgameservers() has pings to send
+{
+    if(!pinghead) return INT_MAX;
+    if(ENET_TIME_GREATER(pinghead->pingdue, servtime)) return ENET_TIME_DIFFERENCE(pinghead->pingdue, servtime);
+    return pingtokens > 0 ? 0 : max(1000 / PING_RATE, 1);
 }
 
 void messagebuf::purge()
 {
     refs = max(refs - 1, 0);
-    if(refs<=0 && owner.last()!=this)
+    if(refs<=0 && owner.last()!=this && !cached)
     {
         owner.removeobj(this);
         delete this;
@@ -556,12 +898,15 @@ bool checkclientinput(client &c)
         uint id; // for AUTH
         string user, val; // for AUTH
 
-        int port;
+        int port, gz, since;
+        uint epoch;
         if(!strncmp(c.input, "list", 4) && (!c.input[4] || isspace(c.input[4])))
         {
             genserverlist();
             if(gameserverlists.empty() || c.message) return false;
-            c.message = gameserverlists.last();
+            int args = sscanf(c.input, "list %*s %*d %*d %d %d %u", &gz, &since, &epoch);
+            if(args >= 2) c.message = getserverlist(args == 3 && epoch == serverlistepoch ? since : 0, gz != 0);
+            else c.message = gameserverlists.last();
             c.message->refs++;
             c.output.setsize(0);
             c.outputpos = 0;
@@ -596,10 +941,97 @@ bool checkclientinput(client &c)
     return c.inputpos<(int)sizeof(c.input);
 }
 
-ENetSocketSet readset, writeset;
+void acceptclients()
+{
+    loopi(ACCEPT_LIMIT)
+    {
+        ENetAddress address;
+        ENetSocket clientsocket = enet_socket_accept(serversocket, &address);
+        if(clientsocket==ENET_SOCKET_NULL) break;
+        if(clients.length()>=CLIENT_LIMIT || checkban(bans, address.host)) { enet_socket_destroy(clientsocket); continue; }
+
+        vector<client *> &shard = hostshard(address.host);
+        int dups = 0;
+        client *oldest = NULL;
+        loopv(shard) if(shard[i]->address.host == address.host && shard[i]->state != CLIENT_CLOSE)
+        {
+            dups++;
+            if(!oldest) oldest = shard[i];
+        }
+        if(dups >= DUP_LIMIT) closeclient(*oldest);
+
+        enet_socket_set_option(clientsocket, ENET_SOCKOPT_NONBLOCK, 1);
+        client *c = new client;
+        c->address = address;
+        c->socket = clientsocket;
+        c->connecttime = servtime;
+        c->lastinput = servtime;
+        c->index = clients.length();
+        clients.add(c);
+        shard.add(c);
+        wheelinsert(*c);
+        updateclientstate(*c);
+    }
+}
+
+void sendclient(client &c)
+{
+    const char *data = c.output.length() ? c.output.getbuf() : c.message->getbuf();
+    int len = c.output.length() ? c.output.length() : c.message->length();
+    ENetBuffer buf;
+    buf.data = (void *)&data[c.outputpos];
+    buf.dataLength = len-c.outputpos;
+    int res = enet_socket_send(c.socket, NULL, &buf, 1);
+    if(res<0) { closeclient(c); return; }
+    c.outputpos += res;
+    if(c.outputpos>=len)
+    {
+        if(c.output.length()) c.output.setsize(0);
+        else
+        {
+            c.message->purge();
+            c.message = NULL;
+        }
+        c.outputpos = 0;
+        if(!c.message && c.output.empty() && c.shouldpurge) { closeclient(c); return; }
+    }
+    updateclientstate(c);
+}
+
+void receiveclient(client &c)
+{
+    ENetBuffer buf;
+    buf.data = &c.input[c.inputpos];
+    buf.dataLength = sizeof(c.input) - c.inputpos;
+    int res = enet_socket_receive(c.socket, NULL, &buf, 1);
+    if(res<=0) { closeclient(c); return; }
+    c.inputpos += res;
+    c.input[min(c.inputpos, (int)sizeof(c.input)-1)] = '\0';
+    if(!checkclientinput(c)) { closeclient(c); return; }
+    updateclientstate(c);
+}
 
 void checkclients()
 {
+    int timeout = ENET_TIME_GREATER(wheeltime, servtime) ? min(ENET_TIME_DIFFERENCE(wheeltime, servtime), (enet_uint32)1000) : 0;
+    timeout = min(timeout, pingtimeout());
+#ifdef MASTER_EPOLL
+    static epoll_event events[EPOLL_EVENTS];
+    int n = epoll_wait(epollfd, events, EPOLL_EVENTS, timeout);
+    servtime = enet_time_get();
+    loopi(n)
+    {
+        void *ptr = events[i].data.ptr;
+        if(ptr == &pingsocket) checkserverpongs();
+        else if(ptr == &serversocket) acceptclients();
+        else
+        {
+            client &c = *(client *)ptr;
+            if(c.state == CLIENT_WRITE) sendclient(c);
+            else if(c.state == CLIENT_READ) receiveclient(c);
+        }
+    }
+#else
     ENetSocketSet readset, writeset;
     ENetSocket maxsock = max(serversocket, pingsocket);
     ENET_SOCKETSET_EMPTY(readset);
@@ -609,91 +1041,32 @@ void checkclients()
     loopv(clients)
     {
         client &c = *clients[i];
-        if(c.message || c.output.length()) ENET_SOCKETSET_ADD(writeset, c.socket);
+        if(c.state == CLIENT_WRITE) ENET_SOCKETSET_ADD(writeset, c.socket);
         else ENET_SOCKETSET_ADD(readset, c.socket);
         maxsock = max(maxsock, c.socket);
     }
-    if(enet_socketset_select(maxsock, &readset, &writeset, 1000)<=0) return;
-
-    if(ENET_SOCKETSET_CHECK(readset, pingsocket)) checkserverpongs();
-    if(ENET_SOCKETSET_CHECK(readset, serversocket))
+    int n = enet_socketset_select(maxsock, &readset, &writeset, timeout);
+    servtime = enet_time_get();
+    if(n>0)
     {
-        ENetAddress address;
-        ENetSocket clientsocket = enet_socket_accept(serversocket, &address);
-        if(clients.length()>=CLIENT_LIMIT || checkban(bans, address.host)) enet_socket_destroy(clientsocket);
-        else if(clientsocket!=ENET_SOCKET_NULL)
+        if(ENET_SOCKETSET_CHECK(readset, pingsocket)) checkserverpongs();
+        if(ENET_SOCKETSET_CHECK(readset, serversocket)) acceptclients();
+        loopv(clients)
         {
-            int dups = 0, oldest = -1;
-            loopv(clients) if(clients[i]->address.host == address.host)
-            {
-                dups++;
-                if(oldest<0 || clients[i]->connecttime < clients[oldest]->connecttime) oldest = i;
-            }
-            if(dups >= DUP_LIMIT) purgeclient(oldest);
-
-            client *c = new client;
-            c->address = address;
-            c->socket = clientsocket;
-            c->connecttime = servtime;
-            c->lastinput = servtime;
-            clients.add(c);
+            client &c = *clients[i];
+            if(c.state == CLIENT_WRITE && ENET_SOCKETSET_CHECK(writeset, c.socket)) sendclient(c);
+            else if(c.state == CLIENT_READ && ENET_SOCKETSET_CHECK(readset, c.socket)) receiveclient(c);
         }
     }
-
-    loopv(clients)
-    {
-        client &c = *clients[i];
-        if((c.message || c.output.length()) && ENET_SOCKETSET_CHECK(writeset, c.socket))
-        {
-            const char *data = c.output.length() ? c.output.getbuf() : c.message->getbuf();
-            int len = c.output.length() ? c.output.length() : c.message->length();
-            ENetBuffer buf;
-            buf.data = (void *)&data[c.outputpos];
-            buf.dataLength = len-c.outputpos;
-            int res = enet_socket_send(c.socket, NULL, &buf, 1);
-            if(res>=0)
-            {
-                c.outputpos += res;
-                if(c.outputpos>=len)
-                {
-                    if(c.output.length()) c.output.setsize(0);
-                    else
-                    {
-                        c.message->purge();
-                        c.message = NULL;
-                    }
-                    c.outputpos = 0;
-                    if(!c.message && c.output.empty() && c.shouldpurge)
-                    {
-                        purgeclient(i--);
-                        continue;
-                    }
-                }
-            }
-            else { purgeclient(i--); continue; }
-        }
-        if(ENET_SOCKETSET_CHECK(readset, c.socket))
-        {
-            ENetBuffer buf;
-            buf.data = &c.input[c.inputpos];
-            buf.dataLength = sizeof(c.input) - c.inputpos;
-            int res = enet_socket_receive(c.socket, NULL, &buf, 1);
-            if(res>0)
-            {
-                c.inputpos += res;
-                c.input[min(c.inputpos, (int)sizeof(c.input)-1)] = '\0';
-                if(!checkclientinput(c)) { purgeclient(i--); continue; }
-            }
-            else { purgeclient(i--); continue; }
-        }
-        if(c.output.length() > OUTPUT_LIMIT) { purgeclient(i--); continue; }
-        if(ENET_TIME_DIFFERENCE(servtime, c.lastinput) >= (c.registeredserver ? KEEPALIVE_TIME : CLIENT_TIME)) { purgeclient(i--); continue; }
-    }
+#endif
+    checktimeouts();
+    purgeclosedclients();
 }
 
 void banclients()
 {
-    loopvrev(clients) if(checkban(bans, clients[i]->address.host)) purgeclient(i);
+    loopv(clients) if(checkban(bans, clients[i]->address.host)) closeclient(*clients[i]);
+    purgeclosedclients();
 }
 
 volatile bool reloadcfg = true;
@@ -424,6 +424,7 @@ static const int msgsizes[] =               // size inclusive message token, 0 f
     SV_CLIENT, 0,
     SV_EXTENSION, 0,
     SV_MAPIDENT, 3, SV_HUDEXTRAS, 2, SV_POINTS, 0,
+    SV_NEXTMAP, 0,
     -1
 };
 
@@ -5,7 +5,7 @@
 #define CUBE_SERVINFO_PORT_LAN 28762
 #define CUBE_SERVINFO_PORT(serverport) (serverport+1)
 #define CUBE_SERVINFO_TO_SERV_PORT(servinfoport) (servinfoport-1)
-#define PROTOCOL_VERSION 1201           // bump when protocol changes (use negative numbers for mods!)
+#define PROTOCOL_VERSION 1202           // bump when protocol changes (use negative numbers for mods!)
 #define DEMO_VERSION 2                  // bump when demo format changes
 #define DEMO_MAGIC "ASSAULTCUBE_DEMO"
 #define DEMO_MINTIME 10000              // don't keep demo recordings with less than 10 seconds
@@ -15,6 +15,8 @@
 #define MAXMEDIADOWNLOADFILESIZE 1024000 // hard cap on filesizes (raw and unzipped) - to limit the effect of zip bombs - no nice error messages: just cap
 #define MAXMODDOWNLOADSIZE 1024000      // hard cap on the filesize of downloaded mod packages - to keep stuff reasonable
 #define MAXFILESINADZIP 21              // max number of files extracted from a zip by autodownload
+#define CONNECTCOOKIE_MAGIC 0xAC0C00C1  // connect challenge datagram (server to client): magic + cookie (both 32 bit, network byte order)
+#define CONNECTCOOKIE_LEN 8             // the client repeats the cookie in the data field of its enet connect request
 
 extern bool modprotocol;
 #define CUR_PROTOCOL_VERSION (modprotocol ? -PROTOCOL_VERSION : PROTOCOL_VERSION)
@@ -45,15 +47,16 @@ enum
     SV_CLIENT,
     SV_EXTENSION,
     SV_MAPIDENT, SV_HUDEXTRAS, SV_POINTS,
+    SV_NEXTMAP,
     SV_NUM
 };
 
+// converts message code to char
+extern const char *messagenames[SV_NUM];
+
 #ifdef _DEBUG
 
 extern void protocoldebug(bool enable);
-
-// converts message code to char
-extern const char *messagenames[SV_NUM];
 #endif
 
 enum { SA_KICK = 0, SA_BAN, SA_REMBANS, SA_MASTERMODE, SA_AUTOTEAM, SA_FORCETEAM, SA_GIVEADMIN, SA_MAP, SA_RECORDDEMO, SA_STOPDEMO, SA_CLEARDEMOS, SA_SERVERDESC, SA_SHUFFLETEAMS, SA_NUM};
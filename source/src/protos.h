@@ -269,7 +269,10 @@ struct gmenu
 struct mline { string name, cmd; };
 
 // serverbrowser
+#define RESOLVERLIMIT 3000
 extern void addserver(const char *servername, int serverport, int weight);
+extern void resolverquery(const char *name, bool notify = true);
+extern int resolvercached(const char *name, ENetAddress *address);
 extern bool resolverwait(const char *name, ENetAddress *address);
 extern int connectwithtimeout(ENetSocket sock, const char *hostname, ENetAddress &remoteaddress);
 extern void writeservercfg();
@@ -330,11 +333,12 @@ struct httpget
     // internal
     ENetSocket tcp;
     stopwatch tcp_age;
-    vector<char> rawsnd, rawrec, datarec;
+    vector<char> rawsnd, rawrec, datarec, surplus;     // surplus: received data for the next pipelined request
+    vector<char *> pipelined;                          // urls of requests sent ahead
 
     // result
     char *header;
-    int response, chunked, gzipped, contentlength, offset, traffic;
+    int response, chunked, gzipped, contentlength, offset, resumefrom, traffic;  // resumefrom: partial content was delivered, continue with range request
     uint elapsedtime;
     vector<uchar> *outvec;                             // receives data, if not NULL (must be set up manually)
     stream *outstream;                                 // receives data, if not NULL (must be set up manually)
@@ -347,6 +351,8 @@ struct httpget
     bool execcallback(float progress);
     void disconnect();
     bool connect(bool force = false);
+    void request(const char *url1, int range = 0, bool head = false);
+    bool pipeline(const char *url1);                   // send GET request ahead (on the same connection)
     int get(const char *url1, uint timeout, uint totaltimeout, int range = 0, bool head = false); // get web ressource
 };
 
@@ -430,6 +436,7 @@ extern SDL_Surface *forcergbsurface(SDL_Surface *os);
 extern SDL_Surface *forcergbasurface(SDL_Surface *os);
 extern Texture *textureload(const char *name, int clamp = 0, bool mipmap = true, bool canreduce = false, float scale = 1.0f, bool trydl = false);
 extern Texture *lookuptexture(int tex, Texture *failtex = notexture, bool trydl = false);
+extern void loadworldtextures(const char *texuse, bool trydl);
 extern const char *gettextureslot(int i);
 extern bool reloadtexture(Texture &t);
 extern void reloadtextures();
@@ -485,6 +492,8 @@ extern void setupautodownload();
 extern void pollautodownloadresponse();
 extern bool requirepackage(int type, const char *name, const char *host = NULL);
 extern int downloadpackages(bool loadscr = true);
+extern bool prefetchpackage(int type, const char *name);
+extern void pollprefetchpackage();
 extern void sortpckservers();
 extern void writepcksourcecfg();
 
@@ -621,7 +630,7 @@ extern void consolescores();
 extern void calcteamscores(int scores[4]);
 
 // world
-extern void setupworld(int factor);
+extern void setupworld(int factor, sqr *prepared = NULL);
 extern void sqrdefault(sqr *s);
 extern bool worldbordercheck(int x1, int x2, int y1, int y2, int z1, int z2);
 extern bool empty_world(int factor, bool force);
@@ -849,6 +858,8 @@ extern const char *setnames(const char *name);
 extern void save_world(char *mname, bool skipoptimise = false, bool addcomfort = false);
 extern int _ignoreillegalpaths;
 extern int load_world(char *mname);
+extern void prefetchmap(const char *name, int mode, int cgzsize, int revision);
+extern void pollmapprefetch();
 extern char *getfiledesc(const char *dir, const char *name, const char *ext);
 extern void writemap(char *name, int size, uchar *data);
 extern void writecfggz(char *name, int size, int sizegz, uchar *data);
@@ -960,6 +971,11 @@ extern void tigerhash(uchar *hash, const uchar *msg, int len);
 extern void *tigerhash_init(uchar *hash);
 extern void tigerhash_add(uchar *hash, const void *msg, int len, void *state);
 extern void tigerhash_finish(uchar *hash, void *state);
+extern void tigerhash_multi(uchar **hashes, const uchar **msgs, const int *lens, int n);
+extern const char *bin2hex(char *d, const uchar *s, int len);
+extern int hex2bin(uchar *d, const char *s, int maxlen);
+extern uchar *ed25519_sign_check(uchar *sm, int smlen, const uchar *pk);
+extern int ed25519_sign_check_batch(uchar **sm, const int *smlen, const uchar **pk, int n, bool *valid = NULL);
 extern void loadcertdir();     // load all certs in "config/certs"
 #if 0
 // crypto // for AUTH
@@ -1068,11 +1084,12 @@ extern ENetSocket connectmaster();
 extern void serverms(int mode, int numplayers, int minremain, char *smapname, int millis, const ENetAddress &localaddr, int *mnum, int *msend, int *mrec, int *cnum, int *csend, int *crec, int protocol_version);
 extern int msgsizelookup(int msg);
 extern const char *genpwdhash(const char *name, const char *pwd, int salt);
+extern int findpwdhash(const char *name, const char **pwds, int numpwds, int salt, const char *pwdhash);
 extern void servermsinit(const char *master, const char *ip, int serverport, bool listen);
 extern bool serverpickup(int i, int sender);
 extern bool valid_client(int cn);
 extern void extinfo_cnbuf(ucharbuf &p, int cn);
-extern void extinfo_statsbuf(ucharbuf &p, int pid, int bpos, ENetSocket &pongsock, ENetAddress &addr, ENetBuffer &buf, int len, int *csend);
+extern int extinfo_statsbuf(ucharbuf &p, int pid, int bpos, ENetSocket &pongsock, ENetAddress &addr, ENetBuffer &buf, int len, int *csend);
 extern void extinfo_teamscorebuf(ucharbuf &p);
 extern char *votestring(int type, char *arg1, char *arg2, char *arg3);
 extern int wizardmain(int argc, char **argv);
@@ -1080,7 +1097,8 @@ extern int wizardmain(int argc, char **argv);
 // some tools
 extern servsqr *createservworld(const sqr *s, int _cubicsize);
 extern int calcmapdims(mapdim_s &md, const servsqr *s, int _ssize);
-extern int calcmapareastats(mapareastats_s &ms, servsqr *s, int _ssize, const mapdim_s &md);
+extern int calcmapareastats(mapareastats_s &ms, servsqr *s, int _ssize, const mapdim_s &md, int threads = 0);
+extern int calcmapareastats_old(mapareastats_s &ms, servsqr *s, int _ssize, const mapdim_s &md);
 extern void calcentitystats(entitystats_s &es, const persistent_entity *pents, int pentsize);
 
 // demo
@@ -1126,18 +1144,18 @@ struct serverconfigfile
 // server commandline parsing
 struct servercommandline
 {
-    int uprate, serverport, syslogfacility, filethres, syslogthres, maxdemos, maxclients, kickthreshold, banthreshold, verbose, incoming_limit, afk_limit, ban_time, demotimelocal;
-    const char *ip, *master, *logident, *serverpassword, *adminpasswd, *demopath, *maprot, *pwdfile, *blfile, *nbfile, *infopath, *motdpath, *forbidden, *demofilenameformat, *demotimestampformat;
+    int uprate, serverport, syslogfacility, filethres, syslogthres, maxdemos, maxclients, kickthreshold, banthreshold, verbose, incoming_limit, afk_limit, ban_time, demotimelocal, mapmemlimit, connectcookies, seed, cpukick, demothreads;
+    const char *ip, *master, *logident, *serverpassword, *adminpasswd, *demopath, *maprot, *pwdfile, *blfile, *nbfile, *infopath, *motdpath, *forbidden, *demofilenameformat, *demotimestampformat, *capture, *replay;
     bool logtimestamp, demo_interm, loggamestatus;
     string motd, servdesc_full, servdesc_pre, servdesc_suf, voteperm, mapperm;
     int clfilenesting;
     vector<const char *> adminonlymaps;
 
     servercommandline() :   uprate(0), serverport(CUBE_DEFAULT_SERVER_PORT), syslogfacility(6), filethres(-1), syslogthres(-1), maxdemos(5),
-                            maxclients(DEFAULTCLIENTS), kickthreshold(-5), banthreshold(-6), verbose(0), incoming_limit(10), afk_limit(45000), ban_time(20*60*1000), demotimelocal(0),
+                            maxclients(DEFAULTCLIENTS), kickthreshold(-5), banthreshold(-6), verbose(0), incoming_limit(10), afk_limit(45000), ban_time(20*60*1000), demotimelocal(0), mapmemlimit(0), connectcookies(1), seed(0), cpukick(0), demothreads(1),
                             ip(""), master(NULL), logident(""), serverpassword(""), adminpasswd(""), demopath(""),
                             maprot("config/maprot.cfg"), pwdfile("config/serverpwd.cfg"), blfile("config/serverblacklist.cfg"), nbfile("config/nicknameblacklist.cfg"),
-                            infopath("config/serverinfo"), motdpath("config/motd"), forbidden("config/forbidden.cfg"),
+                            infopath("config/serverinfo"), motdpath("config/motd"), forbidden("config/forbidden.cfg"), capture(NULL), replay(NULL),
                             logtimestamp(false), demo_interm(false), loggamestatus(true),
                             clfilenesting(0)
     {
@@ -1169,6 +1187,38 @@ struct servercommandline
                         int ai = atoi(arg+16);
                         demotimelocal = ai == 0 ? 0 : 1;
                     }
+                    else if(!strncmp(arg, "--mapmemlimit=", 14))
+                    {
+                        int ai = atoi(arg+14);
+                        mapmemlimit = max(ai, 0);
+                    }
+                    else if(!strncmp(arg, "--connectcookies=", 17))
+                    {
+                        int ai = atoi(arg+17);
+                        connectcookies = clamp(ai, 0, 2);
+                    }
+                    else if(!strncmp(arg, "--cpukick=", 10))
+                    {
+                        int ai = atoi(arg+10);
+                        cpukick = max(ai, 0);
+                    }
+                    else if(!strncmp(arg, "--demothreads=", 14))
+                    {
+                        int ai = atoi(arg+14);
+                        demothreads = clamp(ai, 0, 16);
+                    }
+                    else if(!strncmp(arg, "--capture=", 10))
+                    {
+                        capture = arg+10;
+                    }
+                    else if(!strncmp(arg, "--replay=", 9))
+                    {
+                        replay = arg+9;
+                    }
+                    else if(!strncmp(arg, "--seed=", 7))
+                    {
+                        seed = atoi(arg+7);
+                    }
                     else if(!strncmp(arg, "--masterport=", 13))
                     {
                         int ai = atoi(arg+13);
@@ -35,6 +35,8 @@ ENetHost *serverhost = NULL;
 int laststatus = 0, servmillis = 0, lastfillup = 0;
 
 vector<client *> clients;
+clienthotstate clienthot;
+clientaddressindex clientaddresses;
 vector<worldstate *> worldstates;
 vector<savedscore> savedscores;
 vector<ban> bans;
@@ -69,9 +71,188 @@ int totalclients = 0;
 int cn2boot;
 int servertime = 0, serverlagged = 0;
 
+// servermap store: with a memory budget (--mapmemlimit), the heavy buffers of rarely played maps are moved to a swap file
+// evicted maps are read back synchronously on the main thread, either on access or when they enter the prefetch window;
+// a reload is one blocking read of the compressed buffers (typically well below 1 MB) and stalls the tick for that long
+
+#define SERVERMAPPREFETCHINTERVAL 1000
+
+struct servermapstorestats { int hits, misses, prefetches, evictions, failures; } smstorestats = { 0, 0, 0, 0, 0 };
+static stream *servermapswap = NULL;
+string servermapvotename = "";             // map of the last map vote (belongs to the prefetch window)
+
+servermap *findservermap(const char *mapname)
+{
+    const char *name = behindpath(mapname);
+    loopv(servermaps) if(!strcmp(servermaps[i]->fname, name)) return servermaps[i];
+    return NULL;
+}
+
+bool servermapinwindow(servermap *sm)  // current, queued, voted and next maprot map: don't evict
+{
+    configset *c = maprot.get(maprot.peeknext());
+    const char *window[] = { smapname, nextmapname, servermapvotename, c ? c->mapname : "" };
+    loopi(sizeof(window) / sizeof(window[0])) if(!strcmp(sm->fname, behindpath(window[i]))) return true;
+    return false;
+}
+
+servermap *getservermap(const char *mapname, bool prefetch = false)  // access a servermap, fetch its buffers back from the swap file if necessary
+{
+    servermap *sm = findservermap(mapname);
+    if(!sm) return NULL;
+    if(!prefetch)
+    {
+        sm->lastused = servmillis;
+        if(sm->evicted) smstorestats.misses++;
+        else smstorestats.hits++;
+    }
+    if(sm->evicted)
+    {
+        if(!sm->reload(servermapswap))
+        {
+            smstorestats.failures++;
+            logline(ACLOG_WARNING, "failed to reload servermap %s%s from swap file", sm->fpath, sm->fname);
+            return NULL;
+        }
+        if(prefetch) smstorestats.prefetches++;
+    }
+    return sm;
+}
+
+int64_t servermapsmemusage(int *evicted = NULL)
+{
+    int64_t used = 0;
+    if(evicted) *evicted = 0;
+    loopv(servermaps)
+    {
+        used += servermaps[i]->getmemusage();
+        if(evicted && servermaps[i]->evicted) (*evicted)++;
+    }
+    return used;
+}
+
+void enforceservermapbudget()  // evict least recently used maps, until the memory budget is met
+{
+    if(!scl.mapmemlimit) return;
+    int64_t limit = int64_t(scl.mapmemlimit) << 20, used = servermapsmemusage();
+    while(used > limit)
+    {
+        servermap *lru = NULL;
+        loopv(servermaps)
+        {
+            servermap *sm = servermaps[i];
+            if(!sm->evicted && (!lru || sm->lastused < lru->lastused) && !servermapinwindow(sm)) lru = sm;
+        }
+        if(!lru) break;  // everything left is in use
+        if(!servermapswap && !(servermapswap = opentempfile("servermapswap", "w+b")))
+        {
+            logline(ACLOG_ERROR, "failed to create servermap swap file: memory limit disabled");
+            scl.mapmemlimit = 0;
+            return;
+        }
+        int heavy = lru->getheavymemusage();
+        if(!lru->evict(servermapswap))
+        {
+            smstorestats.failures++;
+            logline(ACLOG_WARNING, "failed to evict servermap %s%s to swap file", lru->fpath, lru->fname);
+            break;
+        }
+        used -= heavy;
+        smstorestats.evictions++;
+    }
+}
+
+void prefetchservermap(const char *mapname)  // map is in the vote/rotation window: reload it now, so that the map change doesn't have to
+{
+    if(scl.mapmemlimit && mapname && *mapname) getservermap(mapname, true);
+}
+
+void poll_servermapstore()    // once per second: reload evicted maps of the prefetch window (on the main thread) and re-check the budget
+{
+    static int lastprefetch = 0;
+    if(!scl.mapmemlimit || servmillis - lastprefetch < SERVERMAPPREFETCHINTERVAL) return;
+    lastprefetch = servmillis;
+    configset *c = maprot.get(maprot.peeknext());
+    prefetchservermap(smapname);
+    prefetchservermap(nextmapname);
+    prefetchservermap(servermapvotename);
+    if(c) prefetchservermap(c->mapname);
+    enforceservermapbudget();
+}
+
+void logservermapstore()
+{
+    if(!scl.mapmemlimit) return;
+    int evicted, accesses = smstorestats.hits + smstorestats.misses;
+    int64_t used = servermapsmemusage(&evicted);
+    logline(ACLOG_INFO, "Servermaps: %d maps, %d evicted, %d KB in memory (limit %d MB); %d hits, %d misses (%.1f%% hit rate), %d prefetches, %d evictions, %d failures",
+                        servermaps.length(), evicted, int(used >> 10), scl.mapmemlimit, smstorestats.hits, smstorestats.misses,
+                        accesses ? 100.0f * smstorestats.hits / accesses : 100.0f, smstorestats.prefetches, smstorestats.evictions, smstorestats.failures);
+}
+
+// advertising the next map: clients can fetch (and prepare) it while the current game is still running
+
+string nextmapadvertised = "";
+int nextmapadvertisedmode = -1, nextmapserial = 0;
+
+servermap *nextmapdistributable(const char *mapname)  // custom maps, that clients may request from the server
+{
+    servermap *sm = findservermap(mapname);
+    return sm && sm->isok && distributablemap(findmappath(mapname)) ? sm : NULL;
+}
+
+void putnextmap(packetbuf &p)
+{
+    servermap *sm = nextmapdistributable(nextmapadvertised);
+    putint(p, SV_NEXTMAP);
+    sendstring(nextmapadvertised, p);
+    putint(p, nextmapadvertisedmode);
+    putint(p, sm ? sm->cgzlen : 0);
+    putint(p, sm ? sm->maprevision : 0);
+}
+
+void advertisenextmap(bool force = false)  // next map: voted map or next entry of the maprot
+{
+    const char *name = nextmapname;
+    int mode = nextgamemode;
+    if(!*name)
+    {
+        configset *c = isdedicated ? maprot.get(maprot.peeknext()) : NULL;
+        if(!c) return;
+        name = c->mapname;
+        mode = c->mode;
+    }
+    bool changed = strcmp(name, nextmapadvertised) != 0;
+    if(!changed && mode == nextmapadvertisedmode && !force) return;
+    if(changed) nextmapserial++;
+    copystring(nextmapadvertised, name);
+    nextmapadvertisedmode = mode;
+    if(!smapname[0] || m_demo || !numclients()) return;
+    packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+    putnextmap(p);
+    sendpacket(-1, 1, p.finalize());
+}
+
+void sendnextmap(client *cl)  // client asked for the advertised next map: send it once (on the file channel)
+{
+    servermap *sm = cl->nextmapsent != nextmapserial ? nextmapdistributable(nextmapadvertised) : NULL;
+    if(!sm || !(sm = getservermap(sm->fname)) || !sm->cgzraw) return;
+    cl->nextmapsent = nextmapserial;
+    packetbuf p(MAXTRANS + sm->cgzlen + sm->cfggzlen, ENET_PACKET_FLAG_RELIABLE);
+    putint(p, SV_RECVMAP);
+    sendstring(sm->fname, p);
+    putint(p, sm->cgzlen);
+    putint(p, sm->cfglen);
+    putint(p, sm->cfggzlen);
+    putint(p, sm->maprevision);
+    p.put(sm->cgzraw, sm->cgzlen);
+    if(sm->cfggzlen) p.put(sm->cfgrawgz, sm->cfggzlen);
+    sendpacket(cl->clientnum, 2, p.finalize());
+}
+
 // synchronising the worker threads...
 
-void poll_serverthreads()       // called once per mainloop-timeslice
+bool poll_serverthreads()       // called once per mainloop-timeslice, returns true while the worker threads are idle
 {
     static vector<servermap *> servermapstodelete;
     static int stage = 0, lastworkerthreadstart = 0;
@@ -110,6 +291,7 @@ void poll_serverthreads()       // called once per mainloop-timeslice
                     {
                         servermaps.add(fresh);
                         logline(ACLOG_INFO,"added servermap %s%s", fresh->fpath, fresh->fname);
+                        enforceservermapbudget();
                     }
                     servermapdropbox = NULL;
                 }
@@ -148,9 +330,10 @@ void poll_serverthreads()       // called once per mainloop-timeslice
             {   // empty server and nothing to do:
                 loopvrev(servermapstodelete) delete servermapstodelete.remove(i);    // delete outdated servermaps
             }
-            break;
+            return true;
         }
     }
+    return false;
 }
 
 
@@ -160,6 +343,35 @@ bool valid_client(int cn)
     return clients.inrange(cn) && clients[cn]->type != ST_EMPTY;
 }
 
+// worldstate buffers are recycled: once enet has released all packets of a worldstate, it goes back to the pool
+// with its buffer capacity intact, so a running server builds its worldstates without allocating memory
+
+#define MAXPOOLEDWORLDSTATES 16
+
+static vector<worldstate *> pooledworldstates;
+static int worldstateallocs = 0, worldstategrowths = 0, worldstatesbuilt = 0;
+
+static worldstate *newworldstate()
+{
+    if(pooledworldstates.length()) return pooledworldstates.pop();
+    worldstateallocs++;
+    return new worldstate;
+}
+
+static void freeworldstate(worldstate *ws)
+{
+    if(pooledworldstates.length() >= MAXPOOLEDWORLDSTATES) { delete ws; return; }
+    ws->positions.setsize(0);
+    ws->messages.setsize(0);
+    pooledworldstates.add(ws);
+}
+
+void logworldstatepool()
+{
+    if(worldstatesbuilt) logline(ACLOG_VERBOSE, "Worldstates: %d built, %d allocated, %d buffer reallocations, %d pooled", worldstatesbuilt, worldstateallocs, worldstategrowths, pooledworldstates.length());
+    worldstatesbuilt = worldstateallocs = worldstategrowths = 0;
+}
+
 void cleanworldstate(ENetPacket *packet)
 {
    loopv(worldstates)
@@ -169,13 +381,16 @@ void cleanworldstate(ENetPacket *packet)
        else continue;
        if(!ws->uses)
        {
-           delete ws;
+           freeworldstate(ws);
            worldstates.remove(i);
        }
        break;
    }
 }
 
+static bool replaying = false;           // running a --replay: no network, outgoing packets are only counted
+static long long replaybytesout = 0;
+
 void sendpacket(int n, int chan, ENetPacket *packet, int exclude, bool demopacket)
 {
     if(n<0)
@@ -188,7 +403,8 @@ void sendpacket(int n, int chan, ENetPacket *packet, int exclude, bool demopacke
     {
         case ST_TCPIP:
         {
-            enet_peer_send(clients[n]->peer, chan, packet);
+            if(replaying) replaybytesout += packet->dataLength;
+            else enet_peer_send(clients[n]->peer, chan, packet);
             break;
         }
 
@@ -203,7 +419,9 @@ static bool reliablemessages = false;
 bool buildworldstate()
 {
     static struct { int posoff, poslen, msgoff, msglen; } pkt[MAXCLIENTS];
-    worldstate &ws = *new worldstate;
+    worldstate &ws = *newworldstate();
+    int poscap = ws.positions.capacity(), msgcap = ws.messages.capacity();
+    worldstatesbuilt++;
     loopv(clients)
     {
         client &c = *clients[i];
@@ -244,6 +462,8 @@ bool buildworldstate()
         p.put(ws.messages.getbuf(), msize);
         ws.messages.addbuf(p);
     }
+    if(ws.positions.capacity() > poscap) worldstategrowths++;
+    if(ws.messages.capacity() > msgcap) worldstategrowths++;
     ws.uses = 0;
     loopv(clients)
     {
@@ -273,7 +493,7 @@ bool buildworldstate()
     reliablemessages = false;
     if(!ws.uses)
     {
-        delete &ws;
+        freeworldstate(&ws);
         return false;
     }
     else
@@ -285,9 +505,8 @@ bool buildworldstate()
 
 int countclients(int type, bool exclude = false)
 {
-    int num = 0;
-    loopv(clients) if((clients[i]->type!=type)==exclude) num++;
-    return num;
+    int num = type == ST_EMPTY ? clients.length() - clienthot.numtype[ST_LOCAL] - clienthot.numtype[ST_TCPIP] : clienthot.numtype[type];
+    return exclude ? clients.length() - num : num;
 }
 
 int numclients() { return countclients(ST_EMPTY, true); }
@@ -296,23 +515,19 @@ int numnonlocalclients() { return countclients(ST_TCPIP); }
 
 int numauthedclients()
 {
-    int num = 0;
-    loopv(clients) if(clients[i]->type!=ST_EMPTY && clients[i]->isauthed) num++;
-    return num;
+    return clienthot.numauthed;
 }
 
 int numactiveclients()
 {
-    int num = 0;
-    loopv(clients) if(clients[i]->type!=ST_EMPTY && clients[i]->isauthed && clients[i]->isonrightmap && team_isactive(clients[i]->team)) num++;
-    return num;
+    return clienthot.numteam[TEAM_CLA] + clienthot.numteam[TEAM_RVSF];
 }
 
 int *numteamclients(int exclude = -1)
 {
     static int num[TEAM_NUM];
-    loopi(TEAM_NUM) num[i] = 0;
-    loopv(clients) if(i != exclude && clients[i]->type!=ST_EMPTY && clients[i]->isauthed && clients[i]->isonrightmap && team_isvalid(clients[i]->team)) num[clients[i]->team]++;
+    loopi(TEAM_NUM) num[i] = clienthot.numteam[i];
+    if(clients.inrange(exclude) && clienthot.inteam(exclude)) num[clienthot.team[exclude]]--;
     return num;
 }
 
@@ -364,7 +579,7 @@ void changemastermode(int newmode)
 
 int findcnbyaddress(ENetAddress *address)
 {
-    loopv(clients)
+    for(int i = clientaddresses.first(address->host); i >= 0; i = clientaddresses.next[i])
     {
         if(clients[i]->type == ST_TCPIP && clients[i]->peer->address.host == address->host && clients[i]->peer->address.port == address->port)
             return i;
@@ -372,13 +587,56 @@ int findcnbyaddress(ENetAddress *address)
     return -1;
 }
 
+// saved scores are hashed by name only, because the ip mask depends on the mastermode
+
+#define SAVEDSCOREHASH 256
+#define MAXSAVEDSCORES 1024     // long sessions in private mode keep all scores: drop the oldest ones
+
+struct savedscoreindex
+{
+    int head[SAVEDSCOREHASH];
+
+    savedscoreindex() { clear(); }
+
+    void clear() { loopi(SAVEDSCOREHASH) head[i] = -1; }
+
+    int &bucket(const char *name) { return head[hthash(name) % SAVEDSCOREHASH]; }
+
+    void add(int i)
+    {
+        int &h = bucket(savedscores[i].name);
+        savedscores[i].next = h;
+        h = i;
+    }
+
+    void rebuild()
+    {
+        clear();
+        loopv(savedscores) add(i);
+    }
+} savedscoreindex;
+
+void clearsavedscores()
+{
+    savedscores.shrink(0);
+    savedscoreindex.clear();
+}
+
+void dropoldestsavedscore()
+{
+    int drop = 0;
+    loopv(savedscores) if(!savedscores[i].valid) { drop = i; break; }    // scores of an earlier game first
+    savedscores.remove(drop);
+    savedscoreindex.rebuild();
+}
+
 savedscore *findscore(client &c, bool insert)
 {
     if(c.type!=ST_TCPIP) return NULL;
     enet_uint32 mask = ENET_HOST_TO_NET_32(mastermode == MM_MATCH ? 0xFFFF0000 : 0xFFFFFFFF); // in match mode, reconnecting from /16 subnet is allowed
     if(!insert)
     {
-        loopv(clients)
+        for(int i = clientaddresses.first(c.peer->address.host); i >= 0; i = clientaddresses.next[i])
         {
             client &o = *clients[i];
             if(o.type!=ST_TCPIP || !o.isauthed) continue;
@@ -390,15 +648,19 @@ savedscore *findscore(client &c, bool insert)
             }
         }
     }
-    loopv(savedscores)
+    int found = -1;     // the oldest match wins
+    for(int i = savedscoreindex.bucket(c.name); i >= 0; i = savedscores[i].next)
     {
         savedscore &sc = savedscores[i];
-        if(!strcmp(sc.name, c.name) && (sc.ip & mask) == (c.peer->address.host & mask)) return &sc;
+        if(!strcmp(sc.name, c.name) && (sc.ip & mask) == (c.peer->address.host & mask)) found = i;
     }
+    if(found >= 0) return &savedscores[found];
     if(!insert) return NULL;
+    if(savedscores.length() >= MAXSAVEDSCORES) dropoldestsavedscore();
     savedscore &sc = savedscores.add();
     copystring(sc.name, c.name);
     sc.ip = c.peer->address.host;
+    savedscoreindex.add(savedscores.length() - 1);
     return &sc;
 }
 
@@ -719,7 +981,7 @@ void setupdemorecord()
     demotmp = opentempfile(demotmppath, "w+b");
     if(!demotmp) return;
 
-    stream *f = opengzfile(NULL, "wb", demotmp);
+    stream *f = opengzfile(NULL, "wb", demotmp, Z_BEST_COMPRESSION, scl.demothreads);
     if(!f)
     {
         delete demotmp;
@@ -1305,11 +1567,7 @@ void arenacheck()
         arenaroundstartmillis = gamemillis;
         distributespawns();
         checkitemspawns(60*1000); // the server will respawn all items now
-        loopv(clients) if(clients[i]->type!=ST_EMPTY && clients[i]->isauthed)
-        {
-            if(clients[i]->isonrightmap && team_isactive(clients[i]->team))
-                sendspawn(clients[i]);
-        }
+        loopv(clients) if(clienthot.active(i)) sendspawn(clients[i]);
         items_blocked = false;
         return;
     }
@@ -1677,7 +1935,7 @@ void autospawncheck()
 {
     if(mastermode != MM_MATCH || !m_autospawn || interm) return;
 
-    loopv(clients) if(clients[i]->type!=ST_EMPTY && clients[i]->isauthed && team_isactive(clients[i]->team))
+    loopv(clients) if(clienthot.authed(i) && team_isactive(clienthot.team[i]))
     {
         client *cl = clients[i];
         if((cl->state.state == CS_DEAD || cl->state.state == CS_SPECTATE)
@@ -1748,6 +2006,7 @@ bool updateclientteam(int cln, int newteam, int ftr)
         cl.state.lastdeath = gamemillis;
     }
     cl.team = newteam;
+    cl.updatehot();
     return true;
 }
 
@@ -2015,7 +2274,7 @@ void resetserver(const char *newname, int newmode, int newtime)
     {
         loopv(savedscores) savedscores[i].valid = false;
     }
-    else savedscores.shrink(0);
+    else clearsavedscores();
     ctfreset();
 
     nextmapname[0] = '\0';
@@ -2055,6 +2314,7 @@ void startgame(const char *newname, int newmode, int newtime, bool notify)
         mapstats *ms = getservermapstats(smapname, isdedicated, &maploc);
         mapbuffer.clear();
         if(isdedicated && distributablemap(maploc)) mapbuffer.load();
+        if(isdedicated) getservermap(smapname);
         if(ms)
         {
             smapstats = *ms;
@@ -2658,12 +2918,14 @@ void welcomepacket(packetbuf &p, int n)
             //putint(p, minremain*60);
         }
         send_item_list(p); // this includes the flags
+        if(nextmapadvertised[0]) putnextmap(p);
     }
     savedscore *sc = NULL;
     if(c)
     {
         if(c->type == ST_TCPIP && serveroperator() != -1) sendserveropinfo(n);
         c->team = mastermode == MM_MATCH && sc ? team_tospec(sc->team) : TEAM_SPECT;
+        c->updatehot();
         putint(p, SV_SETTEAM);
         putint(p, n);
         putint(p, c->team | (FTR_INFO << 4));
@@ -2749,6 +3011,8 @@ int checktype(int type, client *cl)
     return type;
 }
 
+msgprofile processprofile;    // all clients, only measured during replays
+
 // server side processing of updates: does very little and most state is tracked client only
 // could be extended to move more gameplay to server (at expense of lag)
 
@@ -2757,6 +3021,7 @@ void process(ENetPacket *packet, int sender, int chan)
     ucharbuf p(packet->data, packet->dataLength);
     char text[MAXTRANS];
     client *cl = sender>=0 ? clients[sender] : NULL;
+    processcost costguard(cl);
     pwddetail pd;
     int type;
 
@@ -2768,6 +3033,9 @@ void process(ENetPacket *packet, int sender, int chan)
         else if(chan!=1 || getint(p)!=SV_CONNECT) disconnect_client(sender, DISC_TAGT);
         else
         {
+            double t = msgprofile::now();
+            cl->cost.begin(SV_CONNECT, t);
+            if(replaying) processprofile.begin(SV_CONNECT, t);
             cl->acversion = getint(p);
             cl->acbuildtype = getint(p);
             defformatstring(tags)(", AC: %d|%x", cl->acversion, cl->acbuildtype);
@@ -2793,6 +3061,7 @@ void process(ENetPacket *packet, int sender, int chan)
             if(matchreconnect && !banned)
             { // former player reconnecting to a server in match mode
                 cl->isauthed = true;
+                cl->updatehot();
                 logline(ACLOG_INFO, "[%s] %s logged in (reconnect to match)%s", cl->hostname, cl->name, tags);
             }
             else if(wl == NWL_IPFAIL || wl == NWL_PWDFAIL)
@@ -2808,6 +3077,7 @@ void process(ENetPacket *packet, int sender, int chan)
             else if(passwords.check(cl->name, cl->pwd, cl->salt, &pd, (cl->type==ST_TCPIP ? cl->peer->address.host : 0)) && (!pd.denyadmin || (banned && !srvfull && !srvprivate)) && bantype != BAN_MASTER) // pass admins always through
             { // admin (or deban) password match
                 cl->isauthed = true;
+                cl->updatehot();
                 if(!pd.denyadmin && wantrole == CR_ADMIN) clientrole = CR_ADMIN;
                 if(bantype == BAN_VOTE)
                 {
@@ -2828,6 +3098,7 @@ void process(ENetPacket *packet, int sender, int chan)
                 if(!strcmp(genpwdhash(cl->name, scl.serverpassword, cl->salt), cl->pwd))
                 {
                     cl->isauthed = true;
+                    cl->updatehot();
                     logline(ACLOG_INFO, "[%s] %s client logged in (using serverpassword)%s", cl->hostname, cl->name, tags);
                 }
                 else disconnect_client(sender, DISC_WRONGPW);
@@ -2838,6 +3109,7 @@ void process(ENetPacket *packet, int sender, int chan)
             else
             {
                 cl->isauthed = true;
+                cl->updatehot();
                 logline(ACLOG_INFO, "[%s] %s logged in (default)%s", cl->hostname, cl->name, tags);
             }
         }
@@ -2896,6 +3168,12 @@ void process(ENetPacket *packet, int sender, int chan)
     while((curmsg = p.length()) < p.maxlen)
     {
         type = checktype(getint(p), cl);
+        if(cl || replaying)
+        {
+            double t = msgprofile::now();
+            if(cl) cl->cost.begin(type, t);
+            if(replaying) processprofile.begin(type, t);
+        }
 
         #ifdef _DEBUG
         if(type!=SV_POS && type!=SV_POSC && type!=SV_CLIENTPING && type!=SV_PING && type!=SV_CLIENT)
@@ -3049,6 +3327,7 @@ void process(ENetPacket *packet, int sender, int chan)
                 if(!isdedicated || (smapstats.cgzsize == gzs && smapstats.hdr.maprevision == rev))
                 { // here any game really starts for a client: spawn, if it's a new game - don't spawn if the game was already running
                     cl->isonrightmap = true;
+                    cl->updatehot();
                     int sp = canspawn(cl);
                     sendf(sender, 1, "rii", SV_SPAWNDENY, sp);
                     cl->spawnperm = sp;
@@ -3489,6 +3768,11 @@ void process(ENetPacket *packet, int sender, int chan)
                 break;
             }
 
+            case SV_NEXTMAP:
+                getstring(text, p);
+                if(!strcmp(behindpath(text), nextmapadvertised)) sendnextmap(cl);
+                break;
+
             case SV_REMOVEMAP:
             {
                 getstring(text, p);
@@ -3700,6 +3984,15 @@ void process(ENetPacket *packet, int sender, int chan)
                         sendservmsg("your message has been logged", sender);
                     }
                 }
+                else if(!strcmp(ext, "server::cpucost"))
+                {
+                    // shows the server cpu time spent on each client, or (with a client number as argument) on the messages of one client
+                    // access:      requires admin privileges
+                    // usage:       /serverextension server::cpucost [cn]
+
+                    getstring(text, p, n);
+                    if(valid_client(sender) && clients[sender]->role==CR_ADMIN) sendcpucost(sender, text[0] ? atoi(text) : -1);
+                }
                 else if(!strcmp(ext, "set::teamsize"))
                 {
                     // intermediate solution to set the teamsize (will be voteable)
@@ -3767,6 +4060,7 @@ client &addclient()
     if(!c)
     {
         c = new client;
+        c->type = ST_EMPTY;
         c->clientnum = clients.length();
         clients.add(c);
     }
@@ -3781,7 +4075,11 @@ void checkintermission()
         minremain = (gamemillis>=gamelimit || forceintermission) ? 0 : (gamelimit - gamemillis + 60000 - 1)/60000;
         sendf(-1, 1, "ri3", SV_TIMEUP, (gamemillis>=gamelimit || forceintermission) ? gamelimit : gamemillis, gamelimit);
     }
-    if(!interm && minremain<=0) interm = gamemillis+10000;
+    if(!interm && minremain<=0)
+    {
+        interm = gamemillis+10000;
+        advertisenextmap(true);   // last call, for clients that didn't prefetch yet
+    }
     forceintermission = false;
 }
 
@@ -3799,7 +4097,7 @@ void sendworldstate()
 {
     static enet_uint32 lastsend = 0;
     if(clients.empty()) return;
-    enet_uint32 curtime = enet_time_get()-lastsend;
+    enet_uint32 curtime = (replaying ? servmillis : enet_time_get()) - lastsend;   // replays run on the recorded clock
     if(curtime<40) return;
     bool flush = buildworldstate();
     lastsend += curtime - (curtime%40);
@@ -3935,15 +4233,129 @@ void linequalitystats(int elapsed)
     }
 }
 
-void serverslice(uint timeout)   // main server update, called from cube main loop in sp, or dedicated server loop
+// connection admission: runs on every raw packet, before enet allocates a peer for a connect request
+// connect requests are rate limited per /24 subnet; during a connect flood (or always, if configured) clients
+// have to prove that they can receive packets at their address by repeating a stateless cookie
+
+#define CONNECTSUBNETS 1024
+#define CONNECTSUBNETRATE 5         // connect requests per second and subnet
+#define CONNECTSUBNETBURST 10
+#define CONNECTFLOODRATE 20         // more connect requests per second (from all sources) enable the cookie check
+#define CONNECTFLOODBURST 40
+#define CONNECTFLOODTIME 30000      // how long the cookie check stays active after a flood
+#define CONNECTCOOKIESLOT 16        // cookies are valid for 16..32 seconds
+
+static tokenbucket connectsubnets[CONNECTSUBNETS], connectfloodbucket;
+static uint connectsecret[8];
+static int connectfloodmillis = 0, connectattempts = 0, connectsratelimited = 0, connectschallenged = 0;
+
+static enet_uint32 connectcookie(const ENetAddress &addr, int slot)
+{
+    uchar msg[sizeof(connectsecret) + 10], hash[TIGERHASHSIZE];
+    memcpy(msg, connectsecret, sizeof(connectsecret));
+    enet_uint32 s = slot;
+    memcpy(msg + sizeof(connectsecret), &addr.host, 4);
+    memcpy(msg + sizeof(connectsecret) + 4, &s, 4);
+    memcpy(msg + sizeof(connectsecret) + 8, &addr.port, 2);
+    tigerhash(hash, msg, sizeof(msg));
+    enet_uint32 cookie;
+    memcpy(&cookie, hash, 4);
+    return cookie ? cookie : 1;  // 0: no cookie
+}
+
+static int ENET_CALLBACK connectadmission(ENetHost *host, ENetEvent *event)
+{
+    const uchar *d = host->receivedData;
+    size_t len = host->receivedDataLength, hdrlen = sizeof(enet_uint16);
+    if(len < hdrlen) return 0;
+    enet_uint16 peerid = ENET_NET_TO_HOST_16(*(const enet_uint16 *)d);
+    if((peerid & ENET_PROTOCOL_MAXIMUM_PEER_ID) != ENET_PROTOCOL_MAXIMUM_PEER_ID) return 0;  // packet for an existing peer
+    if(peerid & ENET_PROTOCOL_HEADER_FLAG_SENT_TIME) hdrlen += sizeof(enet_uint16);
+    if(host->checksum) hdrlen += sizeof(enet_uint32);
+    if(len < hdrlen + sizeof(ENetProtocolConnect) || (d[hdrlen] & ENET_PROTOCOL_COMMAND_MASK) != ENET_PROTOCOL_COMMAND_CONNECT) return 0;
+
+    connectattempts++;
+    const ENetAddress &addr = host->receivedAddress;
+    tokenbucket &sb = connectsubnets[iphash(addr.host & ENET_HOST_TO_NET_32(0xFFFFFF00)) % CONNECTSUBNETS];
+    if(!sb.allow(servmillis, CONNECTSUBNETRATE, CONNECTSUBNETBURST))
+    {
+        connectsratelimited++;
+        return 1;  // drop silently
+    }
+    sb.charge();
+    if(!connectfloodbucket.allow(servmillis, CONNECTFLOODRATE, CONNECTFLOODBURST))
+    {
+        if(!connectfloodmillis || servmillis - connectfloodmillis > CONNECTFLOODTIME) logline(ACLOG_INFO, "connect flood detected, requiring connect cookies");
+        connectfloodmillis = servmillis;
+    }
+    connectfloodbucket.charge();
+    if(connectfloodmillis && servmillis - connectfloodmillis > CONNECTFLOODTIME) connectfloodmillis = 0;
+
+    if(scl.connectcookies < 2 && (!scl.connectcookies || !connectfloodmillis)) return 0;
+    int slot = servmillis / (CONNECTCOOKIESLOT * 1000);
+    enet_uint32 data;
+    memcpy(&data, d + hdrlen + offsetof(ENetProtocolConnect, data), 4);
+    data = ENET_NET_TO_HOST_32(data);
+    if(data && (data == connectcookie(addr, slot) || data == connectcookie(addr, slot - 1))) return 0;  // proven address: let enet handle it
+
+    enet_uint32 reply[CONNECTCOOKIE_LEN / 4] = { ENET_HOST_TO_NET_32(CONNECTCOOKIE_MAGIC), ENET_HOST_TO_NET_32(connectcookie(addr, slot)) };
+    ENetBuffer buf;
+    buf.data = reply;
+    buf.dataLength = sizeof(reply);
+    enet_socket_send(host->socket, &addr, &buf, 1);
+    connectschallenged++;
+    return 1;
+}
+
+// all incoming network traffic can be written to a file (--capture) and later be replayed offline (--replay),
+// to benchmark the game logic with real traffic, but without network and without waiting for the clock
+
+#define CAPTUREMAGIC "ACSVCAP1"
+enum { CAP_TICK = 0, CAP_CONNECT, CAP_RECEIVE, CAP_DISCONNECT };
+
+static stream *capturefile = NULL;
+
+void startcapture(const char *filename, uint seed)
+{
+    capturefile = openfile(filename, "wb");
+    if(!capturefile) { logline(ACLOG_ERROR, "could not open capture file \"%s\"", filename); return; }
+    capturefile->write(CAPTUREMAGIC, 8);
+    capturefile->putlil<uint>(seed);
+    logline(ACLOG_INFO, "capturing all incoming packets to \"%s\" (seed %u)", filename, seed);
+}
+
+void captureevent(ENetEvent &event)
+{
+    switch(event.type)
+    {
+        case ENET_EVENT_TYPE_CONNECT:
+            capturefile->putchar(CAP_CONNECT);
+            capturefile->putlil<int>(int(event.peer - serverhost->peers));
+            capturefile->write(&event.peer->address.host, sizeof(enet_uint32));
+            capturefile->putlil<int>(event.peer->address.port);
+            break;
+
+        case ENET_EVENT_TYPE_RECEIVE:
+            capturefile->putchar(CAP_RECEIVE);
+            capturefile->putlil<int>(int(event.peer - serverhost->peers));
+            capturefile->putlil<int>(event.channelID);
+            capturefile->putlil<int>(event.packet->flags);
+            capturefile->putlil<int>(int(event.packet->dataLength));
+            capturefile->write(event.packet->data, event.packet->dataLength);
+            break;
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+            capturefile->putchar(CAP_DISCONNECT);
+            capturefile->putlil<int>(int(event.peer - serverhost->peers));
+            break;
+
+        default:
+            break;
+    }
+}
+
+void serverupdate(int nextmillis)   // game logic part of serverslice()
 {
-    static int msend = 0, mrec = 0, csend = 0, crec = 0, mnum = 0, cnum = 0;
-#ifdef STANDALONE
-    int nextmillis = (int)enet_time_get();
-    if(svcctrl) svcctrl->keepalive();
-#else
-    int nextmillis = isdedicated ? (int)enet_time_get() : lastmillis;
-#endif
     int diff = nextmillis - servmillis;
     gamemillis += diff;
     servmillis = nextmillis;
@@ -4012,15 +4424,81 @@ void serverslice(uint timeout)   // main server update, called from cube main lo
     }
 
     resetserverifempty();
+}
+
+void serverevent(ENetEvent &event)
+{
+    switch(event.type)
+    {
+        case ENET_EVENT_TYPE_CONNECT:
+        {
+            client &c = addclient();
+            c.type = ST_TCPIP;
+            c.updatehot();
+            c.peer = event.peer;
+            c.peer->data = (void *)(size_t)c.clientnum;
+            clientaddresses.add(c.clientnum, c.peer->address.host);
+            c.connectmillis = servmillis;
+            c.state.state = CS_SPECTATE;
+            c.salt = rnd(0x1000000)*((servmillis%1000)+1);
+            char hn[1024];
+            copystring(c.hostname, (enet_address_get_host_ip(&c.peer->address, hn, sizeof(hn))==0) ? hn : "unknown");
+            logline(ACLOG_INFO,"[%s] client connected", c.hostname);
+            sendservinfo(c);
+            totalclients++;
+            break;
+        }
+
+        case ENET_EVENT_TYPE_RECEIVE:
+        {
+            int cn = (int)(size_t)event.peer->data;
+            if(valid_client(cn)) process(event.packet, cn, event.channelID);
+            if(event.packet->referenceCount==0) enet_packet_destroy(event.packet);
+            break;
+        }
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+        {
+            int cn = (int)(size_t)event.peer->data;
+            if(!valid_client(cn)) break;
+            disconnect_client(cn);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void serverslice(uint timeout)   // main server update, called from cube main loop in sp, or dedicated server loop
+{
+    static int msend = 0, mrec = 0, csend = 0, crec = 0, mnum = 0, cnum = 0;
+#ifdef STANDALONE
+    int nextmillis = (int)enet_time_get();
+    if(svcctrl) svcctrl->keepalive();
+#else
+    int nextmillis = isdedicated ? (int)enet_time_get() : lastmillis;
+#endif
+    if(capturefile)
+    {
+        capturefile->putchar(CAP_TICK);
+        capturefile->putlil<int>(nextmillis);
+    }
+
+    serverupdate(nextmillis);
 
     if(!isdedicated) return;     // below is network only
 
     poll_serverthreads();
+    poll_servermapstore();
+    advertisenextmap();
 
     serverms(smode, numclients(), minremain, smapname, servmillis, serverhost->address, &mnum, &msend, &mrec, &cnum, &csend, &crec, SERVER_PROTOCOL_VERSION);
 
     if(autoteam && m_teammode && !m_arena && !interm && servmillis - lastfillup > 5000 && refillteams()) lastfillup = servmillis;
 
+    if(servmillis - last_cpucost_check > CPUCOSTINTERVAL) check_cpucost();
+
     static unsigned int lastThrottleEpoch = 0;
     if(serverhost->bandwidthThrottleEpoch != lastThrottleEpoch)
     {
@@ -4032,16 +4510,23 @@ void serverslice(uint timeout)   // main server update, called from cube main lo
     {
         laststatus = servmillis;
         rereadcfgs();
+        int nonlocalclients = numnonlocalclients();
         if(nonlocalclients || serverhost->totalSentData || serverhost->totalReceivedData)
         {
             if(nonlocalclients) loggamestatus(NULL);
+            extern int pingsdropped;
             logline(ACLOG_INFO, "Status at %s: %d remote clients, %.1f send, %.1f rec (K/sec);"
-                                         " Ping: #%d|%d|%d; CSL: #%d|%d|%d (bytes)",
+                                         " Ping: #%d|%d|%d; CSL: #%d|%d|%d (bytes); %d queries dropped",
                                           timestring(true, "%d-%m-%Y %H:%M:%S"), nonlocalclients, serverhost->totalSentData/60.0f/1024, serverhost->totalReceivedData/60.0f/1024,
-                                          mnum, msend, mrec, cnum, csend, crec);
-            mnum = msend = mrec = cnum = csend = crec = 0;
+                                          mnum, msend, mrec, cnum, csend, crec, pingsdropped);
+            mnum = msend = mrec = cnum = csend = crec = pingsdropped = 0;
             linequalitystats(0);
         }
+        logservermapstore();
+        logworldstatepool();
+        logcpucost();
+        if(connectattempts) logline(ACLOG_INFO, "Connect requests: %d, %d rate limited, %d challenged", connectattempts, connectsratelimited, connectschallenged);
+        connectattempts = connectsratelimited = connectschallenged = 0;
         serverhost->totalSentData = serverhost->totalReceivedData = 0;
     }
 
@@ -4054,50 +4539,113 @@ void serverslice(uint timeout)   // main server update, called from cube main lo
             if(enet_host_service(serverhost, &event, timeout) <= 0) break;
             serviced = true;
         }
-        switch(event.type)
+        if(capturefile) captureevent(event);
+        serverevent(event);
+    }
+    sendworldstate();
+}
+
+static int cmpprocessprofile(int *a, int *b)
+{
+    double ta = processprofile.usecs[*a], tb = processprofile.usecs[*b];
+    return ta > tb ? -1 : (ta < tb ? 1 : 0);
+}
+
+void replaycapture(const char *filename)     // feed a capture through the server as fast as possible
+{
+    stream *f = openfile(filename, "rb");
+    char magic[8];
+    if(!f || f->read(magic, 8) != 8 || memcmp(magic, CAPTUREMAGIC, 8)) fatal("could not read capture file \"%s\"", filename);
+    uint seed = f->getlil<uint>();
+    seedMT(seed);
+    logline(ACLOG_INFO, "replaying \"%s\" (seed %u)", filename, seed);
+    replaying = true;
+
+    int ticks = 0, connects = 0, packets = 0, replaymillis = 0;
+    long long bytesin = 0;
+    double start = msgprofile::now(), ticktime = 0;
+    int type;
+    while((type = f->getchar()) >= 0)
+    {
+        ENetEvent event;
+        if(type != CAP_TICK)
+        {
+            int pn = f->getlil<int>();
+            if(pn < 0 || pn >= (int)serverhost->peerCount) fatal("replay: bad peer %d, capture was recorded with more clients (-c)", pn);
+            event.peer = &serverhost->peers[pn];
+        }
+        switch(type)
         {
-            case ENET_EVENT_TYPE_CONNECT:
+            case CAP_TICK:
             {
-                client &c = addclient();
-                c.type = ST_TCPIP;
-                c.peer = event.peer;
-                c.peer->data = (void *)(size_t)c.clientnum;
-                c.connectmillis = servmillis;
-                c.state.state = CS_SPECTATE;
-                c.salt = rnd(0x1000000)*((servmillis%1000)+1);
-                char hn[1024];
-                copystring(c.hostname, (enet_address_get_host_ip(&c.peer->address, hn, sizeof(hn))==0) ? hn : "unknown");
-                logline(ACLOG_INFO,"[%s] client connected", c.hostname);
-                sendservinfo(c);
-                totalclients++;
+                replaymillis = f->getlil<int>();
+                double t = msgprofile::now();
+                if(ticks++) sendworldstate();
+                serverupdate(replaymillis);
+                if(autoteam && m_teammode && !m_arena && !interm && servmillis - lastfillup > 5000 && refillteams()) lastfillup = servmillis;
+                ticktime += msgprofile::now() - t;
                 break;
             }
 
-            case ENET_EVENT_TYPE_RECEIVE:
-            {
-                int cn = (int)(size_t)event.peer->data;
-                if(valid_client(cn)) process(event.packet, cn, event.channelID);
-                if(event.packet->referenceCount==0) enet_packet_destroy(event.packet);
+            case CAP_CONNECT:
+                f->read(&event.peer->address.host, sizeof(enet_uint32));
+                event.peer->address.port = f->getlil<int>();
+                event.type = ENET_EVENT_TYPE_CONNECT;
+                serverevent(event);
+                connects++;
                 break;
-            }
 
-            case ENET_EVENT_TYPE_DISCONNECT:
+            case CAP_RECEIVE:
             {
-                int cn = (int)(size_t)event.peer->data;
-                if(!valid_client(cn)) break;
-                disconnect_client(cn);
+                int chan = f->getlil<int>(), flags = f->getlil<int>(), len = f->getlil<int>();
+                if(len < 0 || len > ENET_PROTOCOL_MAXIMUM_PACKET_SIZE) fatal("replay: corrupt capture file");
+                event.type = ENET_EVENT_TYPE_RECEIVE;
+                event.channelID = chan;
+                event.packet = enet_packet_create(NULL, len, flags);
+                if(f->read(event.packet->data, len) != len) fatal("replay: capture file truncated");
+                processprofile.begin(-1, msgprofile::now());
+                serverevent(event);
+                processprofile.end(msgprofile::now());
+                packets++;
+                bytesin += len;
                 break;
             }
 
-            default:
+            case CAP_DISCONNECT:
+                event.type = ENET_EVENT_TYPE_DISCONNECT;
+                serverevent(event);
                 break;
+
+            default:
+                fatal("replay: corrupt capture file");
         }
     }
-    sendworldstate();
+    if(ticks) sendworldstate();
+    delete f;
+
+    double elapsed = max(msgprofile::now() - start, 1.0);
+    double processtime = 0;
+    vector<int> order;
+    loopi(SV_NUM + 1) if(processprofile.count[i])
+    {
+        order.add(i);
+        processtime += processprofile.usecs[i];
+    }
+    order.sort(cmpprocessprofile);
+    logline(ACLOG_INFO, "replayed %d seconds of traffic in %.3f seconds (%.1fx realtime)", replaymillis / 1000, elapsed / 1e6, replaymillis * 1e3 / elapsed);
+    logline(ACLOG_INFO, "%d connects, %d packets (%.1f KB in, %.1f KB out), %.0f packets/s", connects, packets, bytesin / 1024.0, replaybytesout / 1024.0, packets * 1e6 / elapsed);
+    logline(ACLOG_INFO, "%d server ticks, %.2f us per tick; process(): %.2f us per packet", ticks, ticks ? ticktime / ticks : 0.0, packets ? processtime / packets : 0.0);
+    logline(ACLOG_INFO, "message type          count       total ms     us/msg");
+    loopv(order)
+    {
+        int m = order[i];
+        logline(ACLOG_INFO, "%-20s %8d %12.3f %10.3f", msgprofile::name(m), processprofile.count[m], processprofile.usecs[m] / 1e3, processprofile.usecs[m] / processprofile.count[m]);
+    }
 }
 
 void cleanupserver()
 {
+    DELETEP(capturefile);
     if(serverhost) { enet_host_destroy(serverhost); serverhost = NULL; }
     if(svcctrl)
     {
@@ -4116,13 +4664,32 @@ int getpongflags(enet_uint32 ip)
     return flags;
 }
 
+// the extinfo/extping responses only depend on the game state:
+// they get built at most once per server tick and all queries of that tick are served from the cache
+
+struct extinfocache
+{
+    int namelistmillis, statsmillis, teamscoremillis;     // servmillis of the last update
+    vector<uchar> namelist, stats, teamscore;
+    vector<threeint> statsrecords;                         // key: cn, val1: offset in stats, val2: length
+
+    extinfocache() : namelistmillis(-1), statsmillis(-1), teamscoremillis(-1) {}
+} extcache;
+
 void extping_namelist(ucharbuf &p)
 {
-    loopv(clients)
+    vector<uchar> &q = extcache.namelist;
+    if(extcache.namelistmillis != servmillis)
     {
-        if(clients[i]->type == ST_TCPIP && clients[i]->isauthed) sendstring(clients[i]->name, p);
+        extcache.namelistmillis = servmillis;
+        q.setsize(0);
+        loopv(clients)
+        {
+            if(clients[i]->type == ST_TCPIP && clients[i]->isauthed) sendstring(clients[i]->name, q);
+        }
+        sendstring("", q);
     }
-    sendstring("", p);
+    p.put(q.getbuf(), q.length());
 }
 
 void extping_serverinfo(ucharbuf &pi, ucharbuf &po)
@@ -4176,14 +4743,20 @@ void extinfo_cnbuf(ucharbuf &p, int cn)
     }
 }
 
-void extinfo_statsbuf(ucharbuf &p, int pid, int bpos, ENetSocket &pongsock, ENetAddress &addr, ENetBuffer &buf, int len, int *csend)
+void extinfo_updatestats()
 {
+    if(extcache.statsmillis == servmillis) return;
+    extcache.statsmillis = servmillis;
+    vector<uchar> &p = extcache.stats;
+    p.setsize(0);
+    extcache.statsrecords.setsize(0);
+    bool ismatch = mastermode == MM_MATCH;
     loopv(clients)
     {
         if(clients[i]->type != ST_TCPIP) continue;
-        if(pid>-1 && clients[i]->clientnum!=pid) continue;
-
-        bool ismatch = mastermode == MM_MATCH;
+        threeint &r = extcache.statsrecords.add();
+        r.key = clients[i]->clientnum;
+        r.val1 = p.length();
         putint(p,EXT_PLAYERSTATS_RESP_STATS);  // send player stats following
         putint(p,clients[i]->clientnum);  //add player id
         putint(p,clients[i]->ping);             //Ping
@@ -4202,38 +4775,62 @@ void extinfo_statsbuf(ucharbuf &p, int pid, int bpos, ENetSocket &pongsock, ENet
         putint(p,clients[i]->state.state);      //State (Alive,Dead,Spawning,Lagged,Editing)
         uint ip = clients[i]->peer->address.host; // only 3 byte of the ip address (privacy protected)
         p.put((uchar*)&ip,3);
+        r.val2 = p.length() - r.val1;
+    }
+}
+
+int extinfo_statsbuf(ucharbuf &p, int pid, int bpos, ENetSocket &pongsock, ENetAddress &addr, ENetBuffer &buf, int len, int *csend)  // returns number of packets sent
+{
+    extinfo_updatestats();
+    int sent = 0;
+    loopv(extcache.statsrecords)
+    {
+        threeint &r = extcache.statsrecords[i];
+        if(pid>-1 && r.key!=pid) continue;
+
+        p.put(extcache.stats.getbuf() + r.val1, r.val2);
 
         buf.dataLength = len + p.length();
         enet_socket_send(pongsock, &addr, &buf, 1);
         *csend += (int)buf.dataLength;
+        sent++;
 
         if(pid>-1) break;
         p.len=bpos;
     }
+    return sent;
 }
 
 void extinfo_teamscorebuf(ucharbuf &p)
 {
-    putint(p, m_teammode ? EXT_ERROR_NONE : EXT_ERROR);
-    putint(p, gamemode);
-    putint(p, minremain); // possible TODO: use gamemillis, gamelimit here too?
-    if(!m_teammode) return;
-
-    int teamsizes[TEAM_NUM] = { 0 }, fragscores[TEAM_NUM] = { 0 }, flagscores[TEAM_NUM] = { 0 };
-    loopv(clients) if(clients[i]->type!=ST_EMPTY && team_isvalid(clients[i]->team))
-    {
-        teamsizes[clients[i]->team] += 1;
-        fragscores[clients[i]->team] += clients[i]->state.frags;
-        flagscores[clients[i]->team] += clients[i]->state.flagscore;
-    }
+    vector<uchar> &q = extcache.teamscore;
+    if(extcache.teamscoremillis != servmillis)
+    {
+        extcache.teamscoremillis = servmillis;
+        q.setsize(0);
+        putint(q, m_teammode ? EXT_ERROR_NONE : EXT_ERROR);
+        putint(q, gamemode);
+        putint(q, minremain); // possible TODO: use gamemillis, gamelimit here too?
+        if(m_teammode)
+        {
+            int teamsizes[TEAM_NUM] = { 0 }, fragscores[TEAM_NUM] = { 0 }, flagscores[TEAM_NUM] = { 0 };
+            loopv(clients) if(clients[i]->type!=ST_EMPTY && team_isvalid(clients[i]->team))
+            {
+                teamsizes[clients[i]->team] += 1;
+                fragscores[clients[i]->team] += clients[i]->state.frags;
+                flagscores[clients[i]->team] += clients[i]->state.flagscore;
+            }
 
-    loopi(TEAM_NUM) if(teamsizes[i])
-    {
-        sendstring(team_string(i), p); // team name
-        putint(p, fragscores[i]); // add fragscore per team
-        putint(p, m_flags ? flagscores[i] : -1); // add flagscore per team
-        putint(p, -1); // ?
+            loopi(TEAM_NUM) if(teamsizes[i])
+            {
+                sendstring(team_string(i), q); // team name
+                putint(q, fragscores[i]); // add fragscore per team
+                putint(q, m_flags ? flagscores[i] : -1); // add flagscore per team
+                putint(q, -1); // ?
+            }
+        }
     }
+    p.put(q.getbuf(), q.length());
 }
 
 
@@ -4249,6 +4846,7 @@ void localconnect()
     servstate.reset();
     client &c = addclient();
     c.type = ST_LOCAL;
+    c.updatehot();
     c.role = CR_ADMIN;
     c.salt = 0;
     copystring(c.hostname, "local");
@@ -4321,14 +4919,16 @@ void initserver(bool dedicated, int argc, char **argv)
     logline(ACLOG_INFO, "logging local AssaultCube server (version %d, protocol %d/%d) now..", AC_VERSION, SERVER_PROTOCOL_VERSION, EXT_VERSION);
 
     copystring(servdesc_current, scl.servdesc_full);
-    servermsinit(scl.master ? scl.master : AC_MASTER_URI, scl.ip, CUBE_SERVINFO_PORT(scl.serverport), dedicated);
+    servermsinit(scl.master ? scl.master : AC_MASTER_URI, scl.ip, CUBE_SERVINFO_PORT(scl.serverport), dedicated && !scl.replay);
 
     if((isdedicated = dedicated))
     {
         ENetAddress address = { ENET_HOST_ANY, (enet_uint16)scl.serverport };
         if(scl.ip[0] && enet_address_set_host(&address, scl.ip)<0) logline(ACLOG_WARNING, "server ip not resolved!");
-        serverhost = enet_host_create(&address, scl.maxclients+1, 3, 0, scl.uprate);
+        serverhost = enet_host_create(scl.replay ? NULL : &address, scl.maxclients+1, 3, 0, scl.uprate);
         if(!serverhost) fatal("could not create server host");
+        loopi(sizeof(connectsecret) / sizeof(uint)) connectsecret[i] = randomMT() ^ (uint)time(NULL) ^ (uint)(size_t)&connectsecret;
+        serverhost->intercept = connectadmission;
         loopi(scl.maxclients) serverhost->peers[i].data = (void *)-1;
 
         maprot.init(scl.maprot);
@@ -4382,6 +4982,16 @@ void initserver(bool dedicated, int argc, char **argv)
         readmapsthread_sem = new sl_semaphore(0, NULL);
         sl_createthread(readmapsthread, (void *)"xxxx");
 
+        if(scl.replay)
+        {
+            while(!poll_serverthreads()) sl_sleep(1);     // read all servermaps first, so that every replayed tick sees the same maps
+            replaycapture(scl.replay);
+            exit(EXIT_SUCCESS);
+        }
+        uint seed = scl.seed ? (uint)scl.seed : randomMT() ^ (uint)time(NULL);
+        seedMT(seed);
+        if(scl.capture) startcapture(scl.capture, seed);
+
         for(;;) serverslice(5);
     }
 }
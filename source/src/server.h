@@ -77,6 +77,25 @@ union gameevent
     reloadevent reload;
 };
 
+#define MAXCLIENTEVENTS 128     // power of two; one slot stays unused, queueing stops after 100 events anyway
+
+typedef ringbuf<gameevent, MAXCLIENTEVENTS> gameeventqueue;
+
+struct hiteventiterator     // walks the GE_HIT events which follow the shot or explode event at the front of the queue
+{
+    gameeventqueue &events;
+    int i;
+
+    hiteventiterator(gameeventqueue &events) : events(events), i(0) {}
+
+    hitevent *next()
+    {
+        if(i + 1 >= events.length() || events[i + 1].type != GE_HIT) return NULL;
+        return &events[++i].hit;
+    }
+    int index() const { return i; } // queue position of the last returned hit (1 for the first one), or the number of hits after the end
+};
+
 template <int N>
 struct projectilestate
 {
@@ -162,6 +181,7 @@ struct savedscore
     uint ip;
     int frags, flagscore, deaths, teamkills, shotdamage, damage, team, points, events, lastdisc, reconnections;
     bool valid, forced;
+    int next;       // hash chain, see savedscoreindex
 
     void reset()
     {
@@ -223,6 +243,136 @@ struct medals
     }
 };
 
+// compact copy of the client fields, which are read by the per-tick loops, plus the resulting head counts
+// (indexed by clientnum, updated by client::updatehot() whenever type, team, isauthed or isonrightmap change)
+
+enum { HOT_AUTHED = 1 << 0, HOT_RIGHTMAP = 1 << 1 };
+
+struct clienthotstate
+{
+    uchar type[MAXCLIENTS], team[MAXCLIENTS], flags[MAXCLIENTS];
+    int numtype[ST_TCPIP + 1], numauthed, numteam[TEAM_NUM];    // numteam: authed clients on the right map
+
+    clienthotstate() { memset(this, 0, sizeof(clienthotstate)); }
+
+    bool used(int cn) const { return type[cn] != ST_EMPTY; }
+    bool authed(int cn) const { return type[cn] != ST_EMPTY && (flags[cn] & HOT_AUTHED); }
+    bool inteam(int cn) const { return authed(cn) && (flags[cn] & HOT_RIGHTMAP) && team_isvalid(team[cn]); }  // counted in numteam
+    bool active(int cn) const { return inteam(cn) && team_isactive(team[cn]); }
+
+    void count(int cn, int n)
+    {
+        if(used(cn)) numtype[type[cn]] += n;    // (empty slots are not counted)
+        if(authed(cn)) numauthed += n;
+        if(inteam(cn)) numteam[team[cn]] += n;
+    }
+
+    void update(int cn, int ntype, int nteam, int nflags)
+    {
+        count(cn, -1);
+        type[cn] = ntype;
+        team[cn] = team_isvalid(nteam) ? nteam : TEAM_NUM;
+        flags[cn] = nflags;
+        count(cn, 1);
+    }
+};
+
+extern clienthotstate clienthot;
+
+// remote clients by ip address: hash chains of client numbers (added on connect, removed by client::zap())
+
+#define CLIENTADDRHASH 64
+
+struct clientaddressindex
+{
+    int head[CLIENTADDRHASH], next[MAXCLIENTS];
+    enet_uint32 host[MAXCLIENTS];
+
+    clientaddressindex() { loopi(CLIENTADDRHASH) head[i] = -1; }
+
+    static int bucket(enet_uint32 ip) { return iphash(ip) % CLIENTADDRHASH; }
+    int first(enet_uint32 ip) const { return head[bucket(ip)]; }     // walk with next[], compare the full address
+
+    void add(int cn, enet_uint32 ip)
+    {
+        int &h = head[bucket(ip)];
+        host[cn] = ip;
+        next[cn] = h;
+        h = cn;
+    }
+
+    void remove(int cn)
+    {
+        for(int *p = &head[bucket(host[cn])]; *p >= 0; p = &next[*p]) if(*p == cn)
+        {
+            *p = next[cn];
+            return;
+        }
+    }
+};
+
+extern clientaddressindex clientaddresses;
+
+// time spent per message type, measured for every client (cpu cost accounting) and for the whole server during replays
+struct msgprofile
+{
+    double usecs[SV_NUM + 1], mark;         // index SV_NUM collects the packet overhead and invalid messages
+    int count[SV_NUM + 1], cur;
+
+    msgprofile() { reset(); }
+
+    void reset()
+    {
+        loopi(SV_NUM + 1) { usecs[i] = 0; count[i] = 0; }
+        mark = 0;
+        cur = -1;
+    }
+
+    static double now()                     // microseconds
+    {
+#ifdef WIN32
+        LARGE_INTEGER c, f;
+        QueryPerformanceCounter(&c);
+        QueryPerformanceFrequency(&f);
+        return c.QuadPart * 1e6 / f.QuadPart;
+#else
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+#endif
+    }
+
+    void begin(int type, double t)          // charge the elapsed time to the previous message and start timing the next one
+    {
+        if(cur >= 0) usecs[cur] += t - mark;
+        cur = type >= 0 && type < SV_NUM ? type : SV_NUM;
+        count[cur]++;
+        mark = t;
+    }
+
+    void end(double t)
+    {
+        if(cur >= 0) usecs[cur] += t - mark;
+        cur = -1;
+    }
+
+    double total() const
+    {
+        double sum = 0;
+        loopi(SV_NUM + 1) sum += usecs[i];
+        return sum;
+    }
+
+    int top(double below = 1e300) const      // most expensive message type, which cost less than 'below'
+    {
+        int best = -1;
+        loopi(SV_NUM + 1) if(usecs[i] > 0 && usecs[i] < below && (best < 0 || usecs[i] > usecs[best])) best = i;
+        return best;
+    }
+
+    static const char *name(int type) { return type >= 0 && type < SV_NUM ? messagenames[type] : "(packet overhead)"; }
+};
+
 struct client                   // server side version of "dynent" type
 {
     int type;
@@ -248,7 +398,7 @@ struct client                   // server side version of "dynent" type
     int lastprofileupdate, fastprofileupdates;
     int demoflags;
     clientstate state;
-    vector<gameevent> events;
+    gameeventqueue events;
     vector<uchar> position, messages;
     string lastsaytext;
     int saychars, lastsay, spamcount, badspeech, badmillis;
@@ -278,24 +428,36 @@ struct client                   // server side version of "dynent" type
     float pr;
     int yls, pls, tls;
     int bs, bt, blg, bp;
+    msgprofile cost;            // time spent on messages and game events of this client
+    double lastcost;            // cost.total() at the last check_cpucost()
+    int costrate;               // microseconds per second, measured by check_cpucost()
+    int nextmapsent;            // advertised next map (serial), that was already sent to this client
+
+    void updatehot()
+    {
+        clienthot.update(clientnum, type, team, (isauthed ? HOT_AUTHED : 0) | (isonrightmap ? HOT_RIGHTMAP : 0));
+    }
 
     gameevent &addevent()
     {
         static gameevent dummy;
         if(events.length()>100) return dummy;
-        return events.add();
+        gameevent &e = *events.stage();
+        events.commit();
+        return e;
     }
 
     void mapchange(bool getmap = false)
     {
         state.reset();
-        events.setsize(0);
+        events.clear();
         overflow = 0;
         timesync = false;
         isonrightmap = m_coop;
         spawnperm = SP_WRONGMAP;
         spawnpermsent = servmillis;
         autospawn = false;
+        updatehot();
         if(!getmap)
         {
             loggedwrongmap = false;
@@ -346,16 +508,30 @@ struct client                   // server side version of "dynent" type
         input = inputmillis = 0;
         wn = -1;
         bs = bt = blg = bp = 0;
+        cost.reset();
+        lastcost = 0;
+        costrate = 0;
+        nextmapsent = 0;
     }
 
     void zap()
     {
+        if(type == ST_TCPIP) clientaddresses.remove(clientnum);
         type = ST_EMPTY;
         role = CR_DEFAULT;
         isauthed = haswelcome = false;
+        updatehot();
     }
 };
 
+struct processcost          // time a process() call, the remaining time is charged to the last message
+{
+    client *cl;
+
+    processcost(client *cl) : cl(cl) { if(cl) cl->cost.begin(-1, msgprofile::now()); }
+    ~processcost() { if(cl) cl->cost.end(msgprofile::now()); }
+};
+
 struct ban
 {
     ENetAddress address;
@@ -440,7 +616,8 @@ const char *messagenames[SV_NUM] =
     "SV_SWITCHNAME", "SV_SWITCHSKIN", "SV_SWITCHTEAM",
     "SV_CLIENT",
     "SV_EXTENSION",
-    "SV_MAPIDENT", "SV_HUDEXTRAS", "SV_POINTS"
+    "SV_MAPIDENT", "SV_HUDEXTRAS", "SV_POINTS",
+    "SV_NEXTMAP"
 };
 
 const char *entnames[] =
@@ -67,6 +67,11 @@ struct mapaction : serveraction
             mapstats *ms = map[0] ? getservermapstats(map, false, &maploc) : NULL;
             bool validname = validmapname(map);
             mapok = (ms != NULL) && validname && ( (mode != GMODE_COOPEDIT && mapisok(ms)) || (mode == GMODE_COOPEDIT && !readonlymap(maploc)) );
+            if(mapok)
+            {
+                copystring(servermapvotename, behindpath(map));
+                prefetchservermap(servermapvotename);
+            }
             if(!mapok)
             {
                 if(notify)
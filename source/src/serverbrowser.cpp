@@ -4,29 +4,67 @@
 
 #include "SDL_thread.h"
 
+#ifdef __linux__
+#define SB_MMSG     // sendmmsg/recvmmsg for server pings
+#endif
+
 extern bool isdedicated;
 
 struct resolverthread
 {
     SDL_Thread *thread;
     const char *query;
+    string name;
+    bool notify;
     int starttime;
 };
 
+struct resolverrequest
+{
+    const char *query;
+    bool notify;
+};
+
 struct resolverresult
 {
     const char *query;
     ENetAddress address;
 };
 
-vector<resolverthread> resolverthreads;
-vector<const char *> resolverqueries;
+struct dnscacheentry
+{
+    enet_uint32 host;
+    int expire;
+};
+
+vector<resolverthread *> resolverthreads;   // (threads keep pointers to their entries)
+vector<resolverrequest> resolverqueries;
 vector<resolverresult> resolverresults;
+hashtable<const char *, dnscacheentry> dnscache;
 SDL_mutex *resolvermutex;
 SDL_cond *querycond, *resultcond;
 
-#define RESOLVERTHREADS 1
-#define RESOLVERLIMIT 3000
+#define MAXRESOLVERS 16
+#define DNSCACHETIME (30*60*1000)
+#define DNSFAILTIME (60*1000)
+
+VARP(maxresolvers, 1, 4, MAXRESOLVERS);
+
+// dns cache, positive and negative: only called with resolvermutex locked
+
+static void dnscacheadd(const char *name, enet_uint32 host)
+{
+    dnscacheentry *e = dnscache.access(name);
+    if(!e) e = &dnscache[newstring(name)];
+    e->host = host;
+    e->expire = totalmillis + (host != ENET_HOST_ANY ? DNSCACHETIME : DNSFAILTIME);
+}
+
+static dnscacheentry *dnscachefind(const char *name)
+{
+    dnscacheentry *e = dnscache.access(name);
+    return e && e->expire - totalmillis > 0 ? e : NULL;
+}
 
 int resolverloop(void * data)
 {
@@ -40,28 +78,50 @@ int resolverloop(void * data)
     {
         SDL_LockMutex(resolvermutex);
         while(resolverqueries.empty()) SDL_CondWait(querycond, resolvermutex);
-        rt->query = resolverqueries.pop();
+        resolverrequest rq = resolverqueries.remove(0);
+        rt->query = rq.query;
+        rt->notify = rq.notify;
         rt->starttime = totalmillis;
+        copystring(rt->name, rq.query);
+        string name;    // (the query may be freed, when we get stopped)
+        copystring(name, rq.query);
+        ENetAddress address = { ENET_HOST_ANY, ENET_PORT_ANY };
+        dnscacheentry *cached = dnscachefind(name);  // (same name queried twice)
+        if(cached) address.host = cached->host;
         SDL_UnlockMutex(resolvermutex);
 
-        ENetAddress address = { ENET_HOST_ANY, ENET_PORT_ANY };
-        enet_address_set_host(&address, rt->query);
+        if(!cached) enet_address_set_host(&address, name);
 
         SDL_LockMutex(resolvermutex);
+        if(!cached) dnscacheadd(name, address.host);
         if(rt->query && thread == rt->thread)
         {
-            resolverresult &rr = resolverresults.add();
-            rr.query = rt->query;
-            rr.address = address;
+            if(rt->notify)
+            {
+                resolverresult &rr = resolverresults.add();
+                rr.query = rt->query;
+                rr.address = address;
+                SDL_CondSignal(resultcond);
+            }
             rt->query = NULL;
             rt->starttime = 0;
-            SDL_CondSignal(resultcond);
         }
         SDL_UnlockMutex(resolvermutex);
     }
     return 0;
 }
 
+static void resolverspawn()
+{
+    resolverthread *rt = new resolverthread;
+    rt->query = NULL;
+    rt->name[0] = '\0';
+    rt->notify = false;
+    rt->starttime = 0;
+    resolverthreads.add(rt);
+    rt->thread = SDL_CreateThread(resolverloop, "ResolverThread", rt);
+}
+
 void resolverinit()
 {
     resolvermutex = SDL_CreateMutex();
@@ -69,13 +129,7 @@ void resolverinit()
     resultcond = SDL_CreateCond();
 
     SDL_LockMutex(resolvermutex);
-    loopi(RESOLVERTHREADS)
-    {
-        resolverthread &rt = resolverthreads.add();
-        rt.query = NULL;
-        rt.starttime = 0;
-        rt.thread = SDL_CreateThread(resolverloop, "ResolverThread", &rt);
-    }
+    resolverspawn();    // more are started on demand, up to maxresolvers
     SDL_UnlockMutex(resolvermutex);
 }
 
@@ -101,22 +155,73 @@ void resolverclear()
     resolverresults.shrink(0);
     loopv(resolverthreads)
     {
-        resolverthread &rt = resolverthreads[i];
+        resolverthread &rt = *resolverthreads[i];
         resolverstop(rt);
     }
     SDL_UnlockMutex(resolvermutex);
 }
 
-void resolverquery(const char *name)
+// queue a lookup: with notify, the result is delivered through resolvercheck(), else it only ends up in the cache
+
+void resolverquery(const char *name, bool notify)
 {
     if(resolverthreads.empty()) resolverinit();
 
     SDL_LockMutex(resolvermutex);
-    resolverqueries.add(name);
-    SDL_CondSignal(querycond);
+    dnscacheentry *cached = dnscachefind(name);
+    if(cached)
+    {
+        if(notify)
+        {
+            resolverresult &rr = resolverresults.add();
+            rr.query = name;
+            rr.address.host = cached->host;
+            rr.address.port = ENET_PORT_ANY;
+        }
+    }
+    else
+    {
+        bool queued = false;
+        // (results go to the query pointer, lookups just for the cache only need the same name)
+        loopv(resolverqueries) if(resolverqueries[i].query == name || (!notify && !strcmp(resolverqueries[i].query, name)))
+        {
+            if(notify) resolverqueries[i].notify = true;
+            queued = true;
+            break;
+        }
+        loopv(resolverthreads) if(resolverthreads[i]->query && (resolverthreads[i]->query == name || (!notify && !strcmp(resolverthreads[i]->name, name))))
+        {
+            if(notify) resolverthreads[i]->notify = true;
+            queued = true;
+        }
+        if(!queued)
+        {
+            resolverrequest &rq = resolverqueries.add();
+            rq.query = name;
+            rq.notify = notify;
+            int idle = 0;
+            loopv(resolverthreads) if(!resolverthreads[i]->query) idle++;
+            if(idle < resolverqueries.length() && resolverthreads.length() < maxresolvers) resolverspawn();
+            SDL_CondSignal(querycond);
+        }
+    }
     SDL_UnlockMutex(resolvermutex);
 }
 
+// returns 1 with the address, if the name was resolved recently, 0 if the lookup failed recently, -1 if unknown
+
+int resolvercached(const char *name, ENetAddress *address)
+{
+    if(resolverthreads.empty()) resolverinit();
+
+    SDL_LockMutex(resolvermutex);
+    dnscacheentry *cached = dnscachefind(name);
+    int result = cached ? (cached->host != ENET_HOST_ANY) : -1;
+    if(result > 0) address->host = cached->host;
+    SDL_UnlockMutex(resolvermutex);
+    return result;
+}
+
 bool resolvercheck(const char **name, ENetAddress *address)
 {
     bool resolved = false;
@@ -130,34 +235,34 @@ bool resolvercheck(const char **name, ENetAddress *address)
     }
     else loopv(resolverthreads)
     {
-        resolverthread &rt = resolverthreads[i];
+        resolverthread &rt = *resolverthreads[i];
         if(rt.query && totalmillis - rt.starttime > RESOLVERLIMIT)
         {
-            resolverstop(rt);
+            dnscacheadd(rt.name, ENET_HOST_ANY);    // (the query string belongs to the caller and may be gone)
             *name = rt.query;
-            resolved = true;
+            resolved = rt.notify;
+            resolverstop(rt);
+            if(resolved) break;
         }
     }
     SDL_UnlockMutex(resolvermutex);
     return resolved;
 }
 
-extern bool isdedicated;
-
 bool resolverwait(const char *name, ENetAddress *address)
 {
     if(isdedicated) return enet_address_set_host(address, name) >= 0;
 
-    if(resolverthreads.empty()) resolverinit();
+    int cached = resolvercached(name, address);
+    if(cached >= 0) return cached > 0;
 
     defformatstring(text)("resolving %s... (esc to abort)", name);
     show_out_of_renderloop_progress(0, text);
 
+    resolverquery(name);
     SDL_LockMutex(resolvermutex);
-    resolverqueries.add(name);
-    SDL_CondSignal(querycond);
     int starttime = SDL_GetTicks(), timeout = 0;
-    bool resolved = false;
+    bool done = false, resolved = false;
     for(;;)
     {
         SDL_CondWaitTimeout(resultcond, resolvermutex, 250);
@@ -165,10 +270,11 @@ bool resolverwait(const char *name, ENetAddress *address)
         {
             address->host = resolverresults[i].address.host;
             resolverresults.remove(i);
-            resolved = true;
+            resolved = address->host != ENET_HOST_ANY;
+            done = true;
             break;
         }
-        if(resolved) break;
+        if(done) break;
 
         timeout = SDL_GetTicks() - starttime;
         show_out_of_renderloop_progress(min(float(timeout)/RESOLVERLIMIT, 1.0f), text);
@@ -180,13 +286,14 @@ bool resolverwait(const char *name, ENetAddress *address)
 
         if(timeout > RESOLVERLIMIT) break;
     }
-    if(!resolved && timeout > RESOLVERLIMIT)
+    if(!done)
     {
         loopv(resolverthreads)
         {
-            resolverthread &rt = resolverthreads[i];
+            resolverthread &rt = *resolverthreads[i];
             if(rt.query == name) { resolverstop(rt); break; }
         }
+        loopv(resolverqueries) if(resolverqueries[i].query == name) { resolverqueries.remove(i); break; }
     }
     SDL_UnlockMutex(resolvermutex);
     return resolved;
@@ -283,10 +390,26 @@ vector<serverinfo *> servers;
 ENetSocket pingsock = ENET_SOCKET_NULL;
 int lastinfo = 0;
 
+hashtable<ENetAddress, serverinfo *> serverindex(1<<10);     // by ping address, to match pongs
+
+static void indexserver(serverinfo *si)
+{
+    if(si->address.host != ENET_HOST_ANY && !serverindex.access(si->address)) serverindex[si->address] = si;
+}
+
+static void unindexserver(serverinfo *si)
+{
+    serverinfo **s = serverindex.access(si->address);
+    if(!s || *s != si) return;
+    serverindex.remove(si->address);
+    loopv(servers) if(servers[i] != si && htcmp(servers[i]->address, si->address)) { serverindex[si->address] = servers[i]; break; } // (different names for the same server)
+}
+
 serverinfo *findserverinfo(ENetAddress address)
 {
-    loopv(servers) if(servers[i]->address.host == address.host && servers[i]->port == address.port) return servers[i];
-    return NULL;
+    address.port = CUBE_SERVINFO_PORT(address.port);
+    serverinfo **si = serverindex.access(address);
+    return si ? *si : NULL;
 }
 
 serverinfo *getconnectedserverinfo()
@@ -313,6 +436,7 @@ static serverinfo *newserver(const char *name, uint ip = ENET_HOST_ANY, int port
     si->port = port;
 
     servers.insert(0, si);
+    indexserver(si);
 
     return si;
 }
@@ -323,14 +447,50 @@ void addserver(const char *servername, int serverport, int weight)
 
     loopv(servers) if(strcmp(servers[i]->name, servername)==0 && servers[i]->port == serverport) return;
 
-    newserver(servername, ENET_HOST_ANY, serverport, weight);
+    enet_uint32 ip;
+    const char *ipend = atoip(servername, &ip);
+    if(ipend && !*ipend)
+    {   // numeric addresses (all entries from the master) need no lookup
+        newserver(servername, ENET_HOST_TO_NET_32(ip), serverport, weight);
+        return;
+    }
+    serverinfo *si = newserver(servername, ENET_HOST_ANY, serverport, weight);
+    if(si && !isdedicated)
+    {   // start resolving right away (favourites from the config), not when the server browser is opened
+        si->resolved = serverinfo::RESOLVING;
+        resolverquery(si->name);
+    }
+}
+
+void delserver(const char *servername, int serverport)
+{
+    if(serverport <= 0) serverport = CUBE_DEFAULT_SERVER_PORT;
+
+    serverinfo *curserver = getconnectedserverinfo();
+    loopv(servers) if(strcmp(servers[i]->name, servername)==0 && servers[i]->port == serverport)
+    {
+        serverinfo *si = servers[i];
+        if(si == curserver) return;
+        if(si->resolved == serverinfo::RESOLVING)
+        {   // pending queries refer to the name by pointer
+            resolverclear();
+            loopvj(servers) if(servers[j]->resolved == serverinfo::RESOLVING) servers[j]->resolved = serverinfo::UNRESOLVED;
+        }
+        unindexserver(si);
+        delete servers.remove(i);
+        return;
+    }
 }
 
 VARP(servpingrate, 1000, 5000, 60000);
 VARP(maxservpings, 0, 10, 1000);
 VAR(searchlan, 0, 1, 2);
 
-#define PINGBUFSIZE 100
+#define PINGTICK 20         // the server list is pinged in small batches every PINGTICK ms, spread over servpingrate
+#define PINGTIMEOUT 5000    // pongs arriving later than this are still accepted, but don't update the ping time
+#define PINGBUFSIZE (2 * PINGTIMEOUT / PINGTICK)    // one send time per tick; each is kept for half the ring
+#define PINGBATCH 32        // pings (pongs) per sendmmsg (recvmmsg) call
+#define PINGLEN 16
 static int pingbuf[PINGBUFSIZE], curpingbuf = 0;
 
 int chooseextping(serverinfo *si)
@@ -340,6 +500,43 @@ int chooseextping(serverinfo *si)
     return EXTPING_NOP;
 }
 
+static void sendpingbatch(ENetAddress *addrs, uchar (*pings)[PINGLEN], int *lens, int n)
+{
+#ifdef SB_MMSG
+    mmsghdr msgs[PINGBATCH];
+    iovec iovs[PINGBATCH];
+    sockaddr_in sas[PINGBATCH];
+    loopi(n)
+    {
+        memset(&sas[i], 0, sizeof(sas[i]));
+        sas[i].sin_family = AF_INET;
+        sas[i].sin_addr.s_addr = addrs[i].host;
+        sas[i].sin_port = htons(addrs[i].port);
+        iovs[i].iov_base = pings[i];
+        iovs[i].iov_len = lens[i];
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &sas[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(sas[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for(int sent = 0; sent < n;)
+    {
+        int res = sendmmsg(pingsock, &msgs[sent], n - sent, MSG_DONTWAIT);
+        if(res <= 0) break; // lost pings are repeated next round anyway
+        sent += res;
+    }
+#else
+    ENetBuffer buf;
+    loopi(n)
+    {
+        buf.data = pings[i];
+        buf.dataLength = lens[i];
+        enet_socket_send(pingsock, &addrs[i], &buf, 1);
+    }
+#endif
+}
+
 void pingservers(bool issearch, serverinfo *onlyconnected)
 {
     if(pingsock == ENET_SOCKET_NULL)
@@ -360,7 +557,7 @@ void pingservers(bool issearch, serverinfo *onlyconnected)
     pingbuf[(curpingbuf + PINGBUFSIZE / 2) % PINGBUFSIZE] = 0;
     pingbuf[curpingbuf] = onlyconnected ? 0 : totalmillis;
     putint(p, curpingbuf + 1); // offset by 1 to avoid extinfo trigger
-    int baselen = p.length();
+    int baselen = p.length(), round = servpingrate * (issearch ? 2 : 1);
     if(onlyconnected)
     {
         serverinfo *si = onlyconnected;
@@ -380,22 +577,37 @@ void pingservers(bool issearch, serverinfo *onlyconnected)
     }
     else if(searchlan < 2)
     {
+        // every server once per round, paced evenly over the round: bursts of pings overflow socket buffers
+        // and uplinks (ours and the servers' ping limiters) and make us lose the pongs
         static int lastping = 0;
-        if(lastping >= servers.length()) lastping = 0;
-        loopi(maxservpings ? min(servers.length(), maxservpings) : servers.length())
+        static tokenbucket pingtokens;
+        int rate = max(1, (servers.length() * 1000 + round - 1) / round), burst = maxservpings ? maxservpings : max(1, rate * PINGTICK / 500);
+        ENetAddress addrs[PINGBATCH];
+        uchar pings[PINGBATCH][PINGLEN];
+        int lens[PINGBATCH], batched = 0;
+        for(int tries = servers.length(); tries > 0 && pingtokens.allow(totalmillis, rate, burst); tries--)
         {
-            serverinfo &si = *servers[lastping];
-            if(++lastping >= servers.length()) lastping = 0;
+            if(lastping >= servers.length()) lastping = 0;
+            serverinfo &si = *servers[lastping++];
             if(si.address.host == ENET_HOST_ANY) continue;
-            p.len = baselen;
-            putint(p, issearch ? EXTPING_NAMELIST : chooseextping(&si));
-            buf.data = ping;
-            buf.dataLength = p.length();
-            enet_socket_send(pingsock, &si.address, &buf, 1);
+            ucharbuf q(pings[batched], PINGLEN);
+            putint(q, curpingbuf + 1);
+            putint(q, issearch ? EXTPING_NAMELIST : chooseextping(&si));
+            addrs[batched] = si.address;
+            lens[batched] = q.length();
+            pingtokens.charge();
+            if(++batched == PINGBATCH)
+            {
+                sendpingbatch(addrs, pings, lens, batched);
+                batched = 0;
+            }
         }
+        if(batched) sendpingbatch(addrs, pings, lens, batched);
     }
-    if(searchlan && !onlyconnected)
+    static int lastbroadcast = 0;
+    if(searchlan && !onlyconnected && (!lastbroadcast || totalmillis - lastbroadcast >= round))
     {
+        lastbroadcast = totalmillis;
         ENetAddress address;
         address.host = ENET_HOST_BROADCAST;
         address.port = CUBE_SERVINFO_PORT_LAN;
@@ -434,6 +646,7 @@ void checkresolver()
             {
                 si.resolved = serverinfo::RESOLVED;
                 si.address.host = addr.host;
+                indexserver(&si);
                 addr.host = ENET_HOST_ANY;
                 break;
             }
@@ -443,195 +656,224 @@ void checkresolver()
 
 #define MAXINFOLINELEN 100  // including color codes
 
-void checkpings()
+static void parsepong(const ENetAddress &addr, uchar *ping, int len)
 {
-    if(pingsock == ENET_SOCKET_NULL) return;
-    enet_uint32 events = ENET_SOCKET_WAIT_RECEIVE;
-    ENetBuffer buf;
-    ENetAddress addr;
-    static uchar ping[MAXTRANS];
     static char text[MAXTRANS];
-    buf.data = ping;
-    buf.dataLength = sizeof(ping);
-    while(enet_socket_wait(pingsock, &events, 0) >= 0 && events)
-    {
-        int len = enet_socket_receive(pingsock, &addr, &buf, 1);
-        if(len <= 0) return;
-        serverinfo *si = NULL;
-        loopv(servers) if(addr.host == servers[i]->address.host && addr.port == servers[i]->address.port)
-        {
-            si = servers[i];
+    serverinfo **known = serverindex.access(addr), *si = known ? *known : NULL;
+    if(!si && searchlan) si = newserver(NULL, addr.host, CUBE_SERVINFO_TO_SERV_PORT(addr.port));
+    if(!si) return;
+
+    ucharbuf p(ping, len);
+    si->lastpingmillis = totalmillis;
+    int pingtm = pingbuf[uint(getint(p) - 1) % PINGBUFSIZE];
+    if(pingtm) si->ping = totalmillis - pingtm;
+    int query = getint(p);
+    switch(query)
+    { // cleanup additional query info
+        case EXTPING_SERVERINFO:
+            loopi(2) getint(p);
             break;
-        }
-        if(!si && searchlan) si = newserver(NULL, addr.host, CUBE_SERVINFO_TO_SERV_PORT(addr.port));
-        if(!si) continue;
-
-        ucharbuf p(ping, len);
-        si->lastpingmillis = totalmillis;
-        int pingtm = pingbuf[(getint(p) - 1) % PINGBUFSIZE];
-        if(pingtm) si->ping = totalmillis - pingtm;
-        int query = getint(p);
-        switch(query)
-        { // cleanup additional query info
-            case EXTPING_SERVERINFO:
-                loopi(2) getint(p);
-                break;
-        }
-        si->protocol = getint(p);
-        if(si->protocol!=PROTOCOL_VERSION) si->ping = 9998;
-        si->mode = getint(p);
-        si->numplayers = getint(p);
-        si->minremain = getint(p);
-        getstring(text, p);
-        filtertext(si->map, behindpath(text), FTXT__MAPNAME);
-        getstring(text, p);
-        filtertext(si->sdesc, text, FTXT__SERVDESC);
-        copystring(si->description, si->sdesc);
-        si->maxclients = getint(p);
-        if(p.remaining())
+    }
+    si->protocol = getint(p);
+    if(si->protocol!=PROTOCOL_VERSION) si->ping = 9998;
+    si->mode = getint(p);
+    si->numplayers = getint(p);
+    si->minremain = getint(p);
+    getstring(text, p);
+    filtertext(si->map, behindpath(text), FTXT__MAPNAME);
+    getstring(text, p);
+    filtertext(si->sdesc, text, FTXT__SERVDESC);
+    copystring(si->description, si->sdesc);
+    si->maxclients = getint(p);
+    if(p.remaining())
+    {
+        si->pongflags = getint(p);
+        if(p.remaining() && getint(p) == query)
         {
-            si->pongflags = getint(p);
-            if(p.remaining() && getint(p) == query)
+            switch(query)
             {
-                switch(query)
+                #define RESETINFOLINES() si->infotexts.setsize(0);   \
+                                         ucharbuf q(si->textdata, sizeof(si->textdata))
+                #define ADDINFOLINE(msg) si->infotexts.add((char *)si->textdata + q.length()); \
+                                         sendstring(msg, q)
+                case EXTPING_NAMELIST:
                 {
-                    #define RESETINFOLINES() si->infotexts.setsize(0);   \
-                                             ucharbuf q(si->textdata, sizeof(si->textdata))
-                    #define ADDINFOLINE(msg) si->infotexts.add((char *)si->textdata + q.length()); \
-                                             sendstring(msg, q)
-                    case EXTPING_NAMELIST:
+                    si->playernames.setsize(0);
+                    ucharbuf q(si->namedata, sizeof(si->namedata));
+                    loopi(si->numplayers)
                     {
-                        si->playernames.setsize(0);
-                        ucharbuf q(si->namedata, sizeof(si->namedata));
-                        loopi(si->numplayers)
+                        getstring(text, p);
+                        filtertext(text, text, FTXT__PLAYERNAME);
+                        if(text[0] && !p.overread())
                         {
-                            getstring(text, p);
-                            filtertext(text, text, FTXT__PLAYERNAME);
-                            if(text[0] && !p.overread())
-                            {
-                                si->playernames.add((const char *)si->namedata + q.length());
-                                sendstring(text, q);
-                            }
-                            else break;
+                            si->playernames.add((const char *)si->namedata + q.length());
+                            sendstring(text, q);
                         }
+                        else break;
+                    }
+                    break;
+                }
+                case EXTPING_SERVERINFO:
+                {
+                    RESETINFOLINES();
+                    getstring(text, p);
+                    if(strlen(text) != 2)
+                    {
+                        ADDINFOLINE("this server does not provide additional information");
                         break;
                     }
-                    case EXTPING_SERVERINFO:
+                    strcpy(si->lang, text);
+                    while(p.remaining())
                     {
-                        RESETINFOLINES();
                         getstring(text, p);
-                        if(strlen(text) != 2)
+                        if(*text && !p.overread())
                         {
-                            ADDINFOLINE("this server does not provide additional information");
-                            break;
+                            text[MAXINFOLINELEN] = '\0';
+                            cutcolorstring(text, 100);
+                            ADDINFOLINE(strcmp(text, ".") ? text : "");
                         }
-                        strcpy(si->lang, text);
-                        while(p.remaining())
+                        else break;
+                    }
+                    break;
+                }
+                case EXTPING_MAPROT:
+                {
+                    RESETINFOLINES();
+                    int n = getint(p);
+                    ADDINFOLINE("\f1server map rotation:");
+                    ADDINFOLINE("");
+                    while(p.remaining())
+                    {
+                        getstring(text, p);
+                        filtertext(text, behindpath(text), FTXT__MAPNAME);
+                        if(*text && !p.overread())
                         {
-                            getstring(text, p);
-                            if(*text && !p.overread())
-                            {
-                                text[MAXINFOLINELEN] = '\0';
-                                cutcolorstring(text, 100);
-                                ADDINFOLINE(strcmp(text, ".") ? text : "");
-                            }
-                            else break;
+                            text[MAXINFOLINELEN] = '\0';
+                            loopi(n) concatformatstring(text, ", %d", getint(p));
+                            ADDINFOLINE(text );
                         }
-                        break;
+                        else break;
                     }
-                    case EXTPING_MAPROT:
+                    break;
+                }
+                case EXTPING_UPLINKSTATS:
+                {
+                    si->uplinkqual_age = totalmillis;
+                    if(si->maxclients > 3)
                     {
-                        RESETINFOLINES();
-                        int n = getint(p);
-                        ADDINFOLINE("\f1server map rotation:");
-                        ADDINFOLINE("");
-                        while(p.remaining())
+                        int maxs = 0, maxc = 0, ts, tc;
+                        loopi(si->maxclients - 3)
                         {
-                            getstring(text, p);
-                            filtertext(text, behindpath(text), FTXT__MAPNAME);
-                            if(*text && !p.overread())
+                            ts = tc = si->uplinkstats[i + 4] = p.get();
+                            if(si->maxclients < 8 || i > 2)
                             {
-                                text[MAXINFOLINELEN] = '\0';
-                                loopi(n) concatformatstring(text, ", %d", getint(p));
-                                ADDINFOLINE(text );
+                                ts &= 0xF0; tc &= 0x0F;
+                                if(ts > maxs) maxs = ts;
+                                if(ts > 0x40 && tc > maxc) maxc = tc;   // spent time = 2 ^ ((ts >> 4) - 1) * 30 sec, so 0x50 is 8..15 minutes
                             }
-                            else break;
                         }
-                        break;
+                        if(maxs < 0x90) maxc -= 2;                  // go easy on fresh started servers
+                        if(maxs < 0x50) si->uplinkqual = 3;
+                        else if(maxc < 3) si->uplinkqual = 5;       // choke_percentage = 1 / 2 ^ (15 - tc), so 0x03 is 0.02%
+                        else if(maxc < 6) si->uplinkqual = 4;       // 0.2%
+                        else if(maxc == 6) si->uplinkqual = 3;
+                        else if(maxc < 9) si->uplinkqual = 2;       // 1.6% (yep, that IS bad)
+                        else si->uplinkqual = 1;
                     }
-                    case EXTPING_UPLINKSTATS:
+                    if(si->getinfo == EXTPING_UPLINKSTATS)
                     {
-                        si->uplinkqual_age = totalmillis;
-                        if(si->maxclients > 3)
+                        RESETINFOLINES();
+                        if(si->maxclients < 4)
                         {
-                            int maxs = 0, maxc = 0, ts, tc;
-                            loopi(si->maxclients - 3)
-                            {
-                                ts = tc = si->uplinkstats[i + 4] = p.get();
-                                if(si->maxclients < 8 || i > 2)
-                                {
-                                    ts &= 0xF0; tc &= 0x0F;
-                                    if(ts > maxs) maxs = ts;
-                                    if(ts > 0x40 && tc > maxc) maxc = tc;   // spent time = 2 ^ ((ts >> 4) - 1) * 30 sec, so 0x50 is 8..15 minutes
-                                }
-                            }
-                            if(maxs < 0x90) maxc -= 2;                  // go easy on fresh started servers
-                            if(maxs < 0x50) si->uplinkqual = 3;
-                            else if(maxc < 3) si->uplinkqual = 5;       // choke_percentage = 1 / 2 ^ (15 - tc), so 0x03 is 0.02%
-                            else if(maxc < 6) si->uplinkqual = 4;       // 0.2%
-                            else if(maxc == 6) si->uplinkqual = 3;
-                            else if(maxc < 9) si->uplinkqual = 2;       // 1.6% (yep, that IS bad)
-                            else si->uplinkqual = 1;
+                            ADDINFOLINE("server is too small for uplink quality statistics");
                         }
-                        if(si->getinfo == EXTPING_UPLINKSTATS)
+                        else
                         {
-                            RESETINFOLINES();
-                            if(si->maxclients < 4)
+                            ADDINFOLINE("\f1server uplink quality and usage statistics:");
+                            ADDINFOLINE("");
+                            ADDINFOLINE("players:\terrors/time");
+                            for(int i = 4; i <= si->maxclients; i++)
                             {
-                                ADDINFOLINE("server is too small for uplink quality statistics");
-                            }
-                            else
-                            {
-                                ADDINFOLINE("\f1server uplink quality and usage statistics:");
-                                ADDINFOLINE("");
-                                ADDINFOLINE("players:\terrors/time");
-                                for(int i = 4; i <= si->maxclients; i++)
-                                {
-                                    defformatstring(msg)("   %d\t", i);
-                                    loopj(15) concatformatstring(msg, "\a%c ", '0' + ((si->uplinkstats[i] & 0x0F) > j) + 2 * ((si->uplinkstats[i] & 0xF0) > (j << 4)));
-                                    concatformatstring(msg, "\t\t [%02X]", si->uplinkstats[i]);
-                                    ADDINFOLINE(msg);
-                                }
-                                ADDINFOLINE("");
-                                ADDINFOLINE("\f4red bar: error rate, green bar: time played");
+                                defformatstring(msg)("   %d\t", i);
+                                loopj(15) concatformatstring(msg, "\a%c ", '0' + ((si->uplinkstats[i] & 0x0F) > j) + 2 * ((si->uplinkstats[i] & 0xF0) > (j << 4)));
+                                concatformatstring(msg, "\t\t [%02X]", si->uplinkstats[i]);
+                                ADDINFOLINE(msg);
                             }
+                            ADDINFOLINE("");
+                            ADDINFOLINE("\f4red bar: error rate, green bar: time played");
                         }
-                        break;
                     }
-                    #undef RESETINFOLINES
-                    #undef ADDINFOLINE
+                    break;
                 }
+                #undef RESETINFOLINES
+                #undef ADDINFOLINE
             }
         }
-        else
+    }
+    else
+    {
+        si->pongflags = 0;
+    }
+    if(si->getinfo == query) si->getinfo = EXTPING_NOP;
+    if(si->pongflags > 0)
+    {
+        const char *sp = "";
+        int mm = si->pongflags >> PONGFLAG_MASTERMODE;
+        if(si->pongflags & (1 << PONGFLAG_BANNED))
+            sp = "you are banned from this server";
+        if(si->pongflags & (1 << PONGFLAG_BLACKLIST))
+            sp = "you are blacklisted on this server";
+        else if(si->pongflags & (1 << PONGFLAG_PASSWORD))
+            sp = "this server is password-protected";
+        else if(mm) sp = mmfullname(mm);
+        formatstring(si->description)("%s  \f1(%s)", si->sdesc, sp);
+    }
+}
+
+void checkpings()
+{
+    if(pingsock == ENET_SOCKET_NULL) return;
+    static uchar pongs[PINGBATCH][MAXTRANS];
+#ifdef SB_MMSG
+    static mmsghdr msgs[PINGBATCH];
+    static iovec iovs[PINGBATCH];
+    static sockaddr_in addrs[PINGBATCH];
+    for(;;)
+    {
+        loopi(PINGBATCH)
         {
-            si->pongflags = 0;
+            iovs[i].iov_base = pongs[i];
+            iovs[i].iov_len = sizeof(pongs[i]);
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
         }
-        if(si->getinfo == query) si->getinfo = EXTPING_NOP;
-        if(si->pongflags > 0)
+        int n = recvmmsg(pingsock, msgs, PINGBATCH, MSG_DONTWAIT, NULL);
+        if(n <= 0) break;
+        loopi(n) if(msgs[i].msg_len > 0)
         {
-            const char *sp = "";
-            int mm = si->pongflags >> PONGFLAG_MASTERMODE;
-            if(si->pongflags & (1 << PONGFLAG_BANNED))
-                sp = "you are banned from this server";
-            if(si->pongflags & (1 << PONGFLAG_BLACKLIST))
-                sp = "you are blacklisted on this server";
-            else if(si->pongflags & (1 << PONGFLAG_PASSWORD))
-                sp = "this server is password-protected";
-            else if(mm) sp = mmfullname(mm);
-            formatstring(si->description)("%s  \f1(%s)", si->sdesc, sp);
+            ENetAddress addr;
+            addr.host = addrs[i].sin_addr.s_addr;
+            addr.port = ntohs(addrs[i].sin_port);
+            parsepong(addr, pongs[i], msgs[i].msg_len);
         }
+        if(n < PINGBATCH) break;
+    }
+#else
+    enet_uint32 events = ENET_SOCKET_WAIT_RECEIVE;
+    ENetBuffer buf;
+    ENetAddress addr;
+    buf.data = pongs[0];
+    buf.dataLength = sizeof(pongs[0]);
+    while(enet_socket_wait(pingsock, &events, 0) >= 0 && events)
+    {
+        int len = enet_socket_receive(pingsock, &addr, &buf, 1);
+        if(len <= 0) return;
+        parsepong(addr, pongs[0], len);
     }
+#endif
 }
 
 enum { SBS_PING = 0, SBS_NUMPL, SBS_MAXPL, SBS_MINREM, SBS_MAP, SBS_MODE, SBS_IP, SBS_DESC, NUMSERVSORT };
@@ -721,6 +963,25 @@ int sicompare(serverinfo **ap, serverinfo **bp)
     else return -dir;
 }
 
+#define SORTINSERTLIMIT 32
+
+void sortservers()
+{
+    // the list is resorted every frame, but only a few servers change their place in between (pongs arrive spread
+    // over the ping round): an insertion sort handles that in about linear time, qsort only gets real reorders
+    int unsorted = 0;
+    for(int i = 1; i < servers.length(); i++) if(sicompare(&servers[i], &servers[i - 1]) < 0) unsorted++;
+    if(!unsorted) return;
+    if(unsorted > SORTINSERTLIMIT) { servers.sort(sicompare); return; }
+    for(int i = 1; i < servers.length(); i++)
+    {
+        serverinfo *si = servers[i];
+        int j = i;
+        for(; j > 0 && sicompare(&si, &servers[j - 1]) < 0; j--) servers[j] = servers[j - 1];
+        servers[j] = si;
+    }
+}
+
 void *servmenu = NULL, *searchmenu = NULL, *serverinfomenu = NULL;
 vector<char *> namelists;
 
@@ -967,8 +1228,11 @@ void refreshservers(void *menu, bool init)
     {
         loopi(PINGBUFSIZE) if(pingbuf[i] < totalmillis) pingbuf[i] = 0;
         if(resolverthreads.empty()) resolverinit();
-        else resolverclear();
-        loopv(servers) resolverquery(servers[i]->name);
+        loopv(servers) if(servers[i]->address.host == ENET_HOST_ANY && servers[i]->resolved != serverinfo::RESOLVING)
+        {   // retry failed lookups (the dns cache remembers failures for a while)
+            servers[i]->resolved = serverinfo::RESOLVING;
+            resolverquery(servers[i]->name);
+        }
         servermenumillis = totalmillis;
         usedselect = false;
         if(menu && curserver) oldsel = curserver;
@@ -1011,8 +1275,9 @@ void refreshservers(void *menu, bool init)
         if(*infotext) menuitemmanual(menu, infotext);
         return;
     }
-    if((init && issearch) || totalmillis - lastinfo >= (servpingrate * (issearch ? 2 : 1))/(maxservpings ? max(1, (servers.length() + maxservpings - 1) / maxservpings) : 1))
-        pingservers(issearch, isscoreboard ? curserver : NULL);
+    serverinfo *pingonly = isscoreboard ? curserver : NULL;
+    if((init && issearch) || totalmillis - lastinfo >= (pingonly ? servpingrate : PINGTICK))
+        pingservers(issearch, pingonly);
     if(!init && menu)// && servers.inrange(((gmenu *)menu)->menusel))
     {
         serverinfo *foundserver = NULL;
@@ -1027,7 +1292,7 @@ void refreshservers(void *menu, bool init)
 
     bool showfavtag = (assignserverfavourites() || !serverbrowserhidefavtag) && serverbrowserhidefavtag != 2;
     serversortprepare();
-    servers.sort(sicompare);
+    sortservers();
     if(menu)
     {
         bool showmr = showminremain || serversort == SBS_MINREM;
@@ -1296,13 +1561,20 @@ bool serverinfokey(void *menu, int code, bool isdown)
     return false;
 }
 
+static int serverlistversion = 0; // last server list version received from the master (TCP direct only)
+static uint serverlistepoch = 0;  // master instance that version belongs to
+
 void clearservers()
 {
+    serverlistversion = 0;
+    serverlistepoch = 0;
     resolverclear();
+    serverindex.clear();
     servers.deletecontents();
 }
 
 #define RETRIEVELIMIT 5000
+#define SERVERLISTLIMIT (1 << 20)   // max size of an unpacked server list
 
 extern char *global_name;
 bool cllock = false, clfail = false;
@@ -1316,6 +1588,36 @@ int progress_callback_retrieveservers(void *data, float progress)
 
 VARP(mastertype, 0, 1, 1); // 0: TCP direct, 1: HTTP proxy
 
+// unpack a "serverlist <version> <epoch> <full|changes> <gz> <length>" response, returns -1 on error, 0 for a complete list and 1 for changes since serverlistversion
+int unpackserverlist(vector<char> &data, int &version, uint &epoch)
+{
+    version = 0;
+    epoch = 0;
+    if(strncmp(data.getbuf(), "serverlist ", 11)) return 0;
+    const char *body = strchr(data.getbuf(), '\n');
+    int gz, len;
+    string kind;
+    if(!body || sscanf(data.getbuf(), "serverlist %d %u %259s %d %d", &version, &epoch, kind, &gz, &len) != 5 || len < 0) return -1;
+    bool changes = !strcmp(kind, "changes");
+    if(changes && (epoch != serverlistepoch || !serverlistversion)) return -1;   // changes to a list we don't have
+    body++;
+    int bodylen = data.length() - 1 - int(body - data.getbuf()); // without terminating '\0'
+    if(len > SERVERLISTLIMIT || (!gz && bodylen != len)) return -1;  // don't trust the header with the allocation
+    vector<char> list;
+    list.reserve(len + 1);
+    if(gz)
+    {
+        uLongf rawlen = len;
+        if(uncompress((Bytef *)list.getbuf(), &rawlen, (const Bytef *)body, bodylen) != Z_OK || int(rawlen) != len) return -1;
+    }
+    else memcpy(list.getbuf(), body, len);
+    list.advance(len);
+    list.add('\0');
+    data.setsize(0);
+    data.put(list.getbuf(), list.length());
+    return changes ? 1 : 0;
+}
+
 void retrieveservers(vector<char> &data)
 {
     if(mastertype)
@@ -1356,7 +1658,7 @@ void retrieveservers(vector<char> &data)
         defformatstring(text)("retrieving servers from %s:%d... (esc to abort)", mastername, masterport);
         show_out_of_renderloop_progress(0, text);
         int starttime = SDL_GetTicks(), timeout = 0;
-        defformatstring(request)("list %s %d %d\n", global_name, AC_VERSION, getbuildtype());
+        defformatstring(request)("list %s %d %d 1 %d %u\n", global_name, AC_VERSION, getbuildtype(), serverlistversion, serverlistepoch);
         const char *req = request;
         int reqlen = strlen(req);
         ENetBuffer buf;
@@ -1389,6 +1691,11 @@ void retrieveservers(vector<char> &data)
                 int recv = enet_socket_receive(sock, NULL, &buf, 1);
                 if(recv <= 0) break;
                 data.advance(recv);
+                if(data.length() > SERVERLISTLIMIT + MAXSTRLEN)
+                {
+                    data.setsize(0);    // no sane reply is that big
+                    break;
+                }
             }
             timeout = SDL_GetTicks() - starttime;
             show_out_of_renderloop_progress(min(float(timeout)/RETRIEVELIMIT, 1.0f), text);
@@ -1424,18 +1731,38 @@ void updatefrommaster(int *force)
         string curname;
         if(curserver) copystring(curname, curserver->name);
 
-        clearservers();
-        if(!strncmp(data.getbuf(), "addserver", 9)) cllock = false; // the ms could reply other thing... but currently, this is useless
-        if(!cllock )
+        int version;
+        uint epoch;
+        int listtype = unpackserverlist(data, version, epoch);
+        if(listtype < 0)
         {
+            conoutf("\f3received a broken server list");
+            serverlistversion = 0;
+        }
+        else if(listtype > 0)
+        {   // only what changed since the last update
+            cllock = false;
             execute(data.getbuf());
-            if(curserver) addserver(curname, curserver->port, curserver->msweight);
+            serverlistversion = version;
+        }
+        else
+        {
+            clearservers();
+            if(!strncmp(data.getbuf(), "addserver", 9) || !data[0]) cllock = false; // the ms could reply other thing... but currently, this is useless
+            if(!cllock )
+            {
+                execute(data.getbuf());
+                if(curserver) addserver(curname, curserver->port, curserver->msweight);
+                serverlistversion = version;
+                serverlistepoch = epoch;
+            }
         }
         lastupdate = totalmillis;
     }
 }
 
 COMMANDF(addserver, "sii", (char *n, int *p, int *w) { addserver(n, *p, *w); });
+COMMANDF(delserver, "si", (char *n, int *p) { delserver(n, *p); });
 COMMAND(clearservers, "");
 COMMAND(updatefrommaster, "i");
 
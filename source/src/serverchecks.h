@@ -525,6 +525,66 @@ void check_afk()
     }
 }
 
+#define CPUCOSTINTERVAL 5000
+int last_cpucost_check = 0;
+
+/* measures the server cpu time per client (process() and game events): modified clients may flood
+   cheap-looking messages, which are expensive to handle - optionally, such clients are kicked */
+void check_cpucost()
+{
+    int elapsed = servmillis - last_cpucost_check, windowstart = last_cpucost_check;
+    last_cpucost_check = servmillis;
+    loopv(clients)
+    {
+        client &c = *clients[i];
+        if(c.type != ST_TCPIP) continue;
+        double total = c.cost.total();
+        c.costrate = int((total - c.lastcost) * 1000 / max(elapsed, 1));
+        c.lastcost = total;
+        if(scl.cpukick && c.costrate > scl.cpukick && c.role != CR_ADMIN && c.connectmillis < windowstart)  // (the connect handshake is not counted)
+        {
+            logline(ACLOG_INFO, "[%s] %s kicked for excessive server cpu usage (%d us/s, mostly %s)", c.hostname, c.name, c.costrate, msgprofile::name(c.cost.top()));
+            defformatstring(msg)("%s %s", c.name, "kicked for excessive server load");
+            sendservmsg(msg);
+            disconnect_client(c.clientnum, DISC_OVERFLOW);
+        }
+    }
+}
+
+void sendcpucost(int receiver, int cn)
+{
+    if(cn >= 0)
+    {
+        if(!valid_client(cn)) return;
+        client &c = *clients[cn];
+        defformatstring(msg)("%s (%d): %d us/s, %.1f ms total", c.name, cn, c.costrate, c.cost.total() / 1e3);
+        sendservmsg(msg, receiver);
+        double below = 1e300;
+        loopi(5)
+        {
+            int m = c.cost.top(below);
+            if(m < 0) break;
+            formatstring(msg)("  %s: %d x, %.1f ms", msgprofile::name(m), c.cost.count[m], c.cost.usecs[m] / 1e3);
+            sendservmsg(msg, receiver);
+            below = c.cost.usecs[m];
+        }
+    }
+    else loopv(clients)
+    {
+        client &c = *clients[i];
+        if(c.type != ST_TCPIP) continue;
+        defformatstring(msg)("%s (%d): %d us/s, mostly %s", c.name, i, c.costrate, msgprofile::name(c.cost.top()));
+        sendservmsg(msg, receiver);
+    }
+}
+
+void logcpucost()
+{
+    client *worst = NULL;
+    loopv(clients) if(clients[i]->type == ST_TCPIP && (!worst || clients[i]->costrate > worst->costrate)) worst = clients[i];
+    if(worst) logline(ACLOG_VERBOSE, "highest server cpu usage: [%s] %s, %d us/s, mostly %s", worst->hostname, worst->name, worst->costrate, msgprofile::name(worst->cost.top()));
+}
+
 /** This function counts how much non-killing-damage the player does to any teammates
     The damage limit is 100 hp per minute, which is about 2 tks per minute in a normal game
     In normal games, the players go over 6 tks only in the worst cases */
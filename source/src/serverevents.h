@@ -12,14 +12,15 @@ void processevent(client *c, explodeevent &e)
         default:
             return;
     }
-    for(int i = 1; i<c->events.length() && c->events[i].type==GE_HIT; i++)
+    hiteventiterator hits(c->events);
+    while(hitevent *hp = hits.next())
     {
-        hitevent &h = c->events[i].hit;
+        hitevent &h = *hp;
         if(!clients.inrange(h.target)) continue;
         client *target = clients[h.target];
         if(target->type==ST_EMPTY || target->state.state!=CS_ALIVE || h.lifesequence!=target->state.lifesequence || h.dist<0 || h.dist>EXPDAMRAD) continue;
 
-        int j = 1;
+        int i = hits.index(), j = 1;
         for(j = 1; j<i; j++) if(c->events[j].hit.target==h.target) break;
         if(j<i) continue;
 
@@ -61,9 +62,10 @@ void processevent(client *c, shotevent &e)
         {
             int totalrays = 0, maxrays = e.gun==GUN_SHOTGUN ? 3*SGRAYS: 1;
             int tothits_c = 0, tothits_m = 0, tothits_o = 0; // sgrays
-            for(int i = 1; i<c->events.length() && c->events[i].type==GE_HIT; i++)
+            hiteventiterator hits(c->events);
+            while(hitevent *hp = hits.next())
             {
-                hitevent &h = c->events[i].hit;
+                hitevent &h = *hp;
                 if(!clients.inrange(h.target)) continue;
                 client *target = clients[h.target];
                 if(target->type==ST_EMPTY || target->state.state!=CS_ALIVE || h.lifesequence!=target->state.lifesequence) continue;
@@ -156,11 +158,13 @@ void processevent(client *c, akimboevent &e)
 
 void clearevent(client *c)
 {
-    int n = 1;
-    while(n<c->events.length() && c->events[n].type==GE_HIT) n++;
-    c->events.remove(0, n);
+    hiteventiterator hits(c->events);
+    while(hits.next());
+    c->events.skip(hits.index() + 1);
 }
 
+static const int eventmsgtypes[] = { SV_NUM, SV_SHOOT, SV_EXPLODE, SV_SHOOT, SV_AKIMBO, SV_RELOAD, SV_SUICIDE, SV_ITEMPICKUP };   // cost accounting: GE_* -> message which caused the event
+
 void processevents()
 {
     loopv(clients)
@@ -177,6 +181,8 @@ void processevents()
                 if(e.shot.millis<c->lastevent) { clearevent(c); continue; }
                 c->lastevent = e.shot.millis;
             }
+            int costtype = eventmsgtypes[e.type];
+            double start = msgprofile::now();
             switch(e.type)
             {
                 case GE_SHOT: processevent(c, e.shot); break;
@@ -188,6 +194,7 @@ void processevents()
                 case GE_PICKUP: processevent(c, e.pickup); break;
             }
             clearevent(c);
+            c->cost.usecs[costtype] += msgprofile::now() - start;
         }
     }
 }
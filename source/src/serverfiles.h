@@ -43,13 +43,60 @@ struct servermap  // in-memory version of a map file on a server
     char maptitle[129];
     #endif
 
-    servermap(const char *mname, const char *mpath) { memset(&fname, 0, sizeof(struct servermap)); fname = newstring(mname); fpath = mpath; }
+    int lastused;                   // servmillis of the last access (least recently used maps get evicted first)
+    long swapoffset;                // position of cgzraw, cfgrawgz and layoutgz in the swap file (-1: not written yet)
+    bool evicted;                   // heavy buffers are only available in the swap file
+
+    servermap(const char *mname, const char *mpath) { memset(&fname, 0, sizeof(struct servermap)); fname = newstring(mname); fpath = mpath; swapoffset = -1; }
     ~servermap() { delstring(fname); DELETEA(cgzraw); DELETEA(cfgrawgz); DELETEA(enttypes); DELETEA(entpos_x); DELETEA(entpos_y); DELETEA(layoutgz); }
 
     bool isro() { return fpath == servermappath_off || fpath == servermappath_serv; }
     bool isofficial() { return fpath == servermappath_off; }
 
-    int getmemusage() { return sizeof(struct servermap) + cgzlen + cfggzlen + layoutgzlen + numents * (sizeof(uchar) + sizeof(short) * 3); }
+    int getheavymemusage() { return evicted ? 0 : cgzlen + cfggzlen + layoutgzlen; }
+    int getmemusage() { return sizeof(struct servermap) + getheavymemusage() + numents * (sizeof(uchar) + sizeof(short) * 3); }
+
+    bool evict(stream *swap)  // drop the heavy buffers from memory (they are written to the swap file only once, since they never change)
+    {
+        if(evicted || !isok || !swap) return false;
+        if(swapoffset < 0)
+        {
+            if(!swap->seek(0, SEEK_END)) return false;
+            long pos = swap->tell();
+            if(pos < 0 || swap->write(cgzraw, cgzlen) != cgzlen || swap->write(cfgrawgz, cfggzlen) != cfggzlen || swap->write(layoutgz, layoutgzlen) != layoutgzlen) return false;
+            swapoffset = pos;
+        }
+        DELETEA(cgzraw);
+        DELETEA(cfgrawgz);
+        DELETEA(layoutgz);
+        evicted = true;
+        return true;
+    }
+
+    bool reload(stream *swap)  // fetch evicted buffers back from the swap file
+    {
+        if(!evicted) return true;
+        if(!swap || !swap->seek(swapoffset, SEEK_SET)) return false;
+        uchar *cgz = new uchar[cgzlen], *cfg = cfggzlen ? new uchar[cfggzlen] : NULL, *lgz = new uchar[layoutgzlen], h[TIGERHASHSIZE];
+        bool ok = swap->read(cgz, cgzlen) == cgzlen && swap->read(cfg, cfggzlen) == cfggzlen && swap->read(lgz, layoutgzlen) == layoutgzlen;
+        if(ok)
+        {
+            tigerhash(h, cgz, cgzlen);
+            ok = !memcmp(h, cgzhash, TIGERHASHSIZE);  // paranoia: verify the swapped map before we use it again
+        }
+        if(!ok)
+        {
+            delete[] cgz;
+            DELETEA(cfg);
+            delete[] lgz;
+            return false;
+        }
+        cgzraw = cgz;
+        cfgrawgz = cfg;
+        layoutgz = lgz;
+        evicted = false;
+        return true;
+    }
 
     void load(void)  // load map into memory and extract everything important about it  (assumes struct to be zeroed: can only be called once)
     {
@@ -64,15 +111,19 @@ struct servermap  // in-memory version of a map file on a server
         defformatstring(filename)("%s%s.cfg", fpath, fname);
         path(filename);
         uchar *cfgraw = (uchar *)loadfile(filename, &cfglen);
-        if(cfgraw)
-        {
-            tigerhash(cfghash, cfgraw, cfglen);
-            loopk(cfglen) if(cfgraw[k] > 0x7f || (cfgraw[k] < 0x20 && !isspace(cfgraw[k]))) err = "illegal chars in cfg file";
-        }
+        if(cfgraw) loopk(cfglen) if(cfgraw[k] > 0x7f || (cfgraw[k] < 0x20 && !isspace(cfgraw[k]))) err = "illegal chars in cfg file";
         formatstring(filename)("%s%s.cgz", fpath, fname);
         path(filename);
         cgzraw = (uchar *)loadfile(filename, &cgzlen);
-        if(cgzraw) tigerhash(cgzhash, cgzraw, cgzlen);
+        if(cfgraw && cgzraw)
+        { // hash both files side by side
+            uchar *hashes[2] = { cfghash, cgzhash };
+            const uchar *msgs[2] = { cfgraw, cgzraw };
+            int lens[2] = { cfglen, cgzlen };
+            tigerhash_multi(hashes, msgs, lens, 2);
+        }
+        else if(cfgraw) tigerhash(cfghash, cfgraw, cfglen);
+        else if(cgzraw) tigerhash(cgzhash, cgzraw, cgzlen);
         if(!cgzraw) err = "loading cgz failed";
         else if(cfglen > MAXCFGFILESIZE) err = "cfg file too big";
         else if(cgzlen >= MAXMAPSENDSIZE) err = "cgz file too big";
@@ -294,7 +345,7 @@ struct servermap  // in-memory version of a map file on a server
         // run mipmapper (to get corners right)
 
 
-        // calculate area statistics from type & vdelta values (destroys vdelta!)
+        // calculate area statistics from type & vdelta values
         {
             if(calcmapareastats(areastats, (servsqr *)staticbuffer, 1 << sfactor, mapdims) < 0) err = "world layout malformed"; // should be a quite fringe error
         }
@@ -899,6 +950,14 @@ struct servermaprot : serverconfigfile
     startgame(smapname, smode, -1, notify);
     }
 
+    int peeknext() // cheap guess of the next maprot entry (ignores player count restrictions and map checks of next())
+    {
+        int csl = configsets.length(), ccs = curcfgset;
+        if(ccs >= 0 && ccs < csl) ccs += configsets[ccs].skiplines;
+        ccs++;
+        return ccs >= csl || ccs < 0 ? 0 : ccs;
+    }
+
     configset *current() { return configsets.inrange(curcfgset) ? &configsets[curcfgset] : NULL; }
     configset *get(int ccs) { return configsets.inrange(ccs) ? &configsets[ccs] : NULL; }
 };
@@ -1096,13 +1155,14 @@ struct servernickblacklist : serverconfigfile
         if(!idx) return NWL_UNLISTED; // no matching entry
         int i = *idx;
         bool needipr = false, iprok = false, needpwd = false, pwdok = false;
+        vector<const char *> pwds;
         while(i >= 0)
         {
             iprchain &ic = whitelistranges[i];
             if(ic.pwd)
             { // check pwd
                 needpwd = true;
-                if(pwdok || !strcmp(genpwdhash(c.name, ic.pwd, c.salt), c.pwd)) pwdok = true;
+                pwds.add(ic.pwd);
             }
             else
             { // check IP
@@ -1111,6 +1171,7 @@ struct servernickblacklist : serverconfigfile
             }
             i = whitelistranges[i].next;
         }
+        if(needpwd) pwdok = findpwdhash(c.name, pwds.getbuf(), pwds.length(), c.salt, c.pwd) >= 0;
         if(needpwd && !pwdok) return NWL_PWDFAIL; // wrong PWD
         if(needipr && !iprok) return NWL_IPFAIL; // wrong IP
         return NWL_PASS;
@@ -1332,14 +1393,13 @@ struct serverpasswords : serverconfigfile
         }
         passguy = address;
         passtime = servmillis;
-        loopv(adminpwds)
+        vector<const char *> pwds;
+        loopv(adminpwds) pwds.add(adminpwds[i].pwd);
+        int i = findpwdhash(name, pwds.getbuf(), pwds.length(), salt, pwd);
+        if(i >= 0)
         {
-            if(!strcmp(genpwdhash(name, adminpwds[i].pwd, salt), pwd))
-            {
-                if(detail) *detail = adminpwds[i];
-                found = true;
-                break;
-            }
+            if(detail) *detail = adminpwds[i];
+            found = true;
         }
         return found;
     }
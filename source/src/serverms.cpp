@@ -178,6 +178,19 @@ static inline void updatemasterserver(int millis, int port)
 ENetSocket pongsock = ENET_SOCKET_NULL, lansock = ENET_SOCKET_NULL;
 extern int getpongflags(enet_uint32 ip);
 
+// rate limit for server info queries: token buckets per source address and for all sources together
+// one token pays for one reply packet, so queries with big replies (playerstats) can't be used for reflection amplification
+
+#define PINGBUCKETS         1024        // per-source buckets (hashed by address, colliding sources share a bucket)
+#define PINGSOURCERATE      10          // tokens per second per source
+#define PINGSOURCEBURST     40
+#define PINGGLOBALRATE      1000        // tokens per second for all sources
+#define PINGGLOBALBURST     2000
+#define PINGMAXPERSLICE     64          // maximum number of queries read per socket in one server slice
+
+static tokenbucket pingbuckets[PINGBUCKETS], pingglobalbucket;
+int pingsdropped = 0;
+
 void serverms(int mode, int numplayers, int minremain, char *smapname, int millis, const ENetAddress &localaddr, int *mnum, int *msend, int *mrec, int *cnum, int *csend, int *crec, int protocol_version)
 {
     flushmasteroutput();
@@ -211,116 +224,131 @@ void serverms(int mode, int numplayers, int minremain, char *smapname, int milli
         ENetSocket sock = i ? lansock : pongsock;
         if(sock == ENET_SOCKET_NULL || !ENET_SOCKETSET_CHECK(sockset, sock)) continue;
 
-        buf.dataLength = sizeof(data);
-        len = enet_socket_receive(sock, &addr, &buf, 1);
-        if(len < 0) continue;
-
-        // ping & pong buf
-        ucharbuf pi(data, len), po(&data[len], sizeof(data)-len);
-        bool std = false;
-        if(getint(pi) != 0) // std pong
+        loopj(PINGMAXPERSLICE)
         {
-            extern struct servercommandline scl;
-            extern string servdesc_current;
-            (*mnum)++; *mrec += len; std = true;
-            putint(po, protocol_version);
-            putint(po, mode);
-            putint(po, numplayers);
-            putint(po, minremain);
-            sendstring(smapname, po);
-            sendstring(servdesc_current, po);
-            putint(po, scl.maxclients);
-            putint(po, getpongflags(addr.host));
-            if(pi.remaining())
+            buf.dataLength = sizeof(data);
+            len = enet_socket_receive(sock, &addr, &buf, 1);
+            if(len <= 0) break;   // (0: would block)
+
+            tokenbucket &pb = pingbuckets[iphash(addr.host) % PINGBUCKETS];
+            if(!pingglobalbucket.allow(millis, PINGGLOBALRATE, PINGGLOBALBURST) || !pb.allow(millis, PINGSOURCERATE, PINGSOURCEBURST))
             {
-                int query = getint(pi);
-                switch(query)
+                pingsdropped++;
+                continue;
+            }
+
+            // ping & pong buf
+            ucharbuf pi(data, len), po(&data[len], sizeof(data)-len);
+            bool std = false;
+            int packets = 1;
+            if(getint(pi) != 0) // std pong
+            {
+                extern struct servercommandline scl;
+                extern string servdesc_current;
+                (*mnum)++; *mrec += len; std = true;
+                putint(po, protocol_version);
+                putint(po, mode);
+                putint(po, numplayers);
+                putint(po, minremain);
+                sendstring(smapname, po);
+                sendstring(servdesc_current, po);
+                putint(po, scl.maxclients);
+                putint(po, getpongflags(addr.host));
+                if(pi.remaining())
                 {
-                    case EXTPING_NAMELIST:
-                    {
-                        extern void extping_namelist(ucharbuf &p);
-                        putint(po, query);
-                        extping_namelist(po);
-                        break;
-                    }
-                    case EXTPING_SERVERINFO:
-                    {
-                        extern void extping_serverinfo(ucharbuf &pi, ucharbuf &po);
-                        putint(po, query);
-                        extping_serverinfo(pi, po);
-                        break;
-                    }
-                    case EXTPING_MAPROT:
+                    int query = getint(pi);
+                    switch(query)
                     {
-                        extern void extping_maprot(ucharbuf &po);
-                        putint(po, query);
-                        extping_maprot(po);
-                        break;
-                    }
-                    case EXTPING_UPLINKSTATS:
-                    {
-                        extern void extping_uplinkstats(ucharbuf &po);
-                        putint(po, query);
-                        extping_uplinkstats(po);
-                        break;
+                        case EXTPING_NAMELIST:
+                        {
+                            extern void extping_namelist(ucharbuf &p);
+                            putint(po, query);
+                            extping_namelist(po);
+                            break;
+                        }
+                        case EXTPING_SERVERINFO:
+                        {
+                            extern void extping_serverinfo(ucharbuf &pi, ucharbuf &po);
+                            putint(po, query);
+                            extping_serverinfo(pi, po);
+                            break;
+                        }
+                        case EXTPING_MAPROT:
+                        {
+                            extern void extping_maprot(ucharbuf &po);
+                            putint(po, query);
+                            extping_maprot(po);
+                            break;
+                        }
+                        case EXTPING_UPLINKSTATS:
+                        {
+                            extern void extping_uplinkstats(ucharbuf &po);
+                            putint(po, query);
+                            extping_uplinkstats(po);
+                            break;
+                        }
+                        case EXTPING_NOP:
+                        default:
+                            putint(po, EXTPING_NOP);
+                            break;
                     }
-                    case EXTPING_NOP:
-                    default:
-                        putint(po, EXTPING_NOP);
-                        break;
                 }
             }
-        }
-        else // ext pong - additional server infos
-        {
-            (*cnum)++; *crec += len;
-            int extcmd = getint(pi);
-            putint(po, EXT_ACK);
-            putint(po, EXT_VERSION);
-
-            switch(extcmd)
+            else // ext pong - additional server infos
             {
-                case EXT_UPTIME:        // uptime in seconds
-                {
-                    putint(po, uint(millis)/1000);
-                    break;
-                }
+                (*cnum)++; *crec += len;
+                int extcmd = getint(pi);
+                putint(po, EXT_ACK);
+                putint(po, EXT_VERSION);
 
-                case EXT_PLAYERSTATS:   // playerstats
+                switch(extcmd)
                 {
-                    int cn = getint(pi);     // get requested player, -1 for all
-                    if(!valid_client(cn) && cn != -1)
+                    case EXT_UPTIME:        // uptime in seconds
                     {
-                        putint(po, EXT_ERROR);
+                        putint(po, uint(millis)/1000);
                         break;
                     }
-                    putint(po, EXT_ERROR_NONE);              // add no error flag
 
-                    int bpos = po.length();                  // remember buffer position
-                    putint(po, EXT_PLAYERSTATS_RESP_IDS);    // send player ids following
-                    extinfo_cnbuf(po, cn);
-                    *csend += int(buf.dataLength = len + po.length());
-                    enet_socket_send(pongsock, &addr, &buf, 1); // send all available player ids
-                    po.len = bpos;
-
-                    extinfo_statsbuf(po, cn, bpos, pongsock, addr, buf, len, csend);
-                    return;
-                }
+                    case EXT_PLAYERSTATS:   // playerstats
+                    {
+                        int cn = getint(pi);     // get requested player, -1 for all
+                        if(!valid_client(cn) && cn != -1)
+                        {
+                            putint(po, EXT_ERROR);
+                            break;
+                        }
+                        putint(po, EXT_ERROR_NONE);              // add no error flag
+
+                        int bpos = po.length();                  // remember buffer position
+                        putint(po, EXT_PLAYERSTATS_RESP_IDS);    // send player ids following
+                        extinfo_cnbuf(po, cn);
+                        *csend += int(buf.dataLength = len + po.length());
+                        enet_socket_send(pongsock, &addr, &buf, 1); // send all available player ids
+                        po.len = bpos;
+
+                        packets += extinfo_statsbuf(po, cn, bpos, pongsock, addr, buf, len, csend);
+                        pb.charge(packets);
+                        pingglobalbucket.charge(packets);
+                        continue;
+                    }
 
-                case EXT_TEAMSCORE:
-                    extinfo_teamscorebuf(po);
-                    break;
+                    case EXT_TEAMSCORE:
+                        extinfo_teamscorebuf(po);
+                        break;
 
-                default:
-                    putint(po,EXT_ERROR);
-                    break;
+                    default:
+                        putint(po,EXT_ERROR);
+                        break;
+                }
             }
-        }
 
-        buf.dataLength = len + po.length();
-        enet_socket_send(pongsock, &addr, &buf, 1);
-        if(std) *msend += (int)buf.dataLength;
-        else *csend += (int)buf.dataLength;
+            buf.dataLength = len + po.length();
+            enet_socket_send(pongsock, &addr, &buf, 1);
+            if(std) *msend += (int)buf.dataLength;
+            else *csend += (int)buf.dataLength;
+            pb.charge(packets);
+            pingglobalbucket.charge(packets);
+        }
     }
 
     if(mastersock != ENET_SOCKET_NULL && ENET_SOCKETSET_CHECK(sockset, mastersock)) flushmasterinput();
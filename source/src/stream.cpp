@@ -7,6 +7,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
 string homedir = "";
@@ -880,6 +882,180 @@ struct gzstream : stream
     }
 };
 
+// parallel gzip writer: the data is cut into blocks, which are deflated independently on worker threads and concatenated into one gzip member
+// (like pigz: every block ends byte-aligned with a sync flush - only the last one with Z_FINISH - and uses the last 32K of the previous block as dictionary)
+
+struct pgzblock
+{
+    uchar *data, *out;          // dictionary followed by the block data, compressed block
+    int dictlen, len, outlen;
+    uint crc;
+    bool last, failed;
+    sl_semaphore done;
+
+    pgzblock() : data(NULL), out(NULL), dictlen(0), len(0), outlen(0), crc(0), last(false), failed(false), done(0, NULL) { }
+    ~pgzblock() { DELETEA(data); DELETEA(out); }
+};
+
+struct pgzstream : stream
+{
+    enum
+    {
+        BLOCKSIZE  = 128 * 1024,
+        DICTSIZE   = 32 * 1024,
+        MAXTHREADS = 16
+    };
+
+    stream *file;
+    bool writing, autoclose;
+    int level, numthreads;
+    void *threads[MAXTHREADS];
+    vector<pgzblock *> queue;       // blocks waiting for a worker thread (guarded by queuelock)
+    vector<pgzblock *> pending;     // blocks in file order, not yet written
+    sl_semaphore queuelock, queued;
+    pgzblock *cur;
+    uint crc, total;
+
+    pgzstream() : file(NULL), writing(false), autoclose(false), level(Z_BEST_COMPRESSION), numthreads(0), queuelock(1, NULL), queued(0, NULL), cur(NULL), crc(0), total(0) { }
+
+    ~pgzstream()
+    {
+        close();
+    }
+
+    static int worker(void *data)
+    {
+        pgzstream *gz = (pgzstream *)data;
+        z_stream z;
+        z.zalloc = NULL;
+        z.zfree = NULL;
+        z.opaque = NULL;
+        bool ok = deflateInit2(&z, gz->level, Z_DEFLATED, -MAX_WBITS, min(MAX_MEM_LEVEL, 8), Z_DEFAULT_STRATEGY) == Z_OK;
+        for(;;)
+        {
+            gz->queued.wait();
+            gz->queuelock.wait();
+            pgzblock *b = gz->queue.length() ? gz->queue.remove(0) : NULL;
+            gz->queuelock.post();
+            if(!b) break; // empty queue: shut down
+            b->failed = !ok || deflateReset(&z) != Z_OK || (b->dictlen && deflateSetDictionary(&z, b->data, b->dictlen) != Z_OK);
+            if(!b->failed)
+            {
+                int outsize = deflateBound(&z, b->len) + 64; // room for the sync flush marker
+                b->out = new uchar[outsize];
+                z.next_in = b->data + b->dictlen;
+                z.avail_in = b->len;
+                z.next_out = b->out;
+                z.avail_out = outsize;
+                int err = deflate(&z, b->last ? Z_FINISH : Z_SYNC_FLUSH);
+                b->failed = z.avail_in > 0 || (b->last ? err != Z_STREAM_END : (err != Z_OK || !z.avail_out));
+                b->outlen = outsize - z.avail_out;
+                b->crc = crc32(crc32(0, NULL, 0), b->data + b->dictlen, b->len);
+            }
+            b->done.post();
+        }
+        if(ok) deflateEnd(&z);
+        return 0;
+    }
+
+    bool open(stream *f, int lvl, int nthreads, bool needclose)
+    {
+        if(file) return false;
+        level = lvl;
+        numthreads = 0;
+        loopi(clamp(nthreads, 1, int(MAXTHREADS))) if((threads[numthreads] = sl_createthread(worker, this, "gzwriter"))) numthreads++;
+        if(!numthreads) return false;   // no workers: blocks would never get compressed
+        file = f;
+        autoclose = needclose;
+        writing = true;
+        crc = crc32(0, NULL, 0);
+        total = 0;
+        uchar header[] = { gzstream::MAGIC1, gzstream::MAGIC2, Z_DEFLATED, 0, 0, 0, 0, 0, 0, gzstream::OS_UNIX };
+        file->write(header, sizeof(header));
+        newblock(NULL);
+        return true;
+    }
+
+    void newblock(pgzblock *prev)
+    {
+        cur = new pgzblock;
+        cur->data = new uchar[DICTSIZE + BLOCKSIZE];
+        if(prev)
+        { // the previous block's data is only read by its worker, so we can safely copy from it
+            cur->dictlen = min(int(DICTSIZE), prev->dictlen + prev->len);
+            memcpy(cur->data, prev->data + prev->dictlen + prev->len - cur->dictlen, cur->dictlen);
+        }
+    }
+
+    void writeblock(pgzblock *b)
+    {
+        b->done.wait();
+        if(writing)
+        {
+            if(!b->failed && file->write(b->out, b->outlen) == b->outlen) crc = crc32_combine(crc, b->crc, b->len);
+            else writing = false;
+        }
+        delete b;
+    }
+
+    void submitblock(bool last)
+    {
+        pgzblock *b = cur;
+        b->last = last;
+        pending.add(b);
+        queuelock.wait();
+        queue.add(b);
+        queuelock.post();
+        queued.post();
+        if(last) cur = NULL;
+        else newblock(b);
+
+        // write finished blocks in order, don't let more than two blocks per thread pile up
+        while(pending.length() && (pending.length() > 2 * numthreads || pending[0]->done.getvalue() > 0)) writeblock(pending.remove(0));
+    }
+
+    void close()
+    {
+        if(cur) submitblock(true);
+        while(pending.length()) writeblock(pending.remove(0));
+        if(writing)
+        {
+            uchar trailer[8] =
+            {
+                uchar(crc&0xFF), uchar((crc>>8)&0xFF), uchar((crc>>16)&0xFF), uchar((crc>>24)&0xFF),
+                uchar(total&0xFF), uchar((total>>8)&0xFF), uchar((total>>16)&0xFF), uchar((total>>24)&0xFF)
+            };
+            file->write(trailer, sizeof(trailer));
+            writing = false;
+        }
+        loopi(numthreads) queued.post();
+        loopi(numthreads) sl_waitthread(threads[i]);
+        numthreads = 0;
+        if(autoclose) DELETEP(file);
+    }
+
+    bool end() { return !writing; }
+    long tell() { return writing ? total : -1; }
+
+    int write(const void *buf, int len)
+    {
+        if(!writing || !cur || !buf || len <= 0) return 0;
+        const uchar *src = (const uchar *)buf;
+        int left = len;
+        while(left > 0 && writing)
+        {
+            int n = min(left, BLOCKSIZE - cur->len);
+            memcpy(cur->data + cur->dictlen + cur->len, src, n);
+            cur->len += n;
+            src += n;
+            left -= n;
+            if(cur->len == BLOCKSIZE) submitblock(false);
+        }
+        total += len - left;
+        return len - left;
+    }
+};
+
 struct vecstream : stream
 {
     vector<uchar> *data;
@@ -1014,6 +1190,53 @@ stream *openmemfile(const uchar *buf, int size, int *refcnt)
     return new memstream(buf, size, refcnt);
 }
 
+const uchar *mapfile(const char *filename, int &size, void *&handle) // map a whole file read-only into memory (NULL, if not possible)
+{
+    const char *found = findfile(filename, "rb");
+    if(!strncmp(found, "zip://", 6)) return NULL;
+    const uchar *map = NULL;
+    size = 0;
+    handle = NULL;
+#ifdef WIN32
+    HANDLE file = CreateFile(found, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE) return NULL;
+    DWORD high = 0, low = GetFileSize(file, &high);
+    if(!high && low > 0 && low < INT_MAX)
+    {
+        HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(mapping)
+        {
+            map = (const uchar *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if(map) { size = (int)low; handle = (void *)mapping; }
+            else CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(found, O_RDONLY);
+    if(fd < 0) return NULL;
+    struct stat st;
+    if(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size < INT_MAX)
+    {
+        void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m != MAP_FAILED) { map = (const uchar *)m; size = (int)st.st_size; }
+    }
+    ::close(fd); // the mapping stays valid
+#endif
+    return map;
+}
+
+void unmapfile(const uchar *map, int size, void *handle)
+{
+    if(!map) return;
+#ifdef WIN32
+    UnmapViewOfFile(map);
+    if(handle) CloseHandle((HANDLE)handle);
+#else
+    munmap((void *)map, size);
+#endif
+}
+
 stream *openrawfile(const char *filename, const char *mode)
 {
 #ifndef STANDALONE
@@ -1057,10 +1280,17 @@ stream *opentempfile(const char *name, const char *mode)
     return file;
 }
 
-stream *opengzfile(const char *filename, const char *mode, stream *file, int level)
+stream *opengzfile(const char *filename, const char *mode, stream *file, int level, int threads)
 {
     stream *source = file ? file : openfile(filename, mode);
     if(!source) return NULL;
+    if(threads <= 0) threads = min(sl_numcpus(), 8);
+    if(threads > 1 && strchr(mode, 'w'))
+    {
+        pgzstream *pgz = new pgzstream;
+        if(pgz->open(source, level, threads, !file)) return pgz;
+        delete pgz;                 // no worker threads: compress on this thread
+    }
     gzstream *gz = new gzstream;
     if(!gz->open(source, mode, !file, level)) { if(!file) delete source; delete gz; return NULL; }
     return gz;
@@ -144,7 +144,7 @@ void uploadtexture(GLenum target, GLenum internal, int tw, int th, GLenum format
     if(buf) delete[] buf;
 }
 
-void createtexture(int tnum, int w, int h, void *pixels, int clamp, bool mipmap, bool canreduce, GLenum format)
+static void texparameters(int tnum, int clamp, bool mipmap)
 {
     glBindTexture(GL_TEXTURE_2D, tnum);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, clamp&1 ? GL_CLAMP_TO_EDGE : GL_REPEAT);
@@ -157,7 +157,11 @@ void createtexture(int tnum, int w, int h, void *pixels, int clamp, bool mipmap,
                 (bilinear ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_LINEAR) :
                 (bilinear ? GL_LINEAR_MIPMAP_NEAREST : GL_NEAREST_MIPMAP_NEAREST)) :
             (bilinear ? GL_LINEAR : GL_NEAREST));
+}
 
+void createtexture(int tnum, int w, int h, void *pixels, int clamp, bool mipmap, bool canreduce, GLenum format)
+{
+    texparameters(tnum, clamp, mipmap);
     int tw = w, th = h;
     if(pixels) resizetexture(w, h, mipmap, canreduce, GL_TEXTURE_2D, tw, th);
     uploadtexture(GL_TEXTURE_2D, format, tw, th, format, GL_UNSIGNED_BYTE, pixels, w, h, mipmap);
@@ -312,89 +316,214 @@ SDL_Surface *texdecal(SDL_Surface *s)
     return m;
 }
 
-void scalesurface(SDL_Surface *s, float scale)
-{
-    uint dw = s->w*scale, dh = s->h*scale;
-    uchar *buf = new uchar[dw*dh*s->format->BytesPerPixel];
-    scaletexture((uchar *)s->pixels, s->w, s->h, s->format->BytesPerPixel, buf, dw, dh);
-    delete[] (uchar *)s->pixels;
-    s->w = dw;
-    s->h = dh;
-    s->pixels = buf;
-}
-
 bool silent_texture_load = false;
 
 VARFP(hirestextures, 0, 1, 1, initwarning("texture resolution", INIT_LOAD));
 bool uniformtexres = !hirestextures;
 
-GLuint loadsurface(const char *texname, int &xs, int &ys, int &bpp, int clamp = 0, bool mipmap = true, bool canreduce = false, float scale = 1.0f, bool trydl = false)
+static double texclock() // microseconds
+{
+    return SDL_GetPerformanceCounter() * 1e6 / SDL_GetPerformanceFrequency();
+}
+
+// loading a texture is split in two: decodetexture() does all the CPU work (read and decode the image, fix the format, scale, build all mipmaps)
+// and only touches the texdecode struct - so it can run on a worker thread; the GL upload and all messages stay on the main thread
+
+enum { TDE_OK = 0, TDE_BADNAME, TDE_NOTFOUND, TDE_FORMAT, TDE_SIZE };
+
+struct texdecode
+{
+    string name, file;              // texture name (including "<cmd>" prefix), resolved file name
+    int fileofs;                    // start of the file name in "name"
+    uchar *filedata;                // file contents, for files from zips (read right before decoding, see readtexzip())
+    int filesize, texclamp;
+    bool inzip, mipmap, canreduce;
+    float scale;
+
+    int err, xs, ys, bpp, tw, th, levels;
+    GLenum format;
+    uchar *pixels;                  // all mipmap levels, level 0 first
+    double decodeus, mipus, uploadus;
+
+    texdecode() : fileofs(0), filedata(NULL), filesize(0), texclamp(0), inzip(false), mipmap(true), canreduce(false), scale(1.0f), err(TDE_OK), xs(0), ys(0), bpp(0), tw(0), th(0), levels(0), format(0), pixels(NULL), decodeus(0), mipus(0), uploadus(0) { *name = *file = '\0'; }
+    ~texdecode() { DELETEA(filedata); DELETEA(pixels); }
+};
+
+static bool preparetexdecode(texdecode &d, const char *texname, int clamp, bool mipmap, bool canreduce, float scale) // main thread: resolve the file
 {
+    copystring(d.name, texname);
+    d.texclamp = clamp;
+    d.mipmap = mipmap;
+    d.canreduce = canreduce;
+    d.scale = scale;
     const char *file = texname;
     if(texname[0]=='<')
     {
         file = strchr(texname, '>');
-        if(!file) { if(!silent_texture_load) conoutf("could not load texture %s", texname); return 0; }
+        if(!file) { d.err = TDE_BADNAME; return false; }
         file++;
     }
+    d.fileofs = int(file - texname);
+    copystring(d.file, findfile(file, "rb"));
+    d.inzip = findfilelocation == FFL_ZIP;
+    return true;
+}
 
-    SDL_Surface *s = NULL;
-    const char *ffile = findfile(file, "rb");
-    if(findfilelocation == FFL_ZIP)
+static void readtexzip(texdecode &d) // read a file from a zip into memory; zip streams share the state of their archive, so only one thread at a time may do this
+{
+    stream *z = openzipfile(d.name + d.fileofs, "rb");
+    if(z)
     {
-        stream *z = openzipfile(file, "rb");
-        if(z)
+        int len = z->size();
+        if(len > 0)
         {
-            SDL_RWops *rw = z->rwops();
-            if(rw)
-            {
-                s = IMG_Load_RW(rw, 0);
-                SDL_FreeRW(rw);
-            }
-            delete z;
+            d.filedata = new uchar[len];
+            d.filesize = z->read(d.filedata, len);
         }
+        delete z;
     }
-    else if(!s) s = IMG_Load(ffile);
-    if(!s)
+    if(!d.filesize) d.err = TDE_NOTFOUND;
+}
+
+static void decodetexture(texdecode &d) // may run on a worker thread
+{
+    double start = texclock();
+    SDL_Surface *s = NULL;
+    if(d.filedata)
     {
-        if(trydl) requirepackage(PCK_TEXTURE, file);
-        else if(!silent_texture_load) conoutf("couldn't load texture %s", texname);
-        return 0;
+        SDL_RWops *rw = SDL_RWFromConstMem(d.filedata, d.filesize);
+        if(rw) s = IMG_Load_RW(rw, 1);
+        DELETEA(d.filedata);
     }
+    else s = IMG_Load(d.file);
     s = fixsurfaceformat(s);
-    if(strstr(texname,"playermodel")) { fixcl(s, 45); }
-    else if(strstr(texname,"skin") && strstr(texname,"weapon")) { fixcl(s, 44); }
+    if(!s) { d.err = TDE_NOTFOUND; return; }
+    if(strstr(d.name, "playermodel")) { fixcl(s, 45); }
+    else if(strstr(d.name, "skin") && strstr(d.name, "weapon")) { fixcl(s, 44); }
 
-    GLenum format = texformat(s->format->BitsPerPixel);
-    if(!format)
+    d.format = texformat(s->format->BitsPerPixel);
+    if(!d.format) d.err = TDE_FORMAT;
+    else if(max(s->w, s->h) > (1<<12)) d.err = TDE_SIZE;
+    if(d.err) { SDL_FreeSurface(s); return; }
+
+    if(d.name[0]=='<')
     {
-        SDL_FreeSurface(s);
-        conoutf("texture must be 8, 16, 24, or 32 bpp: %s", texname);
-        return 0;
+        const char *cmd = &d.name[1], *arg1 = strchr(cmd, ':');
+        if(!arg1) arg1 = strchr(cmd, '>');
+        if(!strncmp(cmd, "decal", arg1-cmd)) { s = texdecal(s); d.format = texformat(s->format->BitsPerPixel); }
     }
-    if(max(s->w, s->h) > (1<<12))
-    {
-        SDL_FreeSurface(s);
-        conoutf("texture size exceeded %dx%d pixels: %s", 1<<12, 1<<12, texname);
-        return 0;
+    d.bpp = s->format->BitsPerPixel;
+    int bpp = s->format->BytesPerPixel;
+    d.decodeus = texclock() - start;
+
+    start = texclock();
+    uchar *src = (uchar *)s->pixels, *scaled = NULL;
+    d.xs = s->w;
+    d.ys = s->h;
+    if(uniformtexres && d.scale > 1.0f)
+    { // same as before: the scaled size is also the size reported for the texture
+        float f = 1.0f / d.scale;
+        int dw = s->w*f, dh = s->h*f;
+        scaled = new uchar[dw*dh*bpp];
+        scaletexture(src, s->w, s->h, bpp, scaled, dw, dh);
+        src = scaled;
+        d.xs = dw;
+        d.ys = dh;
     }
+    resizetexture(d.xs, d.ys, d.mipmap, d.canreduce, GL_TEXTURE_2D, d.tw, d.th);
 
-    if(texname[0]=='<')
+    // build the whole mipmap chain, exactly like uploadtexture() does
+    int total = 0, w = d.tw, h = d.th;
+    for(d.levels = 1;; d.levels++)
     {
-        const char *cmd = &texname[1], *arg1 = strchr(cmd, ':');//, *arg2 = arg1 ? strchr(arg1, ',') : NULL;
-        if(!arg1) arg1 = strchr(cmd, '>');
-        if(!strncmp(cmd, "decal", arg1-cmd)) { s = texdecal(s); format = texformat(s->format->BitsPerPixel); }
+        total += w*h*bpp;
+        if(!d.mipmap || max(w, h) <= 1) break;
+        if(w > 1) w /= 2;
+        if(h > 1) h /= 2;
+    }
+    d.pixels = new uchar[total];
+    if(d.xs != d.tw || d.ys != d.th) scaletexture(src, d.xs, d.ys, bpp, d.pixels, d.tw, d.th);
+    else memcpy(d.pixels, src, d.tw*d.th*bpp);
+    uchar *level = d.pixels;
+    w = d.tw;
+    h = d.th;
+    for(int i = 1; i < d.levels; i++)
+    {
+        int srcw = w, srch = h;
+        if(w > 1) w /= 2;
+        if(h > 1) h /= 2;
+        scaletexture(level, srcw, srch, bpp, level + srcw*srch*bpp, w, h);
+        level += srcw*srch*bpp;
     }
+    DELETEA(scaled);
+    SDL_FreeSurface(s);
+    d.mipus = texclock() - start;
+}
 
-    if(uniformtexres && scale > 1.0f) scalesurface(s, 1.0f/scale);
+struct texloadstat
+{
+    string name;
+    int w, h, bpp, levels;
+    float decodems, mipms, uploadms;
+};
+static vector<texloadstat> texloadstats;
 
+static GLuint finishtexdecode(texdecode &d, bool trydl) // main thread: report errors, upload to GL
+{
+    switch(d.err)
+    {
+        case TDE_BADNAME: if(!silent_texture_load) conoutf("could not load texture %s", d.name); return 0;
+        case TDE_NOTFOUND:
+            if(trydl) requirepackage(PCK_TEXTURE, d.name + d.fileofs);
+            else if(!silent_texture_load) conoutf("couldn't load texture %s", d.name);
+            return 0;
+        case TDE_FORMAT: conoutf("texture must be 8, 16, 24, or 32 bpp: %s", d.name); return 0;
+        case TDE_SIZE: conoutf("texture size exceeded %dx%d pixels: %s", 1<<12, 1<<12, d.name); return 0;
+    }
+    double start = texclock();
     GLuint tnum;
     glGenTextures(1, &tnum);
-    createtexture(tnum, s->w, s->h, s->pixels, clamp, mipmap, canreduce, format);
-    xs = s->w;
-    ys = s->h;
-    bpp = s->format->BitsPerPixel;
-    SDL_FreeSurface(s);
+    texparameters(tnum, d.texclamp, d.mipmap);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    uchar *level = d.pixels;
+    int w = d.tw, h = d.th, bpp = formatsize(d.format);
+    loopi(d.levels)
+    {
+        glTexImage2D(GL_TEXTURE_2D, i, d.format, w, h, 0, d.format, GL_UNSIGNED_BYTE, level);
+        level += w*h*bpp;
+        if(w > 1) w /= 2;
+        if(h > 1) h /= 2;
+    }
+    DELETEA(d.pixels);
+    d.uploadus = texclock() - start;
+
+    texloadstat &ts = texloadstats.add();
+    copystring(ts.name, d.name);
+    ts.w = d.tw;
+    ts.h = d.th;
+    ts.bpp = d.bpp;
+    ts.levels = d.levels;
+    ts.decodems = d.decodeus / 1e3;
+    ts.mipms = d.mipus / 1e3;
+    ts.uploadms = d.uploadus / 1e3;
+    return tnum;
+}
+
+GLuint loadsurface(const char *texname, int &xs, int &ys, int &bpp, int clamp = 0, bool mipmap = true, bool canreduce = false, float scale = 1.0f, bool trydl = false)
+{
+    texdecode d;
+    if(preparetexdecode(d, texname, clamp, mipmap, canreduce, scale))
+    {
+        if(d.inzip) readtexzip(d);
+        if(!d.err) decodetexture(d);
+    }
+    GLuint tnum = finishtexdecode(d, trydl);
+    if(tnum)
+    {
+        xs = d.xs;
+        ys = d.ys;
+        bpp = d.bpp;
+    }
     return tnum;
 }
 
@@ -402,18 +531,17 @@ GLuint loadsurface(const char *texname, int &xs, int &ys, int &bpp, int clamp =
 // each texture slot can have multiple texture frames, of which currently only the first is used
 // additional frames can be used for various shaders
 
-Texture *textureload(const char *name, int clamp, bool mipmap, bool canreduce, float scale, bool trydl)
+static void texturekey(char *pname, const char *name, float scale)
 {
-    defformatstring(pname)("%.7g        ", scale);
+    formatstring(pname)("%.7g        ", scale);
     copystring(pname + TEXSCALEPREFIXSIZE, name, MAXSTRLEN - TEXSCALEPREFIXSIZE);
     path(pname + TEXSCALEPREFIXSIZE);
-    Texture *t = textures.access(pname);
-    if(t) return t;
-    int xs, ys, bpp;
-    GLuint id = loadsurface(pname + TEXSCALEPREFIXSIZE, xs, ys, bpp, clamp, mipmap, canreduce, scale, trydl);
-    if(!id) return notexture;
+}
+
+static Texture *addtexture(const char *pname, GLuint id, int xs, int ys, int bpp, int clamp, bool mipmap, bool canreduce, float scale)
+{
     char *key = newstring(pname);
-    t = &textures[key];
+    Texture *t = &textures[key];
     t->name = key + TEXSCALEPREFIXSIZE;
     t->xs = xs;
     t->ys = ys;
@@ -426,6 +554,18 @@ Texture *textureload(const char *name, int clamp, bool mipmap, bool canreduce, f
     return t;
 }
 
+Texture *textureload(const char *name, int clamp, bool mipmap, bool canreduce, float scale, bool trydl)
+{
+    string pname;
+    texturekey(pname, name, scale);
+    Texture *t = textures.access(pname);
+    if(t) return t;
+    int xs, ys, bpp;
+    GLuint id = loadsurface(pname + TEXSCALEPREFIXSIZE, xs, ys, bpp, clamp, mipmap, canreduce, scale, trydl);
+    if(!id) return notexture;
+    return addtexture(pname, id, xs, ys, bpp, clamp, mipmap, canreduce, scale);
+}
+
 struct Slot
 {
     string name;
@@ -506,6 +646,16 @@ const char *gettextureslot(int i)
     else return NULL;
 }
 
+static void setslottexture(Slot &s, Texture *t, Texture *failtex, bool trydl)
+{
+    s.tex = t;
+    if(!trydl)
+    {
+        if(s.tex==notexture) s.tex = failtex;
+        s.loaded = true;
+    }
+}
+
 Texture *lookuptexture(int tex, Texture *failtex, bool trydl)
 {
     Texture *t = failtex;
@@ -515,18 +665,144 @@ Texture *lookuptexture(int tex, Texture *failtex, bool trydl)
         if(!s.loaded)
         {
             defformatstring(pname)("packages/textures/%s", path(s.name, true));
-            s.tex = textureload(pname, 0, true, true, s.scale, trydl);
-            if(!trydl)
-            {
-                if(s.tex==notexture) s.tex = failtex;
-                s.loaded = true;
-            }
+            setslottexture(s, textureload(pname, 0, true, true, s.scale, trydl), failtex, trydl);
         }
         if(s.tex) t = s.tex;
     }
     return t;
 }
 
+// load all missing textures of a map at once: decode on a pool of worker threads, upload in slot order on the main thread
+
+VARP(texloadthreads, 0, 0, 16); // 0: one per cpu
+
+struct texdecodejobs
+{
+    vector<texdecode *> jobs;
+    vector<sl_semaphore *> done;    // one per job, posted when decoded
+    int next;
+    sl_semaphore lock, ziplock, window;     // window: limits the number of textures read or decoded ahead of the upload
+
+    texdecodejobs(int ahead) : next(0), lock(1, NULL), ziplock(1, NULL), window(ahead, NULL) { }
+    ~texdecodejobs() { jobs.deletecontents(); done.deletecontents(); }
+};
+
+static int texdecodethread(void *data)
+{
+    texdecodejobs *q = (texdecodejobs *)data;
+    for(;;)
+    {
+        q->window.wait(); // take the window slot before the job, so the oldest job in work always has one
+        q->lock.wait();
+        int n = q->next++;
+        q->lock.post();
+        if(!q->jobs.inrange(n)) { q->window.post(); break; }
+        texdecode &d = *q->jobs[n];
+        if(d.inzip && !d.err)
+        {
+            q->ziplock.wait();
+            readtexzip(d);
+            q->ziplock.post();
+        }
+        if(!d.err) decodetexture(d);
+        q->done[n]->post();
+    }
+    return 0;
+}
+
+void loadworldtextures(const char *texuse, bool trydl)
+{
+    double start = texclock(), waited = 0;
+    texloadstats.setsize(0);
+    int threads = clamp(texloadthreads ? texloadthreads : sl_numcpus(), 1, 16);
+    texdecodejobs q(threads * 2);
+    int slotjob[256];
+    loopi(256)
+    {
+        slotjob[i] = -1;
+        if(!texuse[i] || !slots.inrange(i) || slots[i].loaded) continue;
+        Slot &s = slots[i];
+        defformatstring(name)("packages/textures/%s", path(s.name, true));
+        string pname;
+        texturekey(pname, name, s.scale);
+        if(textures.access(pname)) continue; // already loaded: lookuptexture() does the rest
+        loopvj(q.jobs) if(q.jobs[j]->scale == s.scale && !strcmp(q.jobs[j]->name, pname + TEXSCALEPREFIXSIZE)) { slotjob[i] = j; break; }
+        if(slotjob[i] >= 0) continue;
+        texdecode *d = new texdecode;
+        preparetexdecode(*d, pname + TEXSCALEPREFIXSIZE, 0, true, true, s.scale);
+        slotjob[i] = q.jobs.length();
+        q.jobs.add(d);
+        q.done.add(new sl_semaphore(0, NULL));
+    }
+
+    // workers decode and build mipmaps, the main thread uploads in order as soon as a texture is ready
+    threads = min(threads, q.jobs.length());
+    vector<void *> handles;
+    loopi(threads)
+    {
+        void *h = sl_createthread(texdecodethread, &q, "texdecode");
+        if(h) handles.add(h);
+    }
+    vector<Texture *> loaded;
+    loopv(q.jobs)
+    {
+        texdecode &d = *q.jobs[i];
+        if(handles.empty())
+        { // no worker thread could be started: decode here
+            if(d.inzip && !d.err) readtexzip(d);
+            if(!d.err) decodetexture(d);
+        }
+        else
+        {
+            double w = texclock();
+            q.done[i]->wait();
+            waited += texclock() - w;
+        }
+        GLuint id = finishtexdecode(d, trydl);
+        q.window.post();
+        if(id)
+        {
+            string pname;
+            texturekey(pname, d.name, d.scale);
+            loaded.add(addtexture(pname, id, d.xs, d.ys, d.bpp, d.texclamp, d.mipmap, d.canreduce, d.scale));
+        }
+        else loaded.add(notexture);
+    }
+    loopv(handles) sl_waitthread(handles[i]);
+    loopi(256)
+    {
+        if(slotjob[i] >= 0) setslottexture(slots[i], loaded[slotjob[i]], noworldtexture, trydl);
+        else if(texuse[i]) lookupworldtexture(i, trydl);
+    }
+
+    if(q.jobs.length())
+    {
+        double cpu = 0, upload = 0;
+        loopv(texloadstats)
+        {
+            cpu += texloadstats[i].decodems + texloadstats[i].mipms;
+            upload += texloadstats[i].uploadms;
+        }
+        clientlogf("loaded %d textures on %d threads in %.1f ms: decoding %.1f ms cpu time, upload %.1f ms, waiting for decoding %.1f ms", q.jobs.length(), threads, (texclock() - start) / 1e3, cpu, upload, waited / 1e3);
+    }
+}
+
+void showtexloadstats(char *what) // "all"(default): list all textures loaded since the last map load, "sum": totals only
+{
+    float decode = 0, mip = 0, upload = 0;
+    bool all = strcasecmp(what, "sum") != 0;
+    loopv(texloadstats)
+    {
+        texloadstat &ts = texloadstats[i];
+        if(all) conoutf("%s: %dx%d %dbpp, %d levels, decode %.2f ms, mipmaps %.2f ms, upload %.2f ms", ts.name, ts.w, ts.h, ts.bpp, ts.levels, ts.decodems, ts.mipms, ts.uploadms);
+        decode += ts.decodems;
+        mip += ts.mipms;
+        upload += ts.uploadms;
+    }
+    conoutf("%d textures: decode %.1f ms, mipmaps %.1f ms, upload %.1f ms", texloadstats.length(), decode, mip, upload);
+}
+COMMANDN(texloadstats, showtexloadstats, "s");
+
 void cleanuptextures()
 {
     enumerate(textures, Texture, t,
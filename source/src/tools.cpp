@@ -131,7 +131,187 @@ int calcmapdims(mapdim_s &md, const servsqr *s, int _ssize)
     return res;
 }
 
-int calcmapareastats(mapareastats_s &ms, servsqr *_servworld, int _ssize, const mapdim_s &md)
+// probe point visibility: every probe point casts 8 * MAS_RESOLUTION rays over the floorplan and counts the cubes it sees
+// the probe points are independent, so they are split over several worker threads, each with its own "seen" map
+
+struct mapareaprobejob
+{
+    const servsqr *world;
+    int ssize, first, last;     // probe points [first..last)
+    const int *pos;             // probe point positions (offsets into world)
+    threeint *tab;              // results: area, volume, position
+    uchar *seen;                // per-job copy of the floorplan visibility (epoch per probe point)
+};
+
+static void mapareaprobes(mapareaprobejob &job)
+{
+    const int ssize = job.ssize;
+    uchar epoch = 1, *seen = job.seen;
+    for(int n = job.first; n < job.last; n++)
+    {
+        const servsqr *r = job.world + job.pos[n], *rr;
+        int area = 0, volume = 0, frac, o;
+        loopk(MAS_RESOLUTION)
+        {
+            #define RAYS(da, db) \
+                rr = r; frac = 0; \
+                for(;;) \
+                { \
+                    if((frac += k) >= MAS_RESOLUTION) rr += da, frac -= MAS_RESOLUTION; \
+                    rr += db; \
+                    if(SOLID(rr)) break; \
+                    o = int(rr - job.world); \
+                    if(seen[o] != epoch) { area += 1; volume += rr->ceil - rr->floor; seen[o] = epoch; } \
+                }
+            RAYS(ssize, 1);
+            RAYS(ssize, -1);
+            RAYS(-ssize, 1);
+            RAYS(-ssize, -1);
+            RAYS(1, ssize);
+            RAYS(1, -ssize);
+            RAYS(-1, ssize);
+            RAYS(-1, -ssize);
+            #undef RAYS
+        }
+        threeint &pp = job.tab[n];
+        pp.key = area;
+        pp.val1 = volume;
+        pp.val2 = job.pos[n];
+        if(area) epoch++;
+        if(!epoch) epoch++;   // (can't happen with MAS_GRID2 < 256)
+    }
+}
+
+static int mapareaprobethread(void *job)
+{
+    mapareaprobes(*(mapareaprobejob *)job);
+    return 0;
+}
+
+int calcmapareastats(mapareastats_s &ms, servsqr *_servworld, int _ssize, const mapdim_s &md, int threads)
+{
+    memset(&ms, 0, sizeof(ms));
+
+    // count steep FHF and CHF
+    int linegap = _ssize - md.xspan;
+    #ifndef STANDALONE
+    int totalmax = 0;
+    #endif
+    servsqr *bb = _servworld + _ssize * md.y1 + md.x1, *ss = bb;
+    for(int j = md.yspan; j > 0; j--, ss += linegap) loopirev(md.xspan)
+    {
+        int type = ss->type & TAGTRIGGERMASK;
+        if(type == FHF || type == CHF) // only CHF and FHF use vdelta
+        {
+            servsqr *r[3] = { ss + 1, ss + _ssize, ss + _ssize + 1 };
+            int min = ss->vdelta, max = min;
+            loopi(3)
+            {
+                if(r[i]->vdelta < min) min = r[i]->vdelta;
+                else if(r[i]->vdelta > max) max = r[i]->vdelta;
+            }
+            max -= min;
+            #ifndef STANDALONE
+            if(max > totalmax)
+            {
+                ms.steepest = int(ss - _servworld);
+                totalmax = max;
+            }
+            #endif
+            int d = max / MAS_VDELTA_QUANT;
+            ASSERT(d >= 0);
+            if(d >= MAS_VDELTA_TABSIZE) d = MAS_VDELTA_TABSIZE - 1;
+            ms.vdd[d]++;
+        }
+        ss++;
+    }
+    loopirev(MAS_VDELTA_TABSIZE) ms.vdds = (ms.vdds << 2) | ((ms.vdd[i] > MAS_VDELTA_THRES) << 1) | (ms.vdd[i] > 0);
+
+    // check occlusion by SOLIDs
+    int xc = (md.xspan + MAS_GRID / 2) / (MAS_GRID + 1), yc = (md.yspan + MAS_GRID / 2) / (MAS_GRID + 1);
+    if(md.x1 + MAS_GRID * xc >= _ssize || md.y1 + MAS_GRID * yc >= _ssize) return -1; // malformed map
+    int xb = min(md.x1 + xc, _ssize - MAS_GRID * xc - md.x1 - 1) / 2, yb = min(md.y1 + yc, _ssize - MAS_GRID * yc - md.y1 - 1) / 2; // make sure, all tp points are inside the map area
+    int tgx = min(xb, max(3, xc / 3)), tgy = min(yb, max(3, yc / 3)) * _ssize, tp[8] = { tgx, -tgx, tgy, -tgy, 2 * tgx + 2 * tgy, -2 * tgx - 2 * tgy, -2 * tgx + 2 * tgy, 2 * tgx - 2 * tgy }; // 8 positions to try, if the stariing point is solid
+    servsqr *s = bb + xc + yc * _ssize; ss = s;
+    int pos[MAS_GRID2], *p = pos;
+    for(int y = 0; y < MAS_GRID; y++, ss = s += _ssize * yc) for(int x = 0; x < MAS_GRID; x++, ss += xc) // place MAS_GRID x MAS_GRID probe points
+    {
+        servsqr *r = ss;
+        if(SOLID(r)) loopi(8)
+        { // if initial position is SOLID, we try 8 points around that spot
+            if(!SOLID(r + tp[i]))
+            {
+                r += tp[i];
+                break;
+            }
+        }
+        *p++ = int(r - _servworld);
+    }
+
+    // measure visible area in all probe points (with a low-res version of computeraytable())
+    if(threads <= 0) threads = sl_numcpus();
+    threads = clamp(threads, 1, MAS_GRID);
+    int cubicsize = _ssize * _ssize;
+    uchar *seen = new uchar[threads * cubicsize];
+    memset(seen, 0, threads * cubicsize);
+    vector<threeint> tab;
+    tab.pad(MAS_GRID2);
+    mapareaprobejob jobs[MAS_GRID];
+    void *handles[MAS_GRID];
+    loopi(threads)
+    {
+        mapareaprobejob &job = jobs[i];
+        job.world = _servworld;
+        job.ssize = _ssize;
+        job.first = (MAS_GRID2 * i) / threads;
+        job.last = (MAS_GRID2 * (i + 1)) / threads;
+        job.pos = pos;
+        job.tab = tab.getbuf();
+        job.seen = seen + i * cubicsize;
+        handles[i] = i ? sl_createthread(mapareaprobethread, &job, "mapareastats") : NULL;
+    }
+    mapareaprobes(jobs[0]);  // the calling thread does its share, too
+    for(int i = 1; i < threads; i++)
+    {
+        if(handles[i]) sl_waitthread(handles[i]);
+        else mapareaprobes(jobs[i]);    // thread didn't start
+    }
+
+    // count all cubes not in view of one of the probe points
+    for(int i = 1; i < threads; i++)
+    {
+        const uchar *src = seen + i * cubicsize;
+        loopj(cubicsize) seen[j] |= src[j];
+    }
+    const uchar *sn = seen + (bb - _servworld);
+    ss = bb;
+    for(int j = md.yspan; j > 0; j--, ss += linegap, sn += linegap) loopirev(md.xspan)
+    {
+        if(!SOLID(ss))
+        {
+            ms.total++;
+            if(!*sn) ms.rest++;
+        }
+        ss++; sn++;
+    }
+    delete[] seen;
+
+    tab.sort(cmpintdesc);
+    loopv(tab)
+    { // sort probe poiints in descending order of area
+        ms.ppv[i] = tab[i].val1;
+        ms.ppa[i] = tab[i].key;
+        #ifndef STANDALONE
+        ms.ppp[i] = tab[i].val2;
+        #endif
+    }
+    return 0;
+}
+
+#ifndef STANDALONE
+// former single-threaded implementation of calcmapareastats(), only kept as reference for "mapareacheck bench"
+// marks seen cubes by writing an epoch value to vdelta (destroys the vdelta values of _servworld)
+int calcmapareastats_old(mapareastats_s &ms, servsqr *_servworld, int _ssize, const mapdim_s &md)
 {
     memset(&ms, 0, sizeof(ms));
 
@@ -244,6 +424,7 @@ int calcmapareastats(mapareastats_s &ms, servsqr *_servworld, int _ssize, const
     }
     return 0;
 }
+#endif
 
 void calcentitystats(entitystats_s &es, const persistent_entity *pents, int pentsize)
 {
@@ -799,10 +980,12 @@ bool glmatrixf::invert(const glmatrixf &m, float mindet)
 #ifdef AC_USE_SDL_THREADS
     #include "SDL_timer.h"
     #include "SDL_thread.h"      // also fetches SDL_mutex.h
+    #include "SDL_cpuinfo.h"
 #else
     #include <pthread.h>
     #include <semaphore.h>
     #include <sys/shm.h>
+    #include <unistd.h>
 #endif
 
 static int sl_sem_errorcountdummy = 0;
@@ -916,11 +1099,13 @@ void *sl_createthread(int (*fn)(void *), void *data, const char *name)
     ti->fn = fn;
     ti->done = 0;
     ti->handle = SDL_CreateThread(sl_thread_indir, name, ti);
+    if(!ti->handle) { delete ti; ti = NULL; }
     return (void *) ti;
 }
 
 int sl_waitthread(void *ti)
 {
+    if(!ti) return -1;
     int res;
     SDL_WaitThread(((sl_threadinfo *)ti)->handle, &res);
     delete (sl_threadinfo *) ti;
@@ -974,13 +1159,14 @@ void *sl_createthread(int (*fn)(void *), void *data, const char *name)
     ti->data = data;
     ti->fn = fn;
     ti->done = 0;
-    pthread_create(&(ti->handle), NULL, sl_thread_indir, ti);
-    if(name) pthread_setname_np(ti->handle, name);
+    if(pthread_create(&(ti->handle), NULL, sl_thread_indir, ti)) { delete ti; ti = NULL; }
+    else if(name) pthread_setname_np(ti->handle, name);
     return (void *) ti;
 }
 
 int sl_waitthread(void *ti)
 {
+    if(!ti) return -1;
     void *res;
     pthread_join(((sl_threadinfo *)ti)->handle, &res);
     int ires = *((int *)res);
@@ -1010,7 +1196,7 @@ bool ismainthread() { return pthread_equal(mainthreadid, pthread_self()) != 0; }
 
 bool sl_pollthread(void *ti)
 {
-    return ((sl_threadinfo*)ti)->done != 0;
+    return !ti || ((sl_threadinfo*)ti)->done != 0;
 }
 
 // platform dependent stuff not covered by enet (use POSIX or, if possible, SDL)
@@ -1019,12 +1205,22 @@ void sl_sleep(int duration)
 {
     SDL_Delay(duration);
 }
+
+int sl_numcpus()
+{
+    return max(1, SDL_GetCPUCount());
+}
 #else
 void sl_sleep(int duration)
 {
     struct timespec t = { duration / 1000, (duration % 1000) * 1000000 };
     nanosleep(&t, NULL);
 }
+
+int sl_numcpus()
+{
+    return max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+}
 #endif
 
 void parseupdatelist(hashtable<const char *, int> &ht, char *buf, const char *prefix, const char *suffix)
@@ -713,6 +713,12 @@ template <class T, int SIZE> struct ringbuf
     int maxsize() const { return SIZE - 1; } // yes, only SIZE-1, sry
     int length() const { return (SIZE + in - out) % SIZE; }
 
+    void skip(int n) // drop n (crashes, if not available)
+    {
+        ASSERT(n >= 0 && n <= length());
+        out = (out + n) % SIZE;
+    }
+
     T &remove() // get one (crashes, if empty)
     {
         ASSERT(!empty());
@@ -945,11 +951,13 @@ extern const char *findfile(const char *filename, const char *mode);
 extern int getfilesize(const char *filename);
 extern stream *openvecfile(vector<uchar> *s = NULL, bool autodelete = true);
 extern stream *openmemfile(const uchar *buf, int size, int *refcnt);
+extern const uchar *mapfile(const char *filename, int &size, void *&handle);
+extern void unmapfile(const uchar *map, int size, void *handle);
 extern bool findzipfile(const char *name);
 extern stream *openzipfile(const char *filename, const char *mode);
 extern stream *openfile(const char *filename, const char *mode);
 extern stream *opentempfile(const char *filename, const char *mode);
-extern stream *opengzfile(const char *filename, const char *mode, stream *file = NULL, int level = Z_BEST_COMPRESSION);
+extern stream *opengzfile(const char *filename, const char *mode, stream *file = NULL, int level = Z_BEST_COMPRESSION, int threads = 1); // threads: 1 = compress on the calling thread, 0 = one per cpu (writing only)
 extern char *loadfile(const char *fn, int *size, const char *mode = NULL);
 extern int streamcopy(stream *dest, stream *source, int maxlen = INT_MAX);
 extern void filerotate(const char *basename, const char *ext, int keepold, const char *oldformat = NULL);
@@ -996,6 +1004,26 @@ extern const char *hiddenpwd(const char *pwd, int showchars = 0);
 extern int getlistindex(const char *key, const char *list[], bool acceptnumeric = true, int deflt = -1);
 extern void parseupdatelist(hashtable<const char *, int> &ht, char *buf, const char *prefix = NULL, const char *suffix = NULL);
 
+struct tokenbucket   // rate limiter: refills with "rate" tokens per second, up to "burst" tokens
+{
+    int credit, lastmillis;             // credit in 1/1000 tokens
+
+    tokenbucket() : credit(0), lastmillis(0) {}
+
+    bool allow(int millis, int rate, int burst)
+    {
+        int elapsed = millis - lastmillis, full = burst * 1000;
+        credit = elapsed >= (full - credit) / rate ? full : credit + elapsed * rate;  // (avoid overflows after long pauses)
+        lastmillis = millis;
+        return credit > 0;
+    }
+    void charge(int tokens = 1) { credit -= tokens * 1000; } // may go into debt
+};
+
+inline uint iphash(enet_uint32 ip) { return (ip * 2654435761U) >> 16; } // (multiplicative hash, for fixed size tables)
+static inline uint hthash(const ENetAddress &a) { return iphash(a.host) ^ a.port; }
+static inline bool htcmp(const ENetAddress &x, const ENetAddress &y) { return x.host == y.host && x.port == y.port; }
+
 struct twoint { int key, val; };
 struct threeint { int key, val1, val2; };
 extern int cmpintasc(const int *a, const int *b);  // leads to ascending sort order
@@ -1023,11 +1051,12 @@ struct sl_semaphore
     void post();     // increments (unlocks) semaphore
 };
 
-extern void *sl_createthread(int (*fn)(void *), void *data, const char *name = NULL);
+extern void *sl_createthread(int (*fn)(void *), void *data, const char *name = NULL);  // returns NULL, if the thread could not be started
 extern int sl_waitthread(void *ti);
 extern bool sl_pollthread(void *ti);
 extern void sl_detachthread(void *ti);
 extern void sl_sleep(int duration);
+extern int sl_numcpus();
 extern bool ismainthread();
 
 #endif
@@ -646,13 +646,17 @@ COMMAND(nextplayerstart, "i");
 
 sqr *wmip[LARGEST_FACTOR*2];
 
-void setupworld(int factor)
+void setupworld(int factor, sqr *prepared)     // prepared: cleared (and possibly already filled) buffer of the right size, is taken over
 {
     ssize = 1<<(sfactor = factor);
     cubicsize = ssize*ssize;
     mipsize = cubicsize*134/100;
-    sqr *w = world = new sqr[mipsize];
-    memset(world, 0, mipsize*sizeof(sqr));
+    sqr *w = world = prepared;
+    if(!w)
+    {
+        w = world = new sqr[mipsize];
+        memset(world, 0, mipsize*sizeof(sqr));
+    }
     loopi(LARGEST_FACTOR*2) { wmip[i] = w; w += cubicsize>>(i*2); }
 }
 
@@ -1019,7 +1023,7 @@ void mapmrproper(bool manual)
 }
 COMMANDF(mapmrproper, "", () { mapmrproper(true); });
 
-void mapareacheck(char *what) // "vdelta" | "steepest" | "total" | "pprest" | "pp"(default)
+void mapareacheck(char *what) // "vdelta" | "steepest" | "total" | "pprest" | "bench" | "pp"(default)
 {
     mapareastats_s ms;
     mapdim_s md;
@@ -1028,9 +1032,30 @@ void mapareacheck(char *what) // "vdelta" | "steepest" | "total" | "pprest" | "p
     servsqr *sw = createservworld(world, cubicsize);
     calcmapdims(md, sw, ssize);
     calcmapareastats(ms, sw, ssize, md);
-    delete[] sw;
     vector<char> res;
-    if(!strcasecmp(what, "vdelta"))
+    if(!strcasecmp(what, "bench"))
+    { // compare the old implementation with the new one (single-threaded and multi-threaded): time per run and identical results
+        // every run works on a fresh copy of the servworld, because the old implementation overwrites the vdelta values
+        const int runs = 20;
+        mapareastats_s mt;
+        servsqr *wc = new servsqr[cubicsize];
+        int elapsed[3], diffs = 0;
+        loopk(3)
+        {
+            ti.start();
+            loopi(runs)
+            {
+                memcpy(wc, sw, cubicsize * sizeof(servsqr));
+                if(k) calcmapareastats(mt, wc, ssize, md, k == 1 ? 1 : 0);
+                else calcmapareastats_old(mt, wc, ssize, md);
+                if(memcmp(&mt, &ms, sizeof(ms))) diffs++;
+            }
+            elapsed[k] = ti.elapsed();
+        }
+        delete[] wc;
+        cvecprintf(res, "%.3g %.3g %.3g %d %d", elapsed[0] / float(runs), elapsed[1] / float(runs), elapsed[2] / float(runs), sl_numcpus(), diffs);
+    }
+    else if(!strcasecmp(what, "vdelta"))
     {
         loopi(MAS_VDELTA_TABSIZE) cvecprintf(res, "%d ", ms.vdd[i]);
     }
@@ -1045,6 +1070,7 @@ void mapareacheck(char *what) // "vdelta" | "steepest" | "total" | "pprest" | "p
             cvecprintf(res, "%d %d %d  %d %d %.5g\n", x, y, z, ms.ppa[i], ms.ppv[i], ms.ppa[i] ? float(ms.ppv[i]) / ms.ppa[i] : 0.0f);
         }
     }
+    delete[] sw;
     resultcharvector(res, -1);
 }
 
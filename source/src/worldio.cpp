@@ -178,7 +178,7 @@ bool rldecodecubes(ucharbuf &f, sqr *s, int len, int version, bool silent) // ru
         {
             case -1:
             {
-                if(!silent) conoutf("while reading map at %d: unexpected end of file", int(cubicsize - (e - s)));
+                if(!silent) conoutf("while reading map at %d: unexpected end of file", int(len - (e - s)));
                 f.forceoverread();
                 silent = true;
                 sqrdefault(s);
@@ -214,7 +214,7 @@ bool rldecodecubes(ucharbuf &f, sqr *s, int len, int version, bool silent) // ru
             {
                 if(type<0 || type>=MAXTYPE)
                 {
-                    if(!silent) conoutf("while reading map at %d: type %d out of range", int(cubicsize - (e - s)), type);
+                    if(!silent) conoutf("while reading map at %d: type %d out of range", int(len - (e - s)), type);
                     f.forceoverread();
                     continue;
                 }
@@ -555,6 +555,7 @@ SVARF(mapinfo_comment, "", setmapinfo(); );
 VAR(advancemaprevision, 1, 1, 100);
 
 VARP(mapbackupsonsave, 0, 1, 1);
+VARP(mapsavethreads, 0, 1, 16); // threads compressing map files (0: one per cpu, 1: compress on the main thread)
 
 void rebuildtexlists()  // checks the texlists, if they still contain all possible textures
 {
@@ -616,7 +617,7 @@ void save_world(char *mname, bool skipoptimise, bool addcomfort)
     // get target file ready
     setnames(mname);
     if(mapbackupsonsave) backup(cgzname, bakname);
-    stream *f = opengzfile(cgzname, "wb");
+    stream *f = opengzfile(cgzname, "wb", NULL, Z_BEST_COMPRESSION, mapsavethreads);
     if(!f) { conoutf("could not write map to %s", cgzname); return; }
 
     // update embedded config file (if used)
@@ -742,7 +743,7 @@ void save_world9(char *mname)
     }
     setnames(mname);
     backup(cgzname, bakname);
-    stream *f = opengzfile(cgzname, "wb");
+    stream *f = opengzfile(cgzname, "wb", NULL, Z_BEST_COMPRESSION, mapsavethreads);
     if(!f) { conoutf("could not write map to %s", cgzname); return; }
     strncpy(hdr.head, "ACMP", 4); // ensure map now declares itself as an AssaultCube map, even if imported as CUBE
     hdr.version = 9;
@@ -788,6 +789,56 @@ void save_world9(char *mname)
 }
 COMMANDN(savemap9, save_world9, "s");
 
+void gzwritebench(char *fname, int *threads) // compare gz compression on the calling thread with the parallel writer: sizes, time per run, identical data after unpacking
+{
+    if(!*fname)
+    {
+        setnames(getclientmap());
+        fname = cgzname;
+    }
+    stream *f = opengzfile(fname, "rb");
+    if(!f) f = openfile(fname, "rb"); // not gzipped: compress the file as it is
+    if(!f) { conoutf("\f3could not read %s", fname); return; }
+    vector<uchar> raw;
+    uchar buf[4096];
+    for(int n; (n = f->read(buf, sizeof(buf))) > 0; ) raw.put(buf, n);
+    delete f;
+    if(raw.empty()) return;
+
+    const int runs = 5;
+    int usethreads = *threads > 0 ? *threads : min(sl_numcpus(), 8), elapsed[2];
+    vector<uchar> packed[2];
+    bool ok = true;
+    stopwatch ti;
+    loopk(2)
+    {
+        ti.start();
+        loopi(runs)
+        {
+            packed[k].setsize(0);
+            stream *v = openvecfile(&packed[k], false), *gz = opengzfile(NULL, "wb", v, Z_BEST_COMPRESSION, k ? usethreads : 1);
+            gz->write(raw.getbuf(), raw.length());
+            delete gz;
+            delete v;
+        }
+        elapsed[k] = ti.elapsed();
+
+        stream *v = openvecfile(&packed[k], false), *gz = opengzfile(NULL, "rb", v);
+        int got = 0;
+        for(int n; gz && (n = gz->read(buf, sizeof(buf))) > 0; got += n) if(got + n > raw.length() || memcmp(buf, &raw[got], n)) ok = false;
+        if(got != raw.length()) ok = false;
+        DELETEP(gz);
+        delete v;
+    }
+    float mb = raw.length() / float(1 << 20);
+    conoutf("gz %s: %d bytes, single thread: %d bytes (%.1f%%), %.1f MB/s, %d threads: %d bytes (%.1f%%), %.1f MB/s, %s", fname, raw.length(),
+        packed[0].length(), 100.0f * packed[0].length() / raw.length(), mb * runs * 1000 / max(elapsed[0], 1),
+        usethreads, packed[1].length(), 100.0f * packed[1].length() / raw.length(), mb * runs * 1000 / max(elapsed[1], 1), ok ? "unpacked ok" : "\f3unpacked data differs");
+    defformatstring(res)("%d %d %d %.3g %.3g %d %d", raw.length(), packed[0].length(), packed[1].length(), elapsed[0] / float(runs), elapsed[1] / float(runs), usethreads, ok ? 1 : 0);
+    result(res);
+}
+COMMAND(gzwritebench, "si");
+
 void showmapdims()
 {
     conoutf("  min X|Y|Z: %3d : %3d : %3d", clmapdims.x1, clmapdims.y1, clmapdims.minfloor);
@@ -825,11 +876,264 @@ extern char *mlayout;
 extern int Mv, Ma, Hhits;
 extern float Mh;
 
+// loading a map happens in two stages: preparemap() reads, inflates and decodes the map file into a side buffer without touching
+// the game state (so it can run in a background thread, for the next map during intermission), load_world() then commits the result
+
+struct preparedmap
+{
+    header hdr;
+    int err;                        // negative: load_world() error code, errmsg is set
+    string errmsg;
+    uchar *extra;                   // extra header data
+    int extrasize;
+    persistent_entity *ents;        // read and converted to the current type numbers, attribute scaling of old formats is done on commit
+    sqr *world;                     // complete world buffer, including space for the mips
+    bool decodeok;
+    int worlderror;
+    mapdim_s mapdims;
+    char *mlayout;
+    int Mv, Ma, Hhits;
+    char texuse[256];
+
+    preparedmap() { memset(&hdr, 0, (char *)(&texuse + 1) - (char *)&hdr); }
+    ~preparedmap() { DELETEA(extra); DELETEA(ents); DELETEA(world); DELETEA(mlayout); }
+};
+
+int preparemap(preparedmap &pm, stream *f, bool silent) // read and decode a map file (no access to the game state: may run in a background thread, if silent), deletes f
+{
+    const int sizeof_header = sizeof(header), sizeof_baseheader = sizeof_header - sizeof(int) * 16;
+    #define PREPAREFAIL(n, msg) { copystring(pm.errmsg, msg); delete f; return pm.err = n; }
+    header &tmp = pm.hdr;
+    if(f->read(&tmp, sizeof_baseheader) != sizeof_baseheader ||
+       (strncmp(tmp.head, "CUBE", 4)!=0 && strncmp(tmp.head, "ACMP",4)!=0)) PREPAREFAIL(-3, "while reading map: header malformatted (1)");
+    lilswap(&tmp.version, 4); // version, headersize, sfactor, numents
+    if(tmp.version > MAPVERSION) PREPAREFAIL(-4, "this map requires a newer version of AssaultCube");
+    if(tmp.sfactor<SMALLEST_FACTOR || tmp.sfactor>LARGEST_FACTOR || tmp.numents > MAXENTITIES) PREPAREFAIL(-5, "illegal map size");
+    tmp.headersize = fixmapheadersize(tmp.version, tmp.headersize);
+    int restofhead = min(tmp.headersize, sizeof_header) - sizeof_baseheader;
+    if(f->read(&tmp.waterlevel, restofhead) != restofhead) PREPAREFAIL(-6, "while reading map: header malformatted (2)");
+    if(tmp.headersize > sizeof_header)
+    {
+        int extrasize = tmp.headersize - sizeof_header;
+        if(tmp.version < 9) extrasize = 0;  // throw away mediareq...
+        else if(extrasize > MAXHEADEREXTRA) extrasize = MAXHEADEREXTRA;
+        if(extrasize)
+        { // map file actually has extra header data that we want too preserve
+            pm.extra = new uchar[extrasize];
+            if(f->read(pm.extra, extrasize) != extrasize) PREPAREFAIL(-7, "while reading map: header malformatted (3)");
+            pm.extrasize = extrasize;
+        }
+        f->seek(tmp.headersize, SEEK_SET);
+    }
+
+    // read entities
+    pm.ents = new persistent_entity[tmp.numents];
+    bool oldentityformat = tmp.version < 10; // version < 10 have only 4 attributes and no scaling
+    loopi(tmp.numents)
+    {
+        persistent_entity &e = pm.ents[i];
+        f->read(&e, oldentityformat ? 12 : sizeof(persistent_entity));
+        lilswap((short *)&e, 4);
+        if(oldentityformat) e.attr5 = e.attr6 = e.attr7 = 0;
+        else lilswap(&e.attr5, 1);
+        if(e.type == LIGHT && e.attr1 >= 0)
+        {
+            if(!e.attr2) e.attr2 = 255; // needed for MAPVERSION<=2
+            if(e.attr1 > 32) e.attr1 = 32; // 12_03 and below (but applied to _all_ files!)
+        }
+        transformoldentitytypes(tmp.version, e.type);
+    }
+
+    // read and decode world geometry
+    int pssize = 1 << tmp.sfactor, pcubicsize = pssize * pssize, pmipsize = pcubicsize * 134 / 100;
+    pm.world = new sqr[pmipsize];
+    memset(pm.world, 0, pmipsize * sizeof(sqr));
+    vector<uchar> rawcubes; // fetch whole file into buffer
+    loopi(9)
+    {
+        ucharbuf q = rawcubes.reserve(pcubicsize);
+        q.len = f->read(q.buf, pcubicsize);
+        rawcubes.addbuf(q);
+        if(q.len < pcubicsize) break;
+    }
+    delete f;
+    ucharbuf uf(rawcubes.getbuf(), rawcubes.length());
+    pm.decodeok = rldecodecubes(uf, pm.world, pcubicsize, tmp.version, silent);
+
+    // calculate map statistics
+    servsqr *smallworld = createservworld(pm.world, pcubicsize);
+    pm.worlderror = calcmapdims(pm.mapdims, smallworld, pssize);
+    delete[] smallworld;
+
+    pm.mlayout = new char[pcubicsize + 256];
+    memset(pm.mlayout, 0, pcubicsize * sizeof(char));
+    loopk(pcubicsize)
+    {
+        sqr *s = &pm.world[k];
+        if(SOLID(s)) pm.mlayout[k] = 127;
+        else
+        {
+            pm.mlayout[k] = s->floor; // FIXME
+            int diff = s->ceil - s->floor;
+            if(diff > 6)
+            {
+                if(diff > MAXMHEIGHT) pm.Hhits += diff - MAXMHEIGHT;
+                pm.Ma += 1;
+                pm.Mv += diff;
+            }
+            pm.texuse[s->utex] = pm.texuse[s->ftex] = pm.texuse[s->ctex] = 1;
+        }
+        pm.texuse[s->wtex] = 1;
+    }
+    #undef PREPAREFAIL
+    return 0;
+}
+
+// prefetching of the next map: the server advertises the next map early, the client fetches it (from the server or by autodownload),
+// and once the game is about to end, a background thread prepares it, so that the map change doesn't have to wait for network, disk or decoding
+
+VARP(prefetchmaps, 0, 1, 1);
+
+#define MAPPREFETCHTIMEOUT 120000
+
+enum { MPF_NONE = 0, MPF_FETCH, MPF_WAIT, MPF_PREPARE, MPF_READY };
+
+struct mapprefetch
+{
+    string name;
+    int stage, cgzsize, filesize, started;
+    stream *f;
+    preparedmap *prepared;
+    SDL_Thread *thread;
+    volatile bool done;
+} nextmap;
+
+int preparemapthread(void *data)
+{
+    preparemap(*nextmap.prepared, nextmap.f, true);
+    nextmap.f = NULL;
+    nextmap.done = true;
+    return 0;
+}
+
+void joinpreparethread()
+{
+    if(nextmap.thread)
+    {
+        int nop;
+        SDL_WaitThread(nextmap.thread, &nop);
+        nextmap.thread = NULL;
+    }
+}
+
+void resetmapprefetch()
+{
+    joinpreparethread();
+    DELETEP(nextmap.prepared);
+    nextmap.stage = MPF_NONE;
+}
+
+int localmapsize(const char *name) // size of the cgz, load_world() would use
+{
+    setnames(name);
+    int size = getfilesize(ocgzname);
+    return size > 0 ? size : getfilesize(cgzname);
+}
+
+bool startmapprepare()
+{
+    setnames(nextmap.name);
+    const char *fname = getfilesize(ocgzname) > 0 ? ocgzname : cgzname;
+    nextmap.filesize = getfilesize(fname);
+    if(!(nextmap.f = opengzfile(fname, "rb"))) return false;
+    nextmap.prepared = new preparedmap;
+    nextmap.done = false;
+    if(!(nextmap.thread = SDL_CreateThread(preparemapthread, "PrepareMap", NULL)))
+    {
+        DELETEP(nextmap.f);
+        DELETEP(nextmap.prepared);
+        return false;
+    }
+    nextmap.stage = MPF_PREPARE;
+    return true;
+}
+
+void prefetchmap(const char *name, int mode, int cgzsize, int revision) // the server announced the next map
+{
+    name = behindpath(name);
+    if(!prefetchmaps || !validmapname(name) || !strcmp(name, getclientmap())) return;
+    if(nextmap.stage != MPF_NONE && !strcmp(nextmap.name, name)) return; // already working on it
+    resetmapprefetch();
+    copystring(nextmap.name, name);
+    nextmap.cgzsize = cgzsize;
+    nextmap.started = totalmillis;
+    int local = localmapsize(name);
+    if(local > 0 && (cgzsize < 10 || local == cgzsize)) nextmap.stage = MPF_WAIT;
+    else if(securemapcheck(name, false)) return;
+    else
+    {
+        extern int autogetmap;
+        if(cgzsize >= 10 && autogetmap) addmsg(SV_NEXTMAP, "rs", name); // server sends the map on the file channel
+        else if(local <= 0 && !prefetchpackage(PCK_MAP, name)) return;
+        nextmap.stage = MPF_FETCH;
+        DEBUG("prefetching next map " << name << " (mode " << mode << ", revision " << revision << ")");
+    }
+}
+
+void pollmapprefetch()
+{
+    pollprefetchpackage();
+    static int lastcheck = 0;
+    switch(nextmap.stage)
+    {
+        case MPF_FETCH: // wait for the map file to arrive
+            if(totalmillis - lastcheck < 500) break;
+            lastcheck = totalmillis;
+            if(totalmillis - nextmap.started > MAPPREFETCHTIMEOUT) nextmap.stage = MPF_NONE;
+            else
+            {
+                int local = localmapsize(nextmap.name);
+                if(local > 0 && (nextmap.cgzsize < 10 || local == nextmap.cgzsize)) nextmap.stage = MPF_WAIT;
+            }
+            break;
+
+        case MPF_WAIT: // prepare the map in the last minute of the game (keeps the memory footprint low during the game)
+        {
+            extern bool intermission;
+            extern int minutesremaining;
+            if((intermission || minutesremaining <= 1) && !startmapprepare()) nextmap.stage = MPF_NONE;
+            break;
+        }
+
+        case MPF_PREPARE:
+            if(nextmap.done)
+            {
+                joinpreparethread();
+                if(nextmap.prepared->err) resetmapprefetch(); // load_world() will report the error
+                else nextmap.stage = MPF_READY;
+            }
+            break;
+    }
+}
+
+preparedmap *takeprefetchedmap(const char *name, const char *fname) // hand over the prepared map, if it is still current
+{
+    if(nextmap.stage == MPF_NONE || strcmp(nextmap.name, behindpath(name))) return NULL;
+    joinpreparethread(); // map change came early: waiting for the thread is still faster than starting over
+    preparedmap *pm = NULL;
+    if(nextmap.prepared && !nextmap.prepared->err && getfilesize(fname) == nextmap.filesize)
+    {
+        pm = nextmap.prepared;
+        nextmap.prepared = NULL;
+    }
+    resetmapprefetch();
+    return pm;
+}
+
 static string lastloadedconfigfile;
 
 int load_world(char *mname)        // still supports all map formats that have existed since the earliest cube betas!
 {
-    const int sizeof_header = sizeof(header), sizeof_baseheader = sizeof_header - sizeof(int) * 16;
     stopwatch watch;
     watch.start();
 
@@ -847,38 +1151,27 @@ int load_world(char *mname)        // still supports all map formats that have e
         conoutf("\f3Invalid map name. It must only contain letters, digits, '-', '_' and be less than %d characters long", MAXMAPNAMELEN);
         return -1;
     }
-    stream *f = opengzfile(cgzname, "rb");
-    if(!f) { conoutf("\f3could not read map %s", cgzname); return -2; }
-    if(unsavededits) xmapbackup("load_map_", mname);
-    unsavededits = 0;
-    DEBUG("reading map \"" << cgzname << "\"");
-    header tmp;
-    memset(&tmp, 0, sizeof_header);
-    if(f->read(&tmp, sizeof_baseheader) != sizeof_baseheader ||
-       (strncmp(tmp.head, "CUBE", 4)!=0 && strncmp(tmp.head, "ACMP",4)!=0)) { conoutf("\f3while reading map: header malformatted (1)"); delete f; return -3; }
-    lilswap(&tmp.version, 4); // version, headersize, sfactor, numents
-    if(tmp.version > MAPVERSION) { conoutf("\f3this map requires a newer version of AssaultCube"); delete f; return -4; }
-    if(tmp.sfactor<SMALLEST_FACTOR || tmp.sfactor>LARGEST_FACTOR || tmp.numents > MAXENTITIES) { conoutf("\f3illegal map size"); delete f; return -5; }
-    tmp.headersize = fixmapheadersize(tmp.version, tmp.headersize);
-    int restofhead = min(tmp.headersize, sizeof_header) - sizeof_baseheader;
-    if(f->read(&tmp.waterlevel, restofhead) != restofhead) { conoutf("\f3while reading map: header malformatted (2)"); delete f; return -6; }
-    DEBUG("version " << tmp.version << " headersize " << tmp.headersize << " headerextrasize " << tmp.headersize - int(sizeof(header)) << " entities " << tmp.numents << " factor " << tmp.sfactor << " revision " << tmp.maprevision);
-    clearheaderextras();
-    if(tmp.headersize > sizeof_header)
+    preparedmap *pm = takeprefetchedmap(mname, cgzname);
+    if(!pm)
     {
-        int extrasize = tmp.headersize - sizeof_header;
-        if(tmp.version < 9) extrasize = 0;  // throw away mediareq...
-        else if(extrasize > MAXHEADEREXTRA) extrasize = MAXHEADEREXTRA;
-        if(extrasize)
-        { // map file actually has extra header data that we want too preserve
-            uchar *extrabuf = new uchar[extrasize];
-            if(f->read(extrabuf, extrasize) != extrasize) { conoutf("\f3while reading map: header malformatted (3)"); delete f; delete[] extrabuf; return -7; }
-            unpackheaderextra(extrabuf, extrasize);
-            delete[] extrabuf;
+        stream *f = opengzfile(cgzname, "rb");
+        if(!f) { conoutf("\f3could not read map %s", cgzname); return -2; }
+        DEBUG("reading map \"" << cgzname << "\"");
+        pm = new preparedmap;
+        if(preparemap(*pm, f, false))
+        {
+            conoutf("\f3%s", pm->errmsg);
+            int err = pm->err;
+            delete pm;
+            return err;
         }
-        f->seek(tmp.headersize, SEEK_SET);
     }
-    hdr = tmp;
+    if(unsavededits) xmapbackup("load_map_", mname);
+    unsavededits = 0;
+    DEBUG("version " << pm->hdr.version << " headersize " << pm->hdr.headersize << " headerextrasize " << pm->hdr.headersize - int(sizeof(header)) << " entities " << pm->hdr.numents << " factor " << pm->hdr.sfactor << " revision " << pm->hdr.maprevision);
+    clearheaderextras();
+    if(pm->extrasize) unpackheaderextra(pm->extra, pm->extrasize);
+    hdr = pm->hdr;
     mapconfigdata.clear();
     rebuildtexlists();
     loadingscreen("%s", hdr.maptitle);
@@ -902,24 +1195,13 @@ int load_world(char *mname)        // still supports all map formats that have e
     mapoverride_limitwaveheight = (hdr.flags & MHF_LIMITWATERWAVEHEIGHT) ? 1 : 0;
     mapoverride_nostencilshadows = (hdr.flags & MHF_DISABLESTENCILSHADOWS) ? 1 : 0;
 
-    // read and convert all entities
+    // convert entities of old map formats
     cleartodoentities();
-    persistent_entity *tempents = new persistent_entity[hdr.numents];
-    bool oldentityformat = hdr.version < 10; // version < 10 have only 4 attributes and no scaling
-    loopi(hdr.numents)
+    persistent_entity *tempents = pm->ents;
+    if(hdr.version < 10) loopi(hdr.numents) // version < 10 have only 4 attributes and no scaling
     {
         persistent_entity &e = tempents[i];
-        f->read(&e, oldentityformat ? 12 : sizeof(persistent_entity));
-        lilswap((short *)&e, 4);
-        if(oldentityformat) e.attr5 = e.attr6 = e.attr7 = 0;
-        else lilswap(&e.attr5, 1);
-        if(e.type == LIGHT && e.attr1 >= 0)
-        {
-            if(!e.attr2) e.attr2 = 255; // needed for MAPVERSION<=2
-            if(e.attr1 > 32) e.attr1 = 32; // 12_03 and below (but applied to _all_ files!)
-        }
-        transformoldentitytypes(hdr.version, e.type);
-        if(oldentityformat && e.type < MAXENTTYPES)
+        if(e.type < MAXENTTYPES)
         {
             if(e.type == CTF_FLAG || e.type == MAPMODEL) e.attr1 = e.attr1 + 7 - (e.attr1 + 7) % 15;  // round the angle to the nearest 15-degree-step, like old versions did during rendering
             if(e.type == LIGHT && e.attr1 < 0) e.attr1 = 0; // negative lights had no meaning before version 10
@@ -950,60 +1232,34 @@ int load_world(char *mname)        // still supports all map formats that have e
         memcpy(&e, &tempents[i], sizeof(persistent_entity));
         e.spawned = false;
     }
-    delete[] tempents;
 
-    // read world geometry
+    // take over the decoded world geometry
     delete[] world;
-    setupworld(hdr.sfactor);
+    setupworld(hdr.sfactor, pm->world);
+    pm->world = NULL;
     if(!mapinfo.numelems || (mapinfo.access(mname) && !cmpf(cgzname, mapinfo[mname]))) world = (sqr *)ents.getbuf();
-    c2skeepalive();
-
-    vector<uchar> rawcubes; // fetch whole file into buffer
-    loopi(9)
+    if(!pm->decodeok)
     {
-        ucharbuf q = rawcubes.reserve(cubicsize);
-        q.len = f->read(q.buf, cubicsize);
-        rawcubes.addbuf(q);
-        if(q.len < cubicsize) break;
+        conoutf("\f3while reading map: broken world geometry");
+        res |= LWW_DECODEERR;
     }
-    delete f;
-    ucharbuf uf(rawcubes.getbuf(), rawcubes.length());
-    res |= rldecodecubes(uf, world, cubicsize, hdr.version, false) ? 0 : LWW_DECODEERR; // decode file
     c2skeepalive();
 
-    // calculate map statistics
-    servsqr *smallworld = createservworld(world, cubicsize);
-    int we = calcmapdims(clmapdims, smallworld, ssize);
+    // map statistics
+    clmapdims = pm->mapdims;
+    int we = pm->worlderror;
     if(we) conoutf("world error %d", we);
     res |= LWW_WORLDERROR * (iabs(we) & 0xf);
-    delete[] smallworld;
-
-
 
     DELETEA(mlayout);
-    mlayout = new char[cubicsize + 256];
-    memset(mlayout, 0, cubicsize * sizeof(char));
-    Mv = Ma = Hhits = 0;
+    mlayout = pm->mlayout;
+    pm->mlayout = NULL;
+    Mv = pm->Mv;
+    Ma = pm->Ma;
+    Hhits = pm->Hhits;
     char texuse[256];
-    loopi(256) texuse[i] = 0;
-    loopk(cubicsize)
-    {
-        sqr *s = &world[k];
-        if(SOLID(s)) mlayout[k] = 127;
-        else
-        {
-            mlayout[k] = s->floor; // FIXME
-            int diff = s->ceil - s->floor;
-            if(diff > 6)
-            {
-                if(diff > MAXMHEIGHT) Hhits += diff - MAXMHEIGHT;
-                Ma += 1;
-                Mv += diff;
-            }
-            texuse[s->utex] = texuse[s->ftex] = texuse[s->ctex] = 1;
-        }
-        texuse[s->wtex] = 1;
-    }
+    memcpy(texuse, pm->texuse, sizeof(texuse));
+    delete pm;
     Mh = Ma ? (float)Mv/Ma : 0;
 
     c2skeepalive();
@@ -1028,7 +1284,7 @@ int load_world(char *mname)        // still supports all map formats that have e
     c2skeepalive();
 
     watch.start();
-    loopi(256) if(texuse[i]) lookupworldtexture(i, autodownload ? true : false);
+    loadworldtextures(texuse, autodownload ? true : false);
     int texloadtime = watch.elapsed();
 
     c2skeepalive();
@@ -1048,7 +1304,7 @@ int load_world(char *mname)        // still supports all map formats that have e
 
     watch.start();
     int downloaded = downloadpackages();
-    if(downloaded > 0) clientlogf("downloaded content (%d KB in %d seconds)", downloaded/1024, watch.elapsed()/1000);
+    if(downloaded > 0) clientlogf("downloaded or cached content (%d KB in %d seconds)", downloaded/1024, watch.elapsed()/1000);
 
     c2skeepalive();
 
@@ -59,9 +59,12 @@ struct ziparchive // zip archive file
     vector<zipfile> files;
     int openfiles;
     zipstream *owner;
+    const uchar *map;   // whole zip file mapped into memory (or NULL)
+    int mapsize, maprefs;
+    void *maphandle;
 
-    ziparchive() : name(NULL), data(NULL), openfiles(0), owner(NULL) { }
-    ~ziparchive() { DELSTRING(name); DELETEP(data); }
+    ziparchive() : name(NULL), data(NULL), openfiles(0), owner(NULL), map(NULL), mapsize(0), maprefs(0), maphandle(NULL) { }
+    ~ziparchive() { DELSTRING(name); DELETEP(data); unmapfile(map, mapsize, maphandle); }
 };
 
 struct memfile
@@ -170,7 +173,7 @@ static bool readzipdirectory(stream *f, int entries, int offset, int size, vecto
 
 static bool readlocalfileheader(stream *f, ziplocalfileheader &h, uint offset)
 {
-    f->seek(offset, SEEK_SET);
+    if(!f->seek(offset, SEEK_SET)) return false;
     uchar buf[ZIP_LOCAL_FILE_SIZE];
     if(f->read(buf, ZIP_LOCAL_FILE_SIZE) != ZIP_LOCAL_FILE_SIZE)
         return false;
@@ -191,6 +194,21 @@ static bool readlocalfileheader(stream *f, ziplocalfileheader &h, uint offset)
     return true;
 }
 
+static bool findzipdata(ziparchive *a, zipfile *zf) // locate file data behind the local header, check against the mapped size
+{
+    if(zf->offset == ~0U)
+    {
+        ziplocalfileheader h;
+        if(a->map && uint64_t(zf->header) + ZIP_LOCAL_FILE_SIZE > uint64_t(a->mapsize)) return false;
+        a->owner = NULL;
+        if(!readlocalfileheader(a->data, h, zf->header)) return false;
+        zf->offset = zf->header + ZIP_LOCAL_FILE_SIZE + h.namelength + h.extralength;
+    }
+    if(!a->map) return true;
+    uint64_t len = zf->compressedsize ? zf->compressedsize : zf->size; // (sizes from the zip directory can't be trusted - don't let them wrap)
+    return uint64_t(zf->offset) <= uint64_t(a->mapsize) && len <= uint64_t(a->mapsize) - zf->offset;
+}
+
 // stream interface
 
 struct zipstream : stream
@@ -223,6 +241,14 @@ struct zipstream : stream
 
     void readbuf(uint size = BUFSIZE)
     {
+        if(arch->map)
+        { // mapped archive: hand the whole remaining compressed data to inflate, no copying
+            zfile.next_in = (Bytef *)arch->map + reading - zfile.avail_in;
+            uint remaining = info->offset + info->compressedsize - reading;
+            zfile.avail_in += remaining;
+            reading += remaining;
+            return;
+        }
         if(!zfile.avail_in) zfile.next_in = (Bytef *)buf;
         size = min(size, uint(&buf[BUFSIZE] - &zfile.next_in[zfile.avail_in]));
         if(arch->owner != this)
@@ -239,13 +265,7 @@ struct zipstream : stream
 
     bool open(ziparchive *a, zipfile *zf)
     {
-        if(zf->offset == ~0U)
-        {
-            ziplocalfileheader h;
-            a->owner = NULL;
-            if(!readlocalfileheader(a->data, h, zf->header)) return false;
-            zf->offset = zf->header + ZIP_LOCAL_FILE_SIZE + h.namelength + h.extralength;
-        }
+        if(!findzipdata(a, zf)) return false;
 
         if(zf->compressedsize && inflateInit2(&zfile, -MAX_WBITS) != Z_OK) return false;
 
@@ -254,7 +274,7 @@ struct zipstream : stream
         info = zf;
         reading = zf->offset;
         ended = false;
-        if(zf->compressedsize) buf = new uchar[BUFSIZE];
+        if(zf->compressedsize && !a->map) buf = new uchar[BUFSIZE];
         return true;
     }
 
@@ -323,7 +343,7 @@ struct zipstream : stream
         if(pos >= (long)zfile.total_out) pos -= zfile.total_out;
         else
         {
-            if(zfile.next_in && zfile.total_in <= uint(zfile.next_in - buf))
+            if(zfile.next_in && (arch->map || zfile.total_in <= uint(zfile.next_in - buf)))
             {
                 zfile.avail_in += zfile.total_in;
                 zfile.next_in -= zfile.total_in;
@@ -362,7 +382,8 @@ struct zipstream : stream
                 arch->owner = this;
             }
 
-            int n = (int)arch->data->read(buf, min(len, int(info->size + info->offset - reading)));
+            uint remaining = info->offset + info->size - reading;
+            int n = (int)arch->data->read(buf, int(min(uint(len), remaining)));
             reading += n;
             if(n < len) ended = true;
             return n;
@@ -427,18 +448,32 @@ static void mountzip(ziparchive &arch, const char *mountdir, const char *stripdi
     }
 }
 
+static void addzipfilehashtable(ziparchive *arch) // add files of a zip with lower priority than all mounted zips (existing entries win)
+{
+    loopv(arch->files)
+    {
+        zipfile *zf = &arch->files[i];
+        if(zf->fullname) zipfiles.access(zf->fullname, zf);
+    }
+}
+
 static void rebuildzipfilehashtable()
 {
     zipfiles.clear(false);
-    loopv(archives)
-    {
-        ziparchive *arch = archives[i];
-        loopvj(arch->files)
-        {
-            zipfile *zf = &arch->files[j];
-            if(zf->fullname) zipfiles.access(zf->fullname, zf);
-        }
+    loopv(archives) addzipfilehashtable(archives[i]);
+}
+
+static stream *openzipentry(ziparchive *arch, zipfile *zf)
+{
+    if(arch->map && !zf->compressedsize)
+    { // stored file in a mapped zip: read straight from the mapping
+        if(!findzipdata(arch, zf)) return NULL;
+        return openmemfile(arch->map + zf->offset, zf->size, &arch->openfiles);
     }
+    zipstream *s = new zipstream;
+    if(s->open(arch, zf)) return s;
+    delete s;
+    return NULL;
 }
 
 void clearmemfiles() // clear list of memfiles and free all associated buffers (unless there are files still open)
@@ -504,6 +539,7 @@ bool validzipmodname(char *name) // check for valid _downloadable_ zip mod name
 }
 
 VAR(zipcachemaxsize, 0, 512, 1024); // load zip files smaller than 512K straight into RAM
+VAR(zipmmap, 0, 1, 1); // map zip files into memory (instead of caching/reading them as streams)
 
 void addzipmod(char *name)
 {
@@ -523,14 +559,18 @@ void addzipmod(char *name)
     }
     ziparchive *arch = new ziparchive;
     arch->name = newstring(name);
-    if(!(arch->data = openfile(pname, "rb")))
+    if(zipmmap && (arch->map = mapfile(pname, arch->mapsize, arch->maphandle)))
+    {
+        arch->data = openmemfile(arch->map, arch->mapsize, &arch->maprefs);
+    }
+    else if(!(arch->data = openfile(pname, "rb")))
     {
         conoutf("could not open file %s", pname);
         delete arch;
         return;
     }
     int zipsize = arch->data->size();
-    if(zipsize > 0 && zipsize < zipcachemaxsize * 1024)
+    if(!arch->map && zipsize > 0 && zipsize < zipcachemaxsize * 1024)
     {
         uchar *buf = new uchar[zipsize];
         if(arch->data->read(buf, zipsize) != zipsize)
@@ -552,8 +592,8 @@ void addzipmod(char *name)
     }
     mountzip(*arch, NULL, NULL, !strncmp(behindpath(name), "###", 3));
     archives.add(arch);
-    rebuildzipfilehashtable();
-    DEBUGCODE(clientlogf("added zipmod %s, %d bytes, %d files", pname, zipsize, arch->files.length()));
+    addzipfilehashtable(arch);
+    DEBUGCODE(clientlogf("added zipmod %s, %d bytes, %d files%s", pname, zipsize, arch->files.length(), arch->map ? ", mapped" : ""));
 }
 COMMAND(addzipmod, "s");
 
@@ -702,7 +742,7 @@ COMMAND(zipmodgetrevision, "s");
 
 void writezipmodconfig(stream *f)
 {
-    f->printf("zipcachemaxsize %d\n", zipcachemaxsize);
+    f->printf("zipcachemaxsize %d\nzipmmap %d\n", zipcachemaxsize, zipmmap);
     loopv(archives) f->printf("addzipmod %s\n", archives[i]->name);
 }
 
@@ -729,13 +769,7 @@ void *zipmanualopen(stream *f, vector<const char *> &files)
 stream *zipmanualstream(void *a, int n)
 {
     ziparchive *arch = (ziparchive *)a;
-    if(arch->files.inrange(n))
-    {
-        zipstream *s = new zipstream;
-        if(s->open(arch, &arch->files[n])) return s;
-        delete s;
-    }
-    return NULL;
+    return arch->files.inrange(n) ? openzipentry(arch, &arch->files[n]) : NULL;
 }
 
 int zipmanualread(void *a, int n, stream *f, int maxlen)
@@ -770,13 +804,7 @@ stream *openzipfile(const char *name, const char *mode)
     memfile *mf = memfiles.access(name);
     if(mf) return openmemfile(mf->buf, mf->len, &mf->refcnt);
     zipfile **zf = zipfiles.access(name);
-    if(zf && *zf)
-    {
-        zipstream *s = new zipstream;
-        if(s->open((*zf)->location, *zf)) return s;
-        delete s;
-    }
-    return NULL;
+    return zf && *zf ? openzipentry((*zf)->location, *zf) : NULL;
 }
 
 void listzipfiles(const char *dir, const char *ext, vector<char *> &files) // (does not list memfiles)